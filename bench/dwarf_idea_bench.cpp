@@ -0,0 +1,713 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "bssids_csv_parser.h"
+#include "cells_csv_parser.h"
+#include "compressed_block_index.h"
+#include "dwarf_idea_builder.h"
+#include "eytzinger_index.h"
+#include "idwarf_idea_builder.h"
+#include "ilocation_aggregator.h"
+#include "location_aggregator.h"
+#include "position_solver.h"
+#include "spatial_block_index.h"
+#include "utils.h"
+
+// Builder with fixed synthetic entries, its blocks and entropy coding tables are
+// computed once, as in the real build, so that each stage can be run on its own.
+template <int KeySize, int ExtraDataSize>
+class DwarfIdeaBuilderBenchmark
+{
+  public:
+    explicit DwarfIdeaBuilderBenchmark(size_t num_entries): builder_(DwarfIdeaBuilderOptions())
+    {
+        static_assert(KeySize <= sizeof(uint64_t), "Keys must fit into uint64_t");
+        // Sorted unique keys, the positions follow the random walk to mimic the
+        // locality of the real data.
+        std::mt19937_64 rng(num_entries);
+        std::normal_distribution<float> step_dist(0.0f, 0.01f);
+        uint64_t key = 0;
+        Point point(47.37f, 8.54f);
+        for (size_t i = 0; i < num_entries; ++i)
+        {
+            key += 1 + rng() % 64;
+            point.lat = std::min(80.0f, std::max(-80.0f, point.lat + step_dist(rng)));
+            point.lon = std::min(170.0f, std::max(-170.0f, point.lon + step_dist(rng)));
+            const Bytes key_bytes = asBytes(key, true);
+            builder_.addLocation(
+                std::string(key_bytes.end() - KeySize, key_bytes.end()), point.lat, point.lon,
+                std::string(ExtraDataSize, char(rng())));
+        }
+        builder_.mapKeys();
+        builder_.buildIndex();
+
+        std::ostringstream os;
+        builder_.encodePass(os, 0);
+        builder_.buildTables();
+        builder_.writeCodecHeader(os, builder_.keys_stream_);
+        builder_.writeCodecHeader(os, builder_.coords_stream_);
+    }
+
+    size_t getNumEntries() const { return builder_.keys_.size(); }
+
+    size_t getNumBlocks() const { return builder_.index_.size(); }
+
+    size_t getBlockSize(size_t block) const
+    {
+        const auto& index = builder_.index_;
+        return (block + 1 == index.size() ? builder_.keys_.size() : index[block + 1]) - index[block];
+    }
+
+    BlockInfo computeBlockInfo(size_t block) { return builder_.computeBlockInfo(block, getBlockSize(block)); }
+
+    Bytes encodeKeys(size_t block) { return builder_.encodeKeys(block, getBlockSize(block), 1); }
+
+    Bytes encodeCoords(const BlockInfo& block_info, size_t block)
+    {
+        return builder_.encodeCoords(block_info, block, getBlockSize(block));
+    }
+
+    Bytes compressBytes(const Bytes& input) { return builder_.compressBytes(input); }
+
+    Bytes entropyCompressKeys(const Bytes& input) { return builder_.entropyCompress(input, builder_.keys_stream_); }
+
+    Bytes entropyCompressCoords(const Bytes& input) { return builder_.entropyCompress(input, builder_.coords_stream_); }
+
+    // Splits all entries into blocks from scratch, returns the number of blocks.
+    size_t findIndexSplit()
+    {
+        std::vector<size_t> index(1, 0);
+        builder_.index_.swap(index);
+        builder_.findIndexSplit(0, builder_.keys_.size() - 1);
+        builder_.index_.swap(index);
+        return index.size();
+    }
+
+  private:
+    DwarfIdeaBuilder<KeySize, ExtraDataSize> builder_;
+};
+
+namespace {
+
+const size_t kNumQueries = 1 << 16;
+const size_t kNumCsvLines = 1 << 16;
+const size_t kNumPoints = 1 << 16;
+// Roughly 1% of the real cells DB, large enough for the index split to be representative.
+const size_t kNumBuilderEntries = 1 << 18;
+
+// Counts the hardware cache misses of the calling thread, if the platform allows it.
+class CacheMissesCounter
+{
+  public:
+    CacheMissesCounter()
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    ~CacheMissesCounter()
+    {
+        if (fd_ >= 0)
+        {
+            close(fd_);
+        }
+    }
+
+    bool available() const { return fd_ >= 0; }
+
+    void start()
+    {
+        ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    uint64_t stop()
+    {
+        ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t value = 0;
+        return read(fd_, &value, sizeof(value)) == sizeof(value) ? value : 0;
+    }
+
+  private:
+    int fd_;
+};
+
+// Sorted unique index keys + random queries within their range.
+struct IndexData
+{
+    std::vector<uint64_t> keys, queries;
+
+    explicit IndexData(size_t num_keys)
+    {
+        std::mt19937_64 rng(num_keys);
+        keys.resize(num_keys);
+        for (uint64_t& key: keys)
+        {
+            key = rng();
+        }
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        std::uniform_int_distribution<uint64_t> query_dist(keys.front(), keys.back());
+        queries.resize(kNumQueries);
+        for (uint64_t& query: queries)
+        {
+            query = query_dist(rng);
+        }
+    }
+};
+
+// Runs 'search' over all queries in every iteration, reports the per-query cache misses.
+template <typename Search>
+void runIndexBenchmark(benchmark::State& state, const IndexData& data, Search search)
+{
+    CacheMissesCounter counter;
+    uint64_t cache_misses = 0;
+    for (auto _: state)
+    {
+        if (counter.available())
+        {
+            counter.start();
+        }
+        for (uint64_t query: data.queries)
+        {
+            benchmark::DoNotOptimize(search(query));
+        }
+        if (counter.available())
+        {
+            cache_misses += counter.stop();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * data.queries.size());
+    if (counter.available())
+    {
+        state.counters["cache_misses_per_query"] = benchmark::Counter(
+            double(cache_misses) / (state.iterations() * data.queries.size()));
+    }
+}
+
+void BM_SortedIndexSearch(benchmark::State& state)
+{
+    IndexData data(state.range(0));
+    runIndexBenchmark(state, data, [&data](uint64_t query)
+    {
+        return std::upper_bound(data.keys.begin(), data.keys.end(), query) - data.keys.begin() - 1;
+    });
+}
+
+void BM_EytzingerIndexSearch(benchmark::State& state)
+{
+    IndexData data(state.range(0));
+    Bytes serialized = buildEytzingerIndex(data.keys);
+    // Serialized index is used in place, so needs to be aligned.
+    std::vector<uint64_t> aligned((serialized.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+    memcpy(aligned.data(), serialized.data(), serialized.size());
+    EytzingerIndex index;
+    if (!index.reset((const uint8_t*)aligned.data(), serialized.size(), data.keys.size()))
+    {
+        state.SkipWithError("Eytzinger index is not supported on this platform");
+        return;
+    }
+    runIndexBenchmark(state, data, [&index](uint64_t query)
+    {
+        return index.findLastNotGreater(query);
+    });
+}
+
+void BM_CompressedIndexSearch(benchmark::State& state)
+{
+    IndexData data(state.range(0));
+    // Offsets of the typical ~2 KB blocks.
+    std::vector<uint64_t> offsets(data.keys.size());
+    for (size_t i = 0; i < offsets.size(); ++i)
+    {
+        offsets[i] = i * 2048 + i % 256;
+    }
+    Bytes serialized = buildCompressedBlockIndex(data.keys, offsets, kDefaultCompressedBlockIndexGroupSize);
+    CompressedBlockIndex index;
+    size_t index_size = 0;
+    if (!index.reset(serialized.data(), serialized.size(), data.keys.size(), index_size))
+    {
+        state.SkipWithError("Failed to load compressed index");
+        return;
+    }
+    runIndexBenchmark(state, data, [&index](uint64_t query)
+    {
+        size_t block_index = 0;
+        index.find(query, block_index);
+        return block_index;
+    });
+    state.counters["bytes_per_block"] = benchmark::Counter(double(index_size) / data.keys.size());
+}
+
+// Block boxes of up to 64 grid steps (~20 km with 16 bits) at the random points of the
+// square region that they cover about once, as the blocks of the real data do, and the
+// queries of 8 grid steps within the same region.
+struct SpatialData
+{
+    std::vector<GridBox> boxes, queries;
+
+    explicit SpatialData(size_t num_blocks)
+    {
+        std::mt19937 rng(num_blocks);
+        std::uniform_int_distribution<uint32_t> coord_dist(0, uint32_t(std::sqrt(double(num_blocks)) * 32));
+        std::uniform_int_distribution<uint32_t> size_dist(0, 64);
+        boxes.resize(num_blocks);
+        for (GridBox& box: boxes)
+        {
+            box.lat_min = coord_dist(rng);
+            box.lon_min = coord_dist(rng);
+            box.lat_max = box.lat_min + size_dist(rng);
+            box.lon_max = box.lon_min + size_dist(rng);
+        }
+        // Fewer queries than for the key lookups, so that the linear scan completes in reasonable time.
+        queries.resize(kNumQueries / 64);
+        for (GridBox& query: queries)
+        {
+            query.lat_min = coord_dist(rng);
+            query.lon_min = coord_dist(rng);
+            query.lat_max = query.lat_min + 8;
+            query.lon_max = query.lon_min + 8;
+        }
+    }
+};
+
+void BM_SpatialIndexQuery(benchmark::State& state)
+{
+    SpatialData data(state.range(0));
+    Bytes serialized = buildSpatialBlockIndex(data.boxes, 16, kDefaultSpatialBlockIndexNodeSize);
+    SpatialBlockIndex index;
+    size_t index_size = 0;
+    if (!index.reset(serialized.data(), serialized.size(), data.boxes.size(), index_size))
+    {
+        state.SkipWithError("Failed to load spatial index");
+        return;
+    }
+    std::vector<size_t> blocks;
+    size_t num_found = 0;
+    for (auto _: state)
+    {
+        for (const GridBox& query: data.queries)
+        {
+            blocks.clear();
+            index.find(query, blocks);
+            num_found += blocks.size();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * data.queries.size());
+    state.counters["blocks_per_query"] = benchmark::Counter(
+        double(num_found) / (state.iterations() * data.queries.size()));
+    state.counters["bytes_per_block"] = benchmark::Counter(double(index_size) / data.boxes.size());
+}
+
+// The baseline for BM_SpatialIndexQuery: checks the boxes of all blocks.
+void BM_SpatialLinearScan(benchmark::State& state)
+{
+    SpatialData data(state.range(0));
+    std::vector<size_t> blocks;
+    for (auto _: state)
+    {
+        for (const GridBox& query: data.queries)
+        {
+            blocks.clear();
+            for (size_t i = 0; i < data.boxes.size(); ++i)
+            {
+                if (data.boxes[i].intersects(query))
+                {
+                    blocks.push_back(i);
+                }
+            }
+            benchmark::DoNotOptimize(blocks.data());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * data.queries.size());
+}
+
+// Scans with 'range(0)' anchors scattered around the same point + 10% of outliers far away.
+void BM_SolvePosition(benchmark::State& state)
+{
+    const size_t num_anchors = state.range(0);
+    std::mt19937 rng(num_anchors);
+    std::normal_distribution<float> offset_dist(0.0f, 0.0005f);
+    std::uniform_real_distribution<float> signal_dist(-100.0f, -40.0f);
+    std::vector<std::vector<Anchor>> scans(256);
+    for (auto& scan: scans)
+    {
+        for (size_t i = 0; i < num_anchors; ++i)
+        {
+            const bool outlier = i < num_anchors / 10;
+            const Point point(47.37f + offset_dist(rng) + (outlier ? 0.1f : 0.0f), 8.54f + offset_dist(rng));
+            scan.push_back(Anchor{point, 100.0f, int(rng() % 16), signal_dist(rng)});
+        }
+    }
+    PositionSolverOptions options;
+    PositionEstimate estimate;
+    for (auto _: state)
+    {
+        for (const auto& scan: scans)
+        {
+            benchmark::DoNotOptimize(solvePosition(scan, options, estimate));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * scans.size());
+}
+
+
+// Discards the parsed entries, only counts them.
+class CountingAggregator: public ILocationAggregator
+{
+  public:
+    void addLocation(const Bytes& key, float lat, float lon, int radius, int samples) override { ++num_entries; }
+
+    void aggregate(IDwarfIdeaBuilder& builder) override {}
+
+    size_t num_entries = 0;
+};
+
+class CountingBuilder: public IDwarfIdeaBuilder
+{
+  public:
+    void addLocation(const std::string& key, float lat, float lon, const std::string& extra_data) override
+    {
+        ++num_entries;
+    }
+
+    void build(std::ostream& os) override {}
+
+    void verify(const std::string& path) const override {}
+
+    size_t num_entries = 0;
+};
+
+// Cells in OpenCellID / MLS format, the way they are stored in the exports.
+std::string makeCellsCsv(size_t num_lines)
+{
+    std::mt19937 rng(num_lines);
+    std::uniform_real_distribution<float> lat_dist(-60.0f, 70.0f), lon_dist(-180.0f, 180.0f);
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(7);
+    os << "radio,mcc,net,area,cell,unit,lon,lat,range,samples,changeable,created,updated,averageSignal\n";
+    for (size_t i = 0; i < num_lines; ++i)
+    {
+        os << (i % 3 ? "LTE" : "GSM") << ',' << 200 + rng() % 600 << ',' << rng() % 100 << ',' << rng() % 65536 <<
+            ',' << rng() % 268435456 << ",," << lon_dist(rng) << ',' << lat_dist(rng) << ',' << 100 + rng() % 5000 <<
+            ',' << 1 + rng() % 100 << ",1,1459692000,1579024000,\n";
+    }
+    return os.str();
+}
+
+// BSSIDs in the tab-separated format.
+std::string makeBssidsCsv(size_t num_lines)
+{
+    std::mt19937_64 rng(num_lines);
+    std::uniform_real_distribution<float> lat_dist(-60.0f, 70.0f), lon_dist(-180.0f, 180.0f);
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(7);
+    os << "bssid\tlat\tlon\n";
+    for (size_t i = 0; i < num_lines; ++i)
+    {
+        os << std::hex << std::setw(12) << std::setfill('0') << (rng() & 0xFFFFFFFFFFFFull) << std::dec <<
+            '\t' << lat_dist(rng) << '\t' << lon_dist(rng) << '\n';
+    }
+    return os.str();
+}
+
+template <typename Parser>
+void runCsvParserBenchmark(benchmark::State& state, const std::string& data, size_t num_lines)
+{
+    for (auto _: state)
+    {
+        Parser parser;
+        CountingAggregator aggregator;
+        CsvParser& csv_parser = parser;
+        csv_parser.reset();
+        csv_parser.parse(data.data(), data.size(), aggregator);
+        csv_parser.parse(nullptr, 0, aggregator);
+        if (aggregator.num_entries != num_lines)
+        {
+            state.SkipWithError("Not all lines were parsed");
+            return;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * num_lines);
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+// Same blacklist as the builder uses by default, GSM and LTE lines pass through it.
+class DefaultCellsCsvParser: public CellsCsvParser
+{
+  public:
+    DefaultCellsCsvParser(): CellsCsvParser("CDMA,1xRTT,eHRPD,EVDO_0,EVDO_A,EVDO_B") {}
+};
+
+void BM_CellsCsvParser(benchmark::State& state)
+{
+    static const std::string data = makeCellsCsv(kNumCsvLines);
+    runCsvParserBenchmark<DefaultCellsCsvParser>(state, data, kNumCsvLines);
+}
+
+void BM_BssidsCsvParser(benchmark::State& state)
+{
+    static const std::string data = makeBssidsCsv(kNumCsvLines);
+    runCsvParserBenchmark<BssidsCsvParser>(state, data, kNumCsvLines);
+}
+
+typedef LocationAggregator<kCellKeySize, kCellExtraDataSize> CellsLocationAggregator;
+
+// Cells keys where ~1/4 of the keys are reported twice, by different data sources.
+std::vector<Bytes> makeCellsKeys(size_t num_keys)
+{
+    std::mt19937 rng(num_keys);
+    std::vector<Bytes> keys;
+    while (keys.size() < num_keys)
+    {
+        Bytes key;
+        appendBytes(asBytes(uint16_t(200 + rng() % 600), true), key);
+        appendBytes(asBytes(uint16_t(rng() % 100), true), key);
+        appendBytes(asBytes(uint16_t(rng()), true), key);
+        appendBytes(asBytes(uint32_t(rng()), true), key);
+        keys.push_back(key);
+        if (rng() % 4 == 0)
+        {
+            keys.push_back(key);
+        }
+    }
+    return keys;
+}
+
+void addCellsLocations(const std::vector<Bytes>& keys, CellsLocationAggregator& aggregator)
+{
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        aggregator.addLocation(keys[i], 47.37f + 1e-4f * (i % 7), 8.54f, 1000, 1 + i % 10);
+    }
+}
+
+void BM_AggregatorAddLocation(benchmark::State& state)
+{
+    static const std::vector<Bytes> keys = makeCellsKeys(kNumCsvLines);
+    for (auto _: state)
+    {
+        std::unique_ptr<CellsLocationAggregator> aggregator(new CellsLocationAggregator());
+        addCellsLocations(keys, *aggregator);
+        state.PauseTiming();
+        aggregator.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+void BM_AggregatorAggregate(benchmark::State& state)
+{
+    const std::vector<Bytes> keys = makeCellsKeys(kNumCsvLines);
+    CellsLocationAggregator aggregator;
+    addCellsLocations(keys, aggregator);
+    for (auto _: state)
+    {
+        CountingBuilder builder;
+        aggregator.aggregate(builder);
+        benchmark::DoNotOptimize(builder.num_entries);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+void BM_GetDist(benchmark::State& state)
+{
+    std::mt19937 rng(kNumPoints);
+    std::uniform_real_distribution<float> lat_dist(-80.0f, 80.0f), lon_dist(-180.0f, 180.0f);
+    std::vector<Point> points;
+    for (size_t i = 0; i < kNumPoints; ++i)
+    {
+        points.emplace_back(lat_dist(rng), lon_dist(rng));
+    }
+    for (auto _: state)
+    {
+        for (size_t i = 1; i < points.size(); ++i)
+        {
+            benchmark::DoNotOptimize(getDist(points[i - 1], points[i]));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * (points.size() - 1));
+}
+
+// The builder stages run on BSSIDs-sized keys, as they don't need the cells
+// keys mapping, but on cells-like spatially local positions.
+typedef DwarfIdeaBuilderBenchmark<kBssidKeySize, kBssidExtraDataSize> BuilderBenchmark;
+
+BuilderBenchmark& getBuilderBenchmark()
+{
+    static BuilderBenchmark builder_benchmark(kNumBuilderEntries);
+    return builder_benchmark;
+}
+
+void BM_FindIndexSplit(benchmark::State& state)
+{
+    BuilderBenchmark& builder = getBuilderBenchmark();
+    for (auto _: state)
+    {
+        benchmark::DoNotOptimize(builder.findIndexSplit());
+    }
+    state.SetItemsProcessed(state.iterations() * builder.getNumEntries());
+}
+
+void BM_ComputeBlockInfo(benchmark::State& state)
+{
+    BuilderBenchmark& builder = getBuilderBenchmark();
+    for (auto _: state)
+    {
+        for (size_t i = 0; i < builder.getNumBlocks(); ++i)
+        {
+            benchmark::DoNotOptimize(builder.computeBlockInfo(i));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * builder.getNumEntries());
+}
+
+void BM_EncodeKeys(benchmark::State& state)
+{
+    BuilderBenchmark& builder = getBuilderBenchmark();
+    for (auto _: state)
+    {
+        for (size_t i = 0; i < builder.getNumBlocks(); ++i)
+        {
+            benchmark::DoNotOptimize(builder.encodeKeys(i));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * builder.getNumEntries());
+}
+
+void BM_EncodeCoords(benchmark::State& state)
+{
+    BuilderBenchmark& builder = getBuilderBenchmark();
+    std::vector<BlockInfo> blocks_info;
+    for (size_t i = 0; i < builder.getNumBlocks(); ++i)
+    {
+        blocks_info.push_back(builder.computeBlockInfo(i));
+    }
+    for (auto _: state)
+    {
+        for (size_t i = 0; i < builder.getNumBlocks(); ++i)
+        {
+            benchmark::DoNotOptimize(builder.encodeCoords(blocks_info[i], i));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * builder.getNumEntries());
+}
+
+// Encoded keys and coordinates of all blocks, either as is or after the transforms.
+std::vector<Bytes> getEncodedStreams(BuilderBenchmark& builder, bool transformed)
+{
+    std::vector<Bytes> streams;
+    for (size_t i = 0; i < builder.getNumBlocks(); ++i)
+    {
+        Bytes keys = builder.encodeKeys(i);
+        Bytes coords = builder.encodeCoords(builder.computeBlockInfo(i), i);
+        streams.push_back(transformed ? builder.compressBytes(keys) : keys);
+        streams.push_back(transformed ? builder.compressBytes(coords) : coords);
+    }
+    return streams;
+}
+
+void BM_CompressBytes(benchmark::State& state)
+{
+    BuilderBenchmark& builder = getBuilderBenchmark();
+    const std::vector<Bytes> streams = getEncodedStreams(builder, false);
+    size_t num_bytes = 0;
+    for (const Bytes& stream: streams)
+    {
+        num_bytes += stream.size();
+    }
+    for (auto _: state)
+    {
+        for (const Bytes& stream: streams)
+        {
+            benchmark::DoNotOptimize(builder.compressBytes(stream));
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * num_bytes);
+}
+
+void BM_EntropyCompress(benchmark::State& state)
+{
+    BuilderBenchmark& builder = getBuilderBenchmark();
+    const std::vector<Bytes> streams = getEncodedStreams(builder, true);
+    size_t num_bytes = 0;
+    for (const Bytes& stream: streams)
+    {
+        num_bytes += stream.size();
+    }
+    for (auto _: state)
+    {
+        for (size_t i = 0; i < streams.size(); i += 2)
+        {
+            benchmark::DoNotOptimize(builder.entropyCompressKeys(streams[i]));
+            benchmark::DoNotOptimize(builder.entropyCompressCoords(streams[i + 1]));
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * num_bytes);
+}
+
+}
+
+// Parsing and aggregation of the input data.
+BENCHMARK(BM_CellsCsvParser);
+BENCHMARK(BM_BssidsCsvParser);
+BENCHMARK(BM_AggregatorAddLocation);
+BENCHMARK(BM_AggregatorAggregate);
+BENCHMARK(BM_GetDist);
+// Build stages, in the order they run.
+BENCHMARK(BM_FindIndexSplit);
+BENCHMARK(BM_ComputeBlockInfo);
+BENCHMARK(BM_EncodeKeys);
+BENCHMARK(BM_EncodeCoords);
+BENCHMARK(BM_CompressBytes);
+BENCHMARK(BM_EntropyCompress);
+// From 4K blocks (fits into L1 / L2) to 4M blocks, the real DBs have ~250K blocks.
+BENCHMARK(BM_SortedIndexSearch)->RangeMultiplier(4)->Range(1 << 12, 1 << 22);
+BENCHMARK(BM_EytzingerIndexSearch)->RangeMultiplier(4)->Range(1 << 12, 1 << 22);
+BENCHMARK(BM_CompressedIndexSearch)->RangeMultiplier(4)->Range(1 << 12, 1 << 22);
+BENCHMARK(BM_SpatialIndexQuery)->RangeMultiplier(8)->Range(1 << 12, 1 << 18);
+BENCHMARK(BM_SpatialLinearScan)->RangeMultiplier(8)->Range(1 << 12, 1 << 18);
+// Typical scans have from a few cells to ~60 WiFi access points.
+BENCHMARK(BM_SolvePosition)->Arg(5)->Arg(20)->Arg(60);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,224 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "block_patch.h"
+
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include <glog/logging.h>
+
+namespace {
+
+const char* kPatchSignature = "DwarfIdeaPatch";
+const uint16_t kPatchVersion = 1;
+
+const uint64_t kFnvOffsetBasis = 14695981039346656037ull;
+const uint64_t kFnvPrime = 1099511628211ull;
+
+uint64_t updateHash(uint64_t hash, const uint8_t* data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash = (hash ^ data[i]) * kFnvPrime;
+    }
+    return hash;
+}
+
+struct Block
+{
+    const uint8_t* data;
+    size_t size;
+
+    bool operator==(const Block& other) const
+    {
+        return size == other.size && !memcmp(data, other.data, size);
+    }
+};
+
+std::vector<Block> getBlocks(const DwarfIdeaReader& db)
+{
+    std::vector<Block> blocks(db.getNumBlocks());
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        uint64_t first_key = 0;
+        CHECK(db.getBlockData(i, first_key, blocks[i].data, blocks[i].size)) << "Malformed block " << i;
+    }
+    return blocks;
+}
+
+}
+
+Bytes createBlockPatch(const DwarfIdeaReader& old_db, const DwarfIdeaReader& new_db, BlockPatchStats* stats)
+{
+    const std::vector<Block> old_blocks = getBlocks(old_db);
+    const std::vector<Block> new_blocks = getBlocks(new_db);
+    std::unordered_multimap<uint64_t, size_t> old_blocks_map;
+    for (size_t i = 0; i < old_blocks.size(); ++i)
+    {
+        old_blocks_map.insert(std::make_pair(updateHash(kFnvOffsetBasis, old_blocks[i].data, old_blocks[i].size), i));
+    }
+
+    Bytes patch(kPatchSignature, kPatchSignature + strlen(kPatchSignature));
+    appendBytes(asBytes(kPatchVersion), patch);
+    for (const DwarfIdeaReader* db: {&old_db, &new_db})
+    {
+        appendBytes(asBytes(uint64_t(db->getFileSize())), patch);
+        appendBytes(asBytes(updateHash(kFnvOffsetBasis, db->getFileData(), db->getFileSize())), patch);
+    }
+    const size_t prefix_size = new_db.getBlocksOffset();
+    appendBytes(asVarInt(prefix_size), patch);
+    patch.insert(patch.end(), new_db.getFileData(), new_db.getFileData() + prefix_size);
+
+    // Runs of the old blocks are continued while possible, as for the unchanged
+    // regions the consecutive new blocks match the consecutive old ones.
+    Bytes ops;
+    size_t num_ops = 0, num_copied_blocks = 0, literal_size = 0;
+    size_t run_begin = 0, run_size = 0;
+    auto flush_run = [&]()
+    {
+        if (run_size)
+        {
+            appendBytes(asVarInt(uint64_t(run_size) << 1), ops);
+            appendBytes(asVarInt(run_begin), ops);
+            ++num_ops;
+            num_copied_blocks += run_size;
+            run_size = 0;
+        }
+    };
+    for (const Block& block: new_blocks)
+    {
+        const size_t next_old_index = run_begin + run_size;
+        if (run_size && next_old_index < old_blocks.size() && old_blocks[next_old_index] == block)
+        {
+            ++run_size;
+            continue;
+        }
+        flush_run();
+        auto range = old_blocks_map.equal_range(updateHash(kFnvOffsetBasis, block.data, block.size));
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (old_blocks[it->second] == block)
+            {
+                run_begin = it->second;
+                run_size = 1;
+                break;
+            }
+        }
+        if (!run_size)
+        {
+            appendBytes(asVarInt((uint64_t(block.size) << 1) | 1), ops);
+            ops.insert(ops.end(), block.data, block.data + block.size);
+            ++num_ops;
+            literal_size += block.size;
+        }
+    }
+    flush_run();
+
+    appendBytes(asVarInt(num_ops), patch);
+    appendBytes(ops, patch);
+    if (stats)
+    {
+        stats->num_blocks = new_blocks.size();
+        stats->num_copied_blocks = num_copied_blocks;
+        stats->prefix_size = prefix_size;
+        stats->literal_size = literal_size;
+    }
+    return patch;
+}
+
+bool applyBlockPatch(const DwarfIdeaReader& old_db, const uint8_t* patch, size_t size, std::ostream& os)
+{
+    BytesReader reader(patch, patch + size);
+    const uint8_t* signature = nullptr;
+    const size_t signature_size = strlen(kPatchSignature);
+    uint16_t version = 0;
+    uint64_t old_size = 0, old_hash = 0, new_size = 0, new_hash = 0;
+    if (!reader.getBytes(signature_size, signature) || memcmp(signature, kPatchSignature, signature_size) ||
+        !reader.get(version) || version != kPatchVersion || !reader.get(old_size) || !reader.get(old_hash) ||
+        !reader.get(new_size) || !reader.get(new_hash))
+    {
+        LOG(ERROR) << "Not a DwarfIdea patch";
+        return false;
+    }
+    if (old_size != old_db.getFileSize() ||
+        old_hash != updateHash(kFnvOffsetBasis, old_db.getFileData(), old_db.getFileSize()))
+    {
+        LOG(ERROR) << "The patch was created for a different old file";
+        return false;
+    }
+
+    uint64_t written_size = 0, written_hash = kFnvOffsetBasis;
+    auto write = [&](const uint8_t* data, size_t size)
+    {
+        os.write((const char*)data, size);
+        written_size += size;
+        written_hash = updateHash(written_hash, data, size);
+    };
+
+    uint64_t prefix_size = 0, num_ops = 0;
+    const uint8_t* prefix = nullptr;
+    if (!reader.getVarInt(prefix_size) || !reader.getBytes(prefix_size, prefix) || !reader.getVarInt(num_ops))
+    {
+        LOG(ERROR) << "Malformed patch header";
+        return false;
+    }
+    write(prefix, prefix_size);
+    for (uint64_t i = 0; i < num_ops; ++i)
+    {
+        uint64_t op = 0, old_index = 0;
+        const uint8_t* data = nullptr;
+        size_t data_size = 0;
+        bool ok = reader.getVarInt(op);
+        if (ok && (op & 1))
+        {
+            ok = reader.getBytes(op >> 1, data);
+            if (ok)
+            {
+                write(data, op >> 1);
+            }
+        }
+        else if (ok)
+        {
+            ok = reader.getVarInt(old_index) && old_index < old_db.getNumBlocks() &&
+                (op >> 1) <= old_db.getNumBlocks() - old_index;
+            for (uint64_t j = 0; ok && j < (op >> 1); ++j)
+            {
+                uint64_t first_key = 0;
+                ok = old_db.getBlockData(old_index + j, first_key, data, data_size);
+                if (ok)
+                {
+                    write(data, data_size);
+                }
+            }
+        }
+        if (!ok)
+        {
+            LOG(ERROR) << "Malformed patch operation " << i;
+            return false;
+        }
+    }
+    if (reader.getPos() != patch + size || written_size != new_size || written_hash != new_hash)
+    {
+        LOG(ERROR) << "The patched file doesn't match the new file";
+        return false;
+    }
+    return bool(os);
+}
@@ -0,0 +1,60 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+#include "dwarf_idea_reader.h"
+#include "utils.h"
+
+// Block-aligned patches between two builds of the same DB.
+//
+// The blocks are opaque to the patch: the new file is reconstructed from its
+// prefix (everything before the first block: the header, the entropy coding
+// tables, the index and the filter), stored as is, followed by the blocks,
+// each either copied from the old file or stored as is. The blocks of the new
+// file are matched to the old ones by their encoded bytes, so the patch is only
+// small if the builds share entropy coding tables and blocks boundaries, see
+// 'DwarfIdeaBuilderOptions::previous_path'.
+//
+// Layout:
+// - "DwarfIdeaPatch" signature, u16 version;
+// - u64 size + u64 FNV-1a hash of the old file, same for the new file;
+// - varint size + the prefix of the new file;
+// - varint number of operations, each either varint (count << 1) + varint
+//   index of the first old block to copy 'count' consecutive blocks, or
+//   varint (size << 1) | 1 + the bytes of the single new block.
+
+struct BlockPatchStats
+{
+    size_t num_blocks = 0;
+    size_t num_copied_blocks = 0;
+    size_t prefix_size = 0;
+    size_t literal_size = 0;
+};
+
+// Creates the patch transforming 'old_db' to 'new_db'.
+Bytes createBlockPatch(const DwarfIdeaReader& old_db, const DwarfIdeaReader& new_db, BlockPatchStats* stats = nullptr);
+
+// Writes the new file reconstructed from 'old_db' and the patch, returns false
+// if the patch is malformed or was created for a different old file.
+bool applyBlockPatch(const DwarfIdeaReader& old_db, const uint8_t* patch, size_t size, std::ostream& os);
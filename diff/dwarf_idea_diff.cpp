@@ -0,0 +1,80 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include <glog/logging.h>
+#include <gflags/gflags.h>
+
+#include "block_patch.h"
+#include "dwarf_idea_reader.h"
+
+DEFINE_string(old_path, "", "Old DwarfIdea file.");
+DEFINE_string(new_path, "", "New DwarfIdea file, if set the patch from --old_path to it is written to --patch_path.");
+DEFINE_string(patch_path, "", "Patch file, written if --new_path is set and applied to --old_path otherwise.");
+DEFINE_string(output_path, "", "Where to write the new file reconstructed from --old_path and --patch_path.");
+
+namespace {
+
+bool readFile(const std::string& path, Bytes& data)
+{
+    std::ifstream is(path, std::ios::binary);
+    data.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+    return !is.bad() && is.is_open();
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    gflags::SetUsageMessage("Creates and applies block-aligned patches between two builds of DwarfIdea DB.");
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    google::InitGoogleLogging(argv[0]);
+
+    CHECK(!FLAGS_old_path.empty() && !FLAGS_patch_path.empty()) << "--old_path and --patch_path must be set";
+    DwarfIdeaReader old_db;
+    CHECK(old_db.open(FLAGS_old_path)) << "Failed to open " << FLAGS_old_path;
+
+    if (!FLAGS_new_path.empty())
+    {
+        DwarfIdeaReader new_db;
+        CHECK(new_db.open(FLAGS_new_path)) << "Failed to open " << FLAGS_new_path;
+        BlockPatchStats stats;
+        Bytes patch = createBlockPatch(old_db, new_db, &stats);
+        std::ofstream os(FLAGS_patch_path, std::ios::binary);
+        os.write((const char*)patch.data(), patch.size());
+        CHECK(os.flush()) << "Failed to write " << FLAGS_patch_path;
+        LOG(INFO) << "Patch: " << patch.size() << " bytes (" << 100.0 * patch.size() / new_db.getFileSize() <<
+            "% of the new file), " << stats.num_copied_blocks << " of " << stats.num_blocks <<
+            " blocks copied, prefix = " << stats.prefix_size << " bytes, changed blocks = " <<
+            stats.literal_size << " bytes";
+        return 0;
+    }
+
+    CHECK(!FLAGS_output_path.empty()) << "Either --new_path or --output_path must be set";
+    Bytes patch;
+    CHECK(readFile(FLAGS_patch_path, patch)) << "Failed to read " << FLAGS_patch_path;
+    std::ofstream os(FLAGS_output_path, std::ios::binary);
+    CHECK(applyBlockPatch(old_db, patch.data(), patch.size(), os) && os.flush()) <<
+        "Failed to apply " << FLAGS_patch_path;
+    LOG(INFO) << "Written " << FLAGS_output_path;
+    return 0;
+}
@@ -0,0 +1,421 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "dataset_generator.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <unordered_map>
+
+#include <glog/logging.h>
+
+#include "gzip_writer.h"
+
+namespace {
+
+// Countries are the cells of the coarse lat / lon grid, which gives 450 MCCs.
+constexpr float kCountryGridStep = 12.0f;
+constexpr int kCountryGridLons = 30;
+constexpr int kNumMccs = 600;
+constexpr int kMaxOperatorsPerCountry = 4;
+// Operators get the 2 digit MNCs, the 3 digit ones are left for the LACs overflow.
+constexpr unsigned kMaxOperatorMnc = 99;
+constexpr unsigned kMaxMnc = 999;
+constexpr uint64_t kNumLacs = 1 << 16;
+constexpr int kNumOuis = 4000;
+constexpr double kMetersPerDegree = 111320.0;
+// Fraction of the cells present only in OpenCellID files.
+constexpr double kOcidOnlyRatio = 0.1;
+// Fraction of the duplicates far away from the original position, e.g. due to
+// the bad GPS fix or the moved access point.
+constexpr double kFarDuplicateRatio = 0.05;
+constexpr double kNearDuplicateRadius = 100.0;
+constexpr double kFarDuplicateRadius = 20000.0;
+// Fraction of the access points exposing several consecutive BSSIDs.
+constexpr double kMultiBssidRatio = 0.3;
+// Timestamps of the observations, 2010 - 2020.
+constexpr int64_t kMinTimestamp = 1262304000;
+constexpr int64_t kMaxTimestamp = 1577836800;
+constexpr size_t kWriteBufferSize = 1 << 20;
+constexpr size_t kMaxRowSize = 256;
+
+const char* kCellsHeader = "radio,mcc,net,area,cell,unit,lon,lat,range,samples,changeable,created,updated,averageSignal\n";
+const char* kBssidsHeader = "id,bssid,lat,lon,updated,data\n";
+
+enum Radio { kGsm, kUmts, kLte, kCdma };
+const char* kRadioNames[] = { "GSM", "UMTS", "LTE", "CDMA" };
+// CDMA is blacklisted by the builder by default, so these rows are skipped.
+const double kRadioWeights[] = { 0.3, 0.25, 0.43, 0.02 };
+
+// Independent random streams for the world and for each shard of each kind.
+enum RandomStream { kWorldStream, kCellsStream, kBssidsStream };
+
+std::mt19937_64 makeRng(uint64_t seed, RandomStream stream, int shard)
+{
+    std::seed_seq seq{ uint32_t(seed), uint32_t(seed >> 32), uint32_t(stream), uint32_t(shard) };
+    return std::mt19937_64(seq);
+}
+
+// Point with normally distributed offsets around 'center', 'radius' is in meters.
+Point scatterPoint(const Point& center, double radius, std::mt19937_64& rng)
+{
+    std::normal_distribution<double> offset_dist(0.0, radius);
+    const double lat = std::min(85.0, std::max(-85.0, center.lat + offset_dist(rng) / kMetersPerDegree));
+    double lon = center.lon + offset_dist(rng) / (kMetersPerDegree * std::cos(lat * M_PI / 180.0));
+    lon = lon >= 180.0 ? lon - 360.0 : (lon < -180.0 ? lon + 360.0 : lon);
+    return Point(lat, lon);
+}
+
+// Position of the repeated observation of the same cell or access point.
+Point duplicatePoint(const Point& point, std::mt19937_64& rng)
+{
+    std::uniform_real_distribution<double> unit_dist;
+    return scatterPoint(point, unit_dist(rng) < kFarDuplicateRatio ? kFarDuplicateRadius : kNearDuplicateRadius, rng);
+}
+
+// Breaks the row the same ways the real dumps are broken.
+std::string corruptRow(std::string row, std::mt19937_64& rng)
+{
+    row.pop_back();
+    switch (rng() % 4)
+    {
+        case 0:
+            // Truncated line.
+            row.resize(rng() % row.size());
+            break;
+        case 1:
+        {
+            // Garbage in one of the numeric fields.
+            const size_t pos = row.find_first_of("0123456789", rng() % row.size());
+            row[pos == std::string::npos ? 0 : pos] = 'x';
+            break;
+        }
+        case 2:
+            // Extra column.
+            row.insert(rng() % row.size(), 1, ',');
+            break;
+        default:
+            row.clear();
+            break;
+    }
+    return row + '\n';
+}
+
+// Buffers the rows of the single output file.
+class RowsWriter
+{
+  public:
+    RowsWriter(): num_rows_(0), ok_(true) {}
+
+    bool open(const std::string& path, int compression_level, const char* header)
+    {
+        buffer_ = header;
+        ok_ = writer_.open(path, compression_level);
+        return ok_;
+    }
+
+    void addRow(const std::string& row)
+    {
+        buffer_ += row;
+        ++num_rows_;
+        if (buffer_.size() >= kWriteBufferSize)
+        {
+            ok_ = ok_ && writer_.write(buffer_);
+            buffer_.clear();
+        }
+    }
+
+    bool close()
+    {
+        ok_ = ok_ && writer_.write(buffer_);
+        return writer_.close() && ok_;
+    }
+
+    uint64_t getNumRows() const { return num_rows_; }
+
+    bool ok() const { return ok_; }
+
+  private:
+    GzipWriter writer_;
+    std::string buffer_;
+    uint64_t num_rows_;
+    bool ok_;
+};
+
+std::string formatCellRow(
+    Radio radio, unsigned mcc, unsigned mnc, unsigned lac, uint64_t cell, const Point& point,
+    int range, int samples, int64_t created, int64_t updated)
+{
+    char row[kMaxRowSize];
+    snprintf(row, sizeof(row), "%s,%u,%u,%u,%" PRIu64 ",,%.6f,%.6f,%d,%d,1,%" PRId64 ",%" PRId64 ",\n",
+        kRadioNames[radio], mcc, mnc, lac, cell, point.lon, point.lat, range, samples, created, updated);
+    return row;
+}
+
+std::string formatBssidRow(uint64_t id, uint64_t bssid, const Point& point, int64_t updated)
+{
+    char row[kMaxRowSize];
+    snprintf(row, sizeof(row), "%" PRIu64 ",%012" PRIX64 ",%.7f,%.7f,%" PRId64 ",\n",
+        id, bssid, point.lat, point.lon, updated);
+    return row;
+}
+
+}  // namespace
+
+DatasetGenerator::DatasetGenerator(const DatasetGeneratorOptions& options): options_(options)
+{
+    CHECK_GT(options_.num_shards, 0);
+    CHECK_GT(options_.num_cities, 0);
+
+    std::mt19937_64 rng = makeRng(options_.seed, kWorldStream, 0);
+    std::uniform_real_distribution<double> unit_dist;
+
+    std::vector<uint16_t> mccs(kNumMccs);
+    for (int i = 0; i < kNumMccs; ++i)
+    {
+        mccs[i] = 200 + i;
+    }
+    std::shuffle(mccs.begin(), mccs.end(), rng);
+
+    // Cities are mostly in the northern hemisphere, the populations follow the
+    // Pareto distribution and the size grows with the population.
+    std::unordered_map<int, size_t> countries_map;
+    for (int i = 0; i < options_.num_cities; ++i)
+    {
+        City city;
+        city.center = Point(-45.0 + 110.0 * std::sqrt(unit_dist(rng)), -180.0 + 360.0 * unit_dist(rng));
+        const double population = std::pow(1.0 - unit_dist(rng), -1.0 / 1.1);
+        city.radius = std::min(30000.0, 2000.0 * std::pow(population, 0.3));
+
+        const int grid_cell =
+            int((city.center.lat + 90.0f) / kCountryGridStep) * kCountryGridLons +
+            int((city.center.lon + 180.0f) / kCountryGridStep);
+        auto it = countries_map.find(grid_cell);
+        if (it == countries_map.end())
+        {
+            Country country;
+            country.mcc = mccs[countries_.size() % kNumMccs];
+            const int num_operators = 1 + rng() % kMaxOperatorsPerCountry;
+            while (country.mncs.size() < size_t(num_operators))
+            {
+                const uint16_t mnc = 1 + rng() % kMaxOperatorMnc;
+                if (std::find(country.mncs.begin(), country.mncs.end(), mnc) == country.mncs.end())
+                {
+                    country.mncs.push_back(mnc);
+                }
+            }
+            it = countries_map.emplace(grid_cell, countries_.size()).first;
+            countries_.push_back(country);
+        }
+        city.country = it->second;
+
+        cities_.push_back(city);
+        cities_weights_.push_back(population);
+    }
+
+    // Unicast, globally administered OUIs with Zipf-distributed popularity.
+    for (int i = 0; i < kNumOuis; ++i)
+    {
+        ouis_.push_back(rng() & 0xFCFFFF);
+        ouis_weights_.push_back(1.0 / (i + 1));
+    }
+}
+
+bool DatasetGenerator::generate(
+    const std::string& output_dir,
+    std::vector<std::string>& cells_paths,
+    std::vector<std::string>& bssids_paths) const
+{
+    const int num_shards = options_.num_shards;
+    auto getPath = [&output_dir](const char* prefix, int shard)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "%s-%05d.csv.gz", prefix, shard);
+        return output_dir + "/" + name;
+    };
+
+    bool ok = true;
+#pragma omp parallel for schedule(dynamic) reduction(&&: ok)
+    for (int task = 0; task < 2 * num_shards; ++task)
+    {
+        const int shard = task % num_shards;
+        if (task < num_shards)
+        {
+            ok = (!options_.cells_rows ||
+                generateCellsShard(shard, getPath("cells-mls", shard), getPath("cells-ocid", shard))) && ok;
+        }
+        else
+        {
+            ok = (!options_.bssids_rows || generateBssidsShard(shard, getPath("bssids", shard))) && ok;
+        }
+    }
+
+    for (int shard = 0; shard < num_shards; ++shard)
+    {
+        if (options_.cells_rows)
+        {
+            cells_paths.push_back(getPath("cells-mls", shard));
+            cells_paths.push_back(getPath("cells-ocid", shard));
+        }
+        if (options_.bssids_rows)
+        {
+            bssids_paths.push_back(getPath("bssids", shard));
+        }
+    }
+    return ok;
+}
+
+uint64_t DatasetGenerator::getShardRows(uint64_t total_rows, int shard) const
+{
+    return total_rows / options_.num_shards + (uint64_t(shard) < total_rows % options_.num_shards ? 1 : 0);
+}
+
+bool DatasetGenerator::generateCellsShard(int shard, const std::string& mls_path, const std::string& ocid_path) const
+{
+    std::mt19937_64 rng = makeRng(options_.seed, kCellsStream, shard);
+    std::uniform_real_distribution<double> unit_dist;
+    std::discrete_distribution<size_t> city_dist(cities_weights_.begin(), cities_weights_.end());
+    std::discrete_distribution<int> radio_dist(std::begin(kRadioWeights), std::end(kRadioWeights));
+    std::lognormal_distribution<double> range_dist(std::log(1000.0), 0.8);
+    std::geometric_distribution<int> samples_dist(0.1);
+    std::uniform_int_distribution<int64_t> time_dist(kMinTimestamp, kMaxTimestamp);
+    // Next LAC index per operator. LACs are interleaved between the shards, so that
+    // the shards don't generate the same keys. Once the 16 bits LACs of the operator
+    // are exhausted, it continues with the next MNC that is free for this, e.g. after
+    // the LACs of MNC 23 run out, MNC 123 is used.
+    std::unordered_map<uint32_t, uint64_t> lacs_counters;
+
+    RowsWriter mls_writer, ocid_writer;
+    if (!mls_writer.open(mls_path, options_.compression_level, kCellsHeader) ||
+        !ocid_writer.open(ocid_path, options_.compression_level, kCellsHeader))
+    {
+        return false;
+    }
+
+    auto addRow = [this, &rng, &unit_dist](RowsWriter& writer, std::string row)
+    {
+        writer.addRow(unit_dist(rng) < options_.malformed_ratio ? corruptRow(row, rng) : row);
+    };
+
+    const uint64_t num_rows = getShardRows(options_.cells_rows, shard);
+    while (mls_writer.getNumRows() + ocid_writer.getNumRows() < num_rows && mls_writer.ok() && ocid_writer.ok())
+    {
+        const City& city = cities_[city_dist(rng)];
+        const Country& country = countries_[city.country];
+        const uint16_t operator_mnc = country.mncs[rng() % country.mncs.size()];
+        const uint64_t lac_index = lacs_counters[(country.mcc << 16) | operator_mnc]++ * options_.num_shards + shard;
+        const uint64_t mnc_index = operator_mnc + lac_index / kNumLacs * (kMaxOperatorMnc + 1);
+        CHECK_LE(mnc_index, kMaxMnc) << "Out of LACs for MCC " << country.mcc << " MNC " << operator_mnc <<
+            ", increase --num_cities";
+        const uint16_t mnc = mnc_index;
+        const uint16_t lac = lac_index % kNumLacs;
+        const Radio radio = Radio(radio_dist(rng));
+        const Point lac_center = scatterPoint(city.center, city.radius, rng);
+        const double lac_radius = 500.0 + 2500.0 * unit_dist(rng);
+        const int num_cells = 20 + rng() % 180;
+        const uint32_t base_id = rng();
+
+        Point site;
+        for (int i = 0; i < num_cells; ++i)
+        {
+            uint64_t cell;
+            switch (radio)
+            {
+                case kUmts:
+                    // RNC + CID.
+                    cell = ((base_id >> 16) & 0xFFF) << 16 | ((base_id + i) & 0xFFFF);
+                    break;
+                case kLte:
+                    // eNB + sector, three sectors per site.
+                    cell = (((base_id & 0xFFFFF) + i / 3) & 0xFFFFF) << 8 | (i % 3);
+                    break;
+                default:
+                    cell = (base_id + i) & 0xFFFF;
+                    break;
+            }
+            if (radio != kLte || i % 3 == 0)
+            {
+                site = scatterPoint(lac_center, lac_radius, rng);
+            }
+            const int range = std::min(20000, std::max(100, int(range_dist(rng))));
+            const int samples = 1 + samples_dist(rng);
+            const int64_t created = time_dist(rng);
+            const int64_t updated = std::max(created, time_dist(rng));
+
+            const double source = unit_dist(rng);
+            const bool in_mls = source >= kOcidOnlyRatio;
+            const bool in_ocid = source < kOcidOnlyRatio + options_.duplicate_ratio;
+            if (in_mls)
+            {
+                addRow(mls_writer, formatCellRow(
+                    radio, country.mcc, mnc, lac, cell, site, range, samples, created, updated));
+            }
+            if (in_ocid)
+            {
+                addRow(ocid_writer, formatCellRow(
+                    radio, country.mcc, mnc, lac, cell, in_mls ? duplicatePoint(site, rng) : site,
+                    range, std::max(1, samples / 2), created, updated));
+            }
+        }
+    }
+
+    const bool mls_ok = mls_writer.close();
+    const bool ocid_ok = ocid_writer.close();
+    return mls_ok && ocid_ok;
+}
+
+bool DatasetGenerator::generateBssidsShard(int shard, const std::string& path) const
+{
+    std::mt19937_64 rng = makeRng(options_.seed, kBssidsStream, shard);
+    std::uniform_real_distribution<double> unit_dist;
+    std::discrete_distribution<size_t> city_dist(cities_weights_.begin(), cities_weights_.end());
+    std::discrete_distribution<size_t> oui_dist(ouis_weights_.begin(), ouis_weights_.end());
+    std::uniform_int_distribution<int64_t> time_dist(kMinTimestamp, kMaxTimestamp);
+
+    RowsWriter writer;
+    if (!writer.open(path, options_.compression_level, kBssidsHeader))
+    {
+        return false;
+    }
+
+    const uint64_t num_rows = getShardRows(options_.bssids_rows, shard);
+    for (uint64_t id = shard; writer.getNumRows() < num_rows && writer.ok(); )
+    {
+        // Access points are more concentrated in the city centers than cells.
+        const City& city = cities_[city_dist(rng)];
+        const Point point = scatterPoint(city.center, 0.5 * city.radius, rng);
+        const uint64_t bssid = uint64_t(ouis_[oui_dist(rng)]) << 24 | (rng() & 0xFFFFFF);
+        const int num_bssids = unit_dist(rng) < kMultiBssidRatio ? 2 + rng() % 3 : 1;
+        for (int i = 0; i < num_bssids; ++i)
+        {
+            const uint64_t cur_bssid = (bssid & ~0xFFull) | ((bssid + i) & 0xFF);
+            const int num_observations = unit_dist(rng) < options_.duplicate_ratio ? 2 + rng() % 2 : 1;
+            for (int j = 0; j < num_observations; ++j, id += options_.num_shards)
+            {
+                std::string row = formatBssidRow(
+                    id, cur_bssid, j ? duplicatePoint(point, rng) : point, time_dist(rng));
+                writer.addRow(unit_dist(rng) < options_.malformed_ratio ? corruptRow(row, rng) : row);
+            }
+        }
+    }
+
+    return writer.close();
+}
@@ -0,0 +1,98 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+
+struct DatasetGeneratorOptions
+{
+    uint64_t seed = 1;
+    // Approximate total number of rows, including duplicates and malformed rows.
+    uint64_t cells_rows = 0;
+    uint64_t bssids_rows = 0;
+    // The output of each kind is split into this many files, generated in parallel.
+    // The output depends on the seed and the number of shards, but not on the
+    // number of threads.
+    int num_shards = 16;
+    // Fraction of the cells present in both MLS and OpenCellID files, and of the
+    // BSSIDs observed more than once.
+    double duplicate_ratio = 0.2;
+    // Fraction of the rows that can't be parsed or are rejected by the parsers.
+    double malformed_ratio = 1e-4;
+    int num_cities = 5000;
+    int compression_level = 6;
+};
+
+// Generates synthetic cells and BSSIDs datasets in the formats of the real dumps.
+//
+// The world consists of the cities with Pareto-distributed populations, both cells
+// and access points are placed around them. Cells follow the MCC -> MNC -> LAC ->
+// cell hierarchy: MCC is derived from the country, i.e. the coarse grid cell the
+// city belongs to, each country has a few operators with the LACs covering parts of
+// the cities, and the cells IDs within the LAC follow per-standard conventions
+// (sequential GSM CIDs, RNC + CID for UMTS, eNB + sector for LTE). BSSIDs use the
+// skewed distribution of the vendor OUIs, with some access points exposing several
+// consecutive BSSIDs, so unlike cells they are not spatially local.
+class DatasetGenerator
+{
+  public:
+    explicit DatasetGenerator(const DatasetGeneratorOptions& options);
+
+    // Writes cells as 'cells-mls-N.csv.gz' + 'cells-ocid-N.csv.gz' (OpenCellID / MLS
+    // format) and BSSIDs as 'bssids-N.csv.gz' (Mylnikov's format) to 'output_dir',
+    // the generated paths are appended to 'cells_paths' and 'bssids_paths'.
+    bool generate(
+        const std::string& output_dir,
+        std::vector<std::string>& cells_paths,
+        std::vector<std::string>& bssids_paths) const;
+
+  private:
+    struct Country
+    {
+        uint16_t mcc;
+        std::vector<uint16_t> mncs;
+    };
+
+    struct City
+    {
+        Point center;
+        // Standard deviation of the positions around the center, in meters.
+        float radius;
+        size_t country;
+    };
+
+    DatasetGeneratorOptions options_;
+    std::vector<Country> countries_;
+    std::vector<City> cities_;
+    std::vector<double> cities_weights_;
+    std::vector<uint32_t> ouis_;
+    std::vector<double> ouis_weights_;
+
+    bool generateCellsShard(int shard, const std::string& mls_path, const std::string& ocid_path) const;
+
+    bool generateBssidsShard(int shard, const std::string& path) const;
+
+    uint64_t getShardRows(uint64_t total_rows, int shard) const;
+};
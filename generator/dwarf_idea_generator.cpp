@@ -0,0 +1,84 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <string>
+#include <vector>
+
+#include <glog/logging.h>
+#include <gflags/gflags.h>
+
+#include "dataset_generator.h"
+
+DEFINE_string(output_dir, ".", "Directory to write the generated files to, must exist.");
+DEFINE_uint64(seed, 1, "Random seed, the same seed and number of shards produce the same output.");
+DEFINE_uint64(cells_rows, 0, "Approximate number of cells rows to generate, across all files.");
+DEFINE_uint64(bssids_rows, 0, "Approximate number of BSSIDs rows to generate, across all files.");
+DEFINE_int32(num_shards, 16, "Number of files per data kind, generated in parallel.");
+DEFINE_double(duplicate_ratio, 0.2, "Fraction of cells present in both MLS and OpenCellID files and "
+    "of BSSIDs observed more than once.");
+DEFINE_double(malformed_ratio, 1e-4, "Fraction of rows to corrupt.");
+DEFINE_int32(num_cities, 5000, "Number of cities the cells and access points are placed around.");
+DEFINE_int32(compression_level, 6, "Gzip compression level, from 1 (fastest) to 9 (best compression).");
+
+namespace {
+
+std::string join(const std::vector<std::string>& paths)
+{
+    std::string result;
+    for (const auto& path: paths)
+    {
+        result += (result.empty() ? "" : ",") + path;
+    }
+    return result;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    gflags::SetUsageMessage("Generates synthetic cells and BSSIDs datasets for dwarf-idea-builder.");
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    google::InitGoogleLogging(argv[0]);
+
+    DatasetGeneratorOptions options;
+    options.seed = FLAGS_seed;
+    options.cells_rows = FLAGS_cells_rows;
+    options.bssids_rows = FLAGS_bssids_rows;
+    options.num_shards = FLAGS_num_shards;
+    options.duplicate_ratio = FLAGS_duplicate_ratio;
+    options.malformed_ratio = FLAGS_malformed_ratio;
+    options.num_cities = FLAGS_num_cities;
+    options.compression_level = FLAGS_compression_level;
+
+    DatasetGenerator generator(options);
+    std::vector<std::string> cells_paths, bssids_paths;
+    CHECK(generator.generate(FLAGS_output_dir, cells_paths, bssids_paths)) << "Failed to generate the datasets";
+
+    // Ready to be passed to the builder as is.
+    if (!cells_paths.empty())
+    {
+        LOG(INFO) << "--cells_files=" << join(cells_paths);
+    }
+    if (!bssids_paths.empty())
+    {
+        LOG(INFO) << "--bssids_files=" << join(bssids_paths);
+    }
+
+    return 0;
+}
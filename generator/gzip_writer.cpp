@@ -0,0 +1,96 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "gzip_writer.h"
+
+#include <string>
+
+#include <archive.h>
+#include <archive_entry.h>
+#include <glog/logging.h>
+
+GzipWriter::GzipWriter(): archive_(nullptr)
+{
+}
+
+GzipWriter::~GzipWriter()
+{
+    if (archive_)
+    {
+        close();
+    }
+}
+
+bool GzipWriter::open(const std::string& path, int compression_level)
+{
+    CHECK(!archive_) << "The writer is already open";
+    archive_ = archive_write_new();
+    const std::string level = std::to_string(compression_level);
+    if (archive_write_add_filter_gzip(archive_) != ARCHIVE_OK ||
+        archive_write_set_filter_option(archive_, "gzip", "compression-level", level.c_str()) != ARCHIVE_OK ||
+        archive_write_set_format_raw(archive_) != ARCHIVE_OK ||
+        archive_write_open_filename(archive_, path.c_str()) != ARCHIVE_OK)
+    {
+        LOG(ERROR) << "Failed to open " << path << ": " << archive_error_string(archive_);
+        archive_write_free(archive_);
+        archive_ = nullptr;
+        return false;
+    }
+
+    // Raw format still needs the single entry, its name ends up in the gzip header.
+    std::string name = path.substr(path.rfind('/') + 1);
+    if (name.size() > 3 && name.compare(name.size() - 3, 3, ".gz") == 0)
+    {
+        name.resize(name.size() - 3);
+    }
+    struct archive_entry* entry = archive_entry_new();
+    archive_entry_set_pathname(entry, name.c_str());
+    archive_entry_set_filetype(entry, AE_IFREG);
+    const bool ok = archive_write_header(archive_, entry) == ARCHIVE_OK;
+    archive_entry_free(entry);
+    if (!ok)
+    {
+        LOG(ERROR) << "Failed to write header to " << path << ": " << archive_error_string(archive_);
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool GzipWriter::write(const std::string& data)
+{
+    if (archive_write_data(archive_, data.data(), data.size()) != ssize_t(data.size()))
+    {
+        LOG(ERROR) << "Failed to write data: " << archive_error_string(archive_);
+        return false;
+    }
+    return true;
+}
+
+bool GzipWriter::close()
+{
+    const bool ok = archive_write_close(archive_) == ARCHIVE_OK;
+    if (!ok)
+    {
+        LOG(ERROR) << "Failed to close the output: " << archive_error_string(archive_);
+    }
+    archive_write_free(archive_);
+    archive_ = nullptr;
+    return ok;
+}
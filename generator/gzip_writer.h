@@ -0,0 +1,47 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <string>
+
+struct archive;
+
+// Writes the single .gz file, readable by the builder as the raw archive.
+class GzipWriter
+{
+  public:
+    GzipWriter();
+
+    ~GzipWriter();
+
+    GzipWriter(const GzipWriter&) = delete;
+    GzipWriter& operator=(const GzipWriter&) = delete;
+
+    // 'compression_level' is from 1 (fastest) to 9 (best compression).
+    bool open(const std::string& path, int compression_level);
+
+    bool write(const std::string& data);
+
+    // Flushes the remaining data, returns false if it fails.
+    bool close();
+
+  private:
+    struct archive* archive_;
+};
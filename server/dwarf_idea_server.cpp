@@ -0,0 +1,67 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glog/logging.h>
+#include <gflags/gflags.h>
+
+#include "dwarf_idea_reader.h"
+#include "lookup_server.h"
+
+DEFINE_string(db_paths, "", "Comma-separated list of DBs to serve, the position in the list is "
+    "the source index used in the requests.");
+DEFINE_string(socket_path, "/tmp/dwarf-idea.sock", "Path of the Unix domain socket to listen on.");
+DEFINE_int32(cache_size_mb, 256, "Memory budget of the decoded blocks cache per DB, in MB.");
+DEFINE_int32(num_threads, 0, "Number of threads used to process the batches, 0 to use all cores.");
+DEFINE_double(default_radius, 100.0f, "Coverage radius, in meters, for the entries without extra data.");
+
+int main(int argc, char* argv[])
+{
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    google::InitGoogleLogging(argv[0]);
+
+    CHECK(!FLAGS_db_paths.empty()) << "--db_paths must be set";
+
+    std::vector<std::unique_ptr<DwarfIdeaReader>> readers;
+    std::vector<const DwarfIdeaReader*> readers_ptrs;
+    std::istringstream db_paths(FLAGS_db_paths);
+    std::string db_path;
+    while (std::getline(db_paths, db_path, ','))
+    {
+        readers.emplace_back(new DwarfIdeaReader());
+        CHECK(readers.back()->open(db_path)) << "Failed to open " << db_path;
+        readers_ptrs.push_back(readers.back().get());
+    }
+
+    LookupServerOptions options;
+    options.cache_size = size_t(FLAGS_cache_size_mb) << 20;
+    options.num_threads = FLAGS_num_threads > 0 ? FLAGS_num_threads : std::thread::hardware_concurrency();
+    options.solver_options.default_radius = FLAGS_default_radius;
+
+    LookupServer server(readers_ptrs, options);
+    CHECK(server.listen(FLAGS_socket_path));
+    server.run();
+
+    return 0;
+}
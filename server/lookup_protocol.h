@@ -0,0 +1,63 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Binary protocol of dwarf-idea-server, used over the Unix domain stream socket.
+// All integers are little-endian, floats are IEEE 754 in the little-endian order.
+//
+// Every message, both request and response, starts with u32 size of the rest of
+// the message, u8 message type and u32 request ID. The response carries the type
+// and ID of the request it answers, followed by u8 status. The requests of the
+// single connection can be pipelined, the responses come in the same order.
+// The client may shut down its side of the connection after the last request, the
+// server then sends all the responses before closing the connection.
+//
+// kRequestLookup: u8 source (index of the DB in --db_paths), u16 keys count, then
+//   for every key u8 key size + key bytes.
+// Response on kStatusOk: u16 keys count, then for every key u8 found and, if found,
+//   f32 lat + f32 lon + u8 extra data size + extra data.
+//
+// kRequestSolve: u16 observations count, then for every observation u8 source +
+//   u8 key size + key bytes + f32 signal strength in dBm (NaN if unknown).
+// Response on kStatusOk: u8 found and, if found, f32 lat + f32 lon + f32 accuracy
+//   in meters + u16 used observations + u16 rejected observations.
+
+enum LookupMessageType: uint8_t
+{
+    kRequestLookup = 1,
+    kRequestSolve = 2,
+};
+
+enum LookupStatus: uint8_t
+{
+    kStatusOk = 0,
+    kStatusMalformedRequest = 1,
+    kStatusUnknownSource = 2,
+    kStatusUnknownType = 3,
+};
+
+// Size + type + request ID.
+constexpr size_t kMessageHeaderSize = 9;
+
+// The connections sending larger messages are closed.
+constexpr size_t kMaxMessageSize = 1 << 20;
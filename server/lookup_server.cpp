@@ -0,0 +1,561 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "lookup_server.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <glog/logging.h>
+
+#include "lookup_protocol.h"
+
+namespace {
+
+// Values of epoll_event.data.u64 for the non-connection descriptors,
+// the connections are numbered starting from kFirstConnectionId.
+constexpr uint64_t kListenId = 0;
+constexpr uint64_t kSignalId = 1;
+constexpr uint64_t kFirstConnectionId = 2;
+
+constexpr int kMaxEvents = 256;
+constexpr size_t kReadBufferSize = 64 << 10;
+// The connection isn't read while it has more responses waiting to be sent, so that
+// the clients which don't read the responses can't make the server buffer them all.
+constexpr size_t kMaxPendingOutput = 4 << 20;
+// Bounds the requests taken from a single connection into one batch, the rest
+// is read on the next iteration of the loop.
+constexpr size_t kMaxReadSize = 1 << 20;
+
+void putFloat(float value, Bytes& output)
+{
+    uint8_t bytes[sizeof(value)];
+    memcpy(bytes, &value, sizeof(value));
+    output.insert(output.end(), bytes, bytes + sizeof(value));
+}
+
+bool getKey(BytesReader& reader, std::string& key)
+{
+    uint8_t key_size;
+    const uint8_t* key_data;
+    if (!reader.get(key_size) || !reader.getBytes(key_size, key_data))
+    {
+        return false;
+    }
+    key.assign((const char*)key_data, key_size);
+    return true;
+}
+
+bool updateEpoll(int epoll_fd, int op, int fd, uint32_t events, uint64_t id)
+{
+    epoll_event event = {};
+    event.events = events;
+    event.data.u64 = id;
+    if (epoll_ctl(epoll_fd, op, fd, &event) < 0)
+    {
+        PLOG(ERROR) << "epoll_ctl failed";
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+LookupServer::LookupServer(const std::vector<const DwarfIdeaReader*>& readers, const LookupServerOptions& options):
+    readers_(readers),
+    solver_(options.solver_options),
+    num_threads_(options.num_threads),
+    listen_fd_(-1),
+    signal_fd_(-1),
+    epoll_fd_(-1),
+    next_connection_id_(kFirstConnectionId),
+    num_batches_(0),
+    num_requests_(0)
+{
+    for (const DwarfIdeaReader* reader: readers_)
+    {
+        caches_.emplace_back(new DecodedBlocksCache(*reader, options.cache_size, options.cache_shards));
+        solver_.addSource(*reader, caches_.back().get());
+    }
+}
+
+LookupServer::~LookupServer()
+{
+    while (!connections_.empty())
+    {
+        closeConnection(connections_.begin()->first);
+    }
+    for (int fd: {listen_fd_, signal_fd_, epoll_fd_})
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+    if (!socket_path_.empty())
+    {
+        unlink(socket_path_.c_str());
+    }
+}
+
+bool LookupServer::listen(const std::string& socket_path)
+{
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path))
+    {
+        LOG(ERROR) << "Socket path is too long: " << socket_path;
+        return false;
+    }
+    strcpy(addr.sun_path, socket_path.c_str());
+
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0)
+    {
+        PLOG(ERROR) << "Failed to create socket";
+        return false;
+    }
+    unlink(socket_path.c_str());
+    if (bind(listen_fd_, (const sockaddr*)&addr, sizeof(addr)) < 0 || ::listen(listen_fd_, SOMAXCONN) < 0)
+    {
+        PLOG(ERROR) << "Failed to listen on " << socket_path;
+        return false;
+    }
+    socket_path_ = socket_path;
+
+    // Termination signals are delivered through the event loop, so that the
+    // server shuts down cleanly between the batches.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &signals, nullptr) < 0)
+    {
+        PLOG(ERROR) << "Failed to block signals";
+        return false;
+    }
+    signal_fd_ = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (signal_fd_ < 0 || epoll_fd_ < 0)
+    {
+        PLOG(ERROR) << "Failed to create event descriptors";
+        return false;
+    }
+    return updateEpoll(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, EPOLLIN, kListenId) &&
+        updateEpoll(epoll_fd_, EPOLL_CTL_ADD, signal_fd_, EPOLLIN, kSignalId);
+}
+
+void LookupServer::run()
+{
+    CHECK_GE(epoll_fd_, 0) << "'listen' must be called first";
+    LOG(INFO) << "Serving " << readers_.size() << " DBs on " << socket_path_;
+
+    epoll_event events[kMaxEvents];
+    bool stop = false;
+    while (!stop)
+    {
+        int num_events = epoll_wait(epoll_fd_, events, kMaxEvents, -1);
+        if (num_events < 0)
+        {
+            PCHECK(errno == EINTR) << "epoll_wait failed";
+            continue;
+        }
+
+        for (int i = 0; i < num_events; ++i)
+        {
+            uint64_t id = events[i].data.u64;
+            if (id == kListenId)
+            {
+                acceptConnections();
+            }
+            else if (id == kSignalId)
+            {
+                stop = true;
+            }
+            else if (connections_.count(id))
+            {
+                if (events[i].events & EPOLLOUT)
+                {
+                    flushConnection(id);
+                }
+                if (connections_.count(id) && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                {
+                    readConnection(id);
+                }
+            }
+        }
+
+        if (!batch_.empty())
+        {
+            processBatch();
+        }
+    }
+
+    LOG(INFO) << "Stopping, processed " << num_requests_ << " requests in " << num_batches_ << " batches";
+    for (size_t source = 0; source < caches_.size(); ++source)
+    {
+        DecodedBlocksCacheStats stats = caches_[source]->getStats();
+        LOG(INFO) << "DB " << source << " cache: " << stats.hits << " hits, " << stats.misses << " misses, "
+            << stats.evictions << " evictions";
+    }
+}
+
+void LookupServer::acceptConnections()
+{
+    while (true)
+    {
+        int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+            {
+                PLOG(ERROR) << "accept failed";
+            }
+            if (errno != EINTR && errno != ECONNABORTED)
+            {
+                return;
+            }
+            continue;
+        }
+
+        uint64_t id = next_connection_id_++;
+        if (!updateEpoll(epoll_fd_, EPOLL_CTL_ADD, fd, EPOLLIN, id))
+        {
+            close(fd);
+            continue;
+        }
+        connections_[id] = Connection{fd, Bytes(), Bytes(), EPOLLIN, false, 0};
+    }
+}
+
+void LookupServer::readConnection(uint64_t connection_id)
+{
+    Connection& connection = connections_.at(connection_id);
+
+    uint8_t buffer[kReadBufferSize];
+    bool failed = false;
+    for (size_t total_size = 0; !connection.input_closed && total_size < kMaxReadSize; )
+    {
+        ssize_t size = read(connection.fd, buffer, sizeof(buffer));
+        if (size > 0)
+        {
+            connection.input.insert(connection.input.end(), buffer, buffer + size);
+            total_size += size;
+        }
+        else if (size == 0)
+        {
+            connection.input_closed = true;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            break;
+        }
+        else if (errno != EINTR)
+        {
+            failed = true;
+            break;
+        }
+    }
+
+    size_t pos = 0;
+    while (connection.input.size() - pos >= sizeof(uint32_t))
+    {
+        uint32_t size = asInt<uint32_t>(Bytes(connection.input.begin() + pos, connection.input.begin() + pos + 4));
+        if (size < kMessageHeaderSize - sizeof(uint32_t) || size > kMaxMessageSize)
+        {
+            LOG(WARNING) << "Closing connection with invalid message size " << size;
+            failed = true;
+            break;
+        }
+        if (connection.input.size() - pos < sizeof(uint32_t) + size)
+        {
+            break;
+        }
+        parseRequest(connection_id, connection.input.data() + pos + sizeof(uint32_t), size);
+        pos += sizeof(uint32_t) + size;
+    }
+    connection.input.erase(connection.input.begin(), connection.input.begin() + pos);
+
+    if (failed)
+    {
+        // The responses to already received requests are dropped.
+        closeConnection(connection_id);
+    }
+    else if (connection.input_closed)
+    {
+        // Stops polling for input, the connection is closed once the responses
+        // to the requests received so far are sent.
+        flushConnection(connection_id);
+    }
+}
+
+void LookupServer::parseRequest(uint64_t connection_id, const uint8_t* data, size_t size)
+{
+    BytesReader reader(data, data + size);
+    Request request;
+    request.connection_id = connection_id;
+    reader.get(request.type);
+    reader.get(request.id);
+    request.status = kStatusOk;
+
+    if (request.type == kRequestLookup)
+    {
+        uint8_t source;
+        uint16_t num_keys;
+        if (!reader.get(source) || !reader.get(num_keys))
+        {
+            request.status = kStatusMalformedRequest;
+        }
+        else if (source >= readers_.size())
+        {
+            request.status = kStatusUnknownSource;
+        }
+        for (uint16_t i = 0; i < num_keys && request.status == kStatusOk; ++i)
+        {
+            Observation observation;
+            observation.source = source;
+            if (!getKey(reader, observation.key))
+            {
+                request.status = kStatusMalformedRequest;
+            }
+            request.observations.push_back(std::move(observation));
+        }
+    }
+    else if (request.type == kRequestSolve)
+    {
+        uint16_t num_observations;
+        if (!reader.get(num_observations))
+        {
+            request.status = kStatusMalformedRequest;
+        }
+        for (uint16_t i = 0; i < num_observations && request.status == kStatusOk; ++i)
+        {
+            Observation observation;
+            uint8_t source;
+            if (!reader.get(source) || !getKey(reader, observation.key) || !reader.get(observation.signal_strength))
+            {
+                request.status = kStatusMalformedRequest;
+            }
+            else if (source >= readers_.size())
+            {
+                request.status = kStatusUnknownSource;
+            }
+            observation.source = source;
+            request.observations.push_back(std::move(observation));
+        }
+    }
+    else
+    {
+        request.status = kStatusUnknownType;
+    }
+
+    if (request.status == kStatusOk && reader.getPos() != data + size)
+    {
+        request.status = kStatusMalformedRequest;
+    }
+    if (request.status != kStatusOk)
+    {
+        request.observations.clear();
+    }
+    ++connections_.at(connection_id).num_pending_requests;
+    batch_.push_back(std::move(request));
+}
+
+void LookupServer::processBatch()
+{
+    // Lookups: the keys of all requests are merged per DB, so that the blocks shared
+    // by the requests of different clients are searched and decoded only once.
+    for (size_t source = 0; source < readers_.size(); ++source)
+    {
+        std::vector<std::string> keys;
+        std::vector<Request*> requests;
+        for (Request& request: batch_)
+        {
+            if (request.type == kRequestLookup && request.status == kStatusOk &&
+                !request.observations.empty() && request.observations[0].source == source)
+            {
+                for (Observation& observation: request.observations)
+                {
+                    keys.push_back(std::move(observation.key));
+                }
+                requests.push_back(&request);
+            }
+        }
+        if (keys.empty())
+        {
+            continue;
+        }
+
+        std::vector<LookupResult> results(keys.size());
+        caches_[source]->lookupBatch(keys.data(), keys.size(), results.data(), num_threads_);
+
+        size_t pos = 0;
+        for (Request* request: requests)
+        {
+            size_t num_keys = request->observations.size();
+            request->results.assign(
+                std::make_move_iterator(results.begin() + pos),
+                std::make_move_iterator(results.begin() + pos + num_keys));
+            pos += num_keys;
+        }
+    }
+
+    // Solves: each scan already does batched lookups per DB, so parallelize across scans.
+    #pragma omp parallel for schedule(dynamic) num_threads(num_threads_)
+    for (size_t i = 0; i < batch_.size(); ++i)
+    {
+        Request& request = batch_[i];
+        if (request.type == kRequestSolve && request.status == kStatusOk)
+        {
+            solver_.solve(request.observations, request.estimate);
+        }
+    }
+
+    std::vector<uint64_t> connection_ids;
+    for (const Request& request: batch_)
+    {
+        writeResponse(request);
+        if (connection_ids.empty() || connection_ids.back() != request.connection_id)
+        {
+            connection_ids.push_back(request.connection_id);
+        }
+    }
+    for (uint64_t connection_id: connection_ids)
+    {
+        if (connections_.count(connection_id))
+        {
+            flushConnection(connection_id);
+        }
+    }
+
+    ++num_batches_;
+    num_requests_ += batch_.size();
+    batch_.clear();
+}
+
+void LookupServer::writeResponse(const Request& request)
+{
+    auto it = connections_.find(request.connection_id);
+    if (it == connections_.end())
+    {
+        return;
+    }
+
+    Bytes response;
+    response.push_back(request.type);
+    appendBytes(asBytes(request.id), response);
+    response.push_back(request.status);
+    if (request.status == kStatusOk && request.type == kRequestLookup)
+    {
+        appendBytes(asBytes(uint16_t(request.results.size())), response);
+        for (const LookupResult& result: request.results)
+        {
+            response.push_back(result.found);
+            if (result.found)
+            {
+                putFloat(result.point.lat, response);
+                putFloat(result.point.lon, response);
+                response.push_back(result.extra_data.size());
+                appendBytes(result.extra_data, response);
+            }
+        }
+    }
+    else if (request.status == kStatusOk && request.type == kRequestSolve)
+    {
+        const PositionEstimate& estimate = request.estimate;
+        response.push_back(estimate.found);
+        if (estimate.found)
+        {
+            putFloat(estimate.point.lat, response);
+            putFloat(estimate.point.lon, response);
+            putFloat(estimate.accuracy, response);
+            appendBytes(asBytes(uint16_t(estimate.num_used)), response);
+            appendBytes(asBytes(uint16_t(estimate.num_rejected)), response);
+        }
+    }
+
+    --it->second.num_pending_requests;
+    Bytes& output = it->second.output;
+    appendBytes(asBytes(uint32_t(response.size())), output);
+    appendBytes(response, output);
+}
+
+void LookupServer::flushConnection(uint64_t connection_id)
+{
+    Connection& connection = connections_.at(connection_id);
+
+    size_t pos = 0;
+    while (pos < connection.output.size())
+    {
+        ssize_t size = send(connection.fd, connection.output.data() + pos, connection.output.size() - pos, MSG_NOSIGNAL);
+        if (size >= 0)
+        {
+            pos += size;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            break;
+        }
+        else if (errno != EINTR)
+        {
+            closeConnection(connection_id);
+            return;
+        }
+    }
+    connection.output.erase(connection.output.begin(), connection.output.begin() + pos);
+
+    if (connection.input_closed && connection.output.empty() && !connection.num_pending_requests)
+    {
+        closeConnection(connection_id);
+        return;
+    }
+
+    // Only wait for the socket to become writable while there's pending output,
+    // and stop reading the requests while too much of it is pending.
+    uint32_t events = 0;
+    if (!connection.input_closed && connection.output.size() < kMaxPendingOutput)
+    {
+        events |= EPOLLIN;
+    }
+    if (!connection.output.empty())
+    {
+        events |= EPOLLOUT;
+    }
+    if (events != connection.events)
+    {
+        connection.events = events;
+        updateEpoll(epoll_fd_, EPOLL_CTL_MOD, connection.fd, events, connection_id);
+    }
+}
+
+void LookupServer::closeConnection(uint64_t connection_id)
+{
+    auto it = connections_.find(connection_id);
+    // Closing the descriptor also removes it from the epoll set.
+    close(it->second.fd);
+    connections_.erase(it);
+}
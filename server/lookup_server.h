@@ -0,0 +1,115 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "decoded_blocks_cache.h"
+#include "dwarf_idea_reader.h"
+#include "position_solver.h"
+#include "utils.h"
+
+struct LookupServerOptions
+{
+    // Memory budget of the decoded blocks cache, per DB.
+    size_t cache_size = 256 << 20;
+    size_t cache_shards = 16;
+    int num_threads = 1;
+    PositionSolverOptions solver_options;
+};
+
+// Serves lookup and solve requests over the Unix domain socket, see lookup_protocol.h.
+//
+// The single thread runs epoll event loop over all connections. All requests that
+// arrive within the single wakeup of the loop, from all clients, are processed as a
+// single batch: the lookups from all requests are merged per DB so that every
+// touched block is decoded at most once, solve requests are processed in parallel.
+// The decoded blocks cache is shared by all requests.
+class LookupServer
+{
+  public:
+    // 'readers' must outlive the server, their positions are the sources of the protocol.
+    LookupServer(const std::vector<const DwarfIdeaReader*>& readers, const LookupServerOptions& options);
+
+    ~LookupServer();
+
+    LookupServer(const LookupServer&) = delete;
+    LookupServer& operator=(const LookupServer&) = delete;
+
+    // Creates the socket, replacing the existing file at the path, if any.
+    bool listen(const std::string& socket_path);
+
+    // Serves the requests until SIGINT or SIGTERM is received.
+    void run();
+
+  private:
+    struct Connection
+    {
+        int fd;
+        Bytes input;
+        Bytes output;
+        // The epoll events the descriptor is registered for.
+        uint32_t events;
+        // Set once the client has shut down its side of the connection.
+        bool input_closed;
+        // The requests in the current batch that are not responded yet.
+        size_t num_pending_requests;
+    };
+
+    struct Request
+    {
+        uint64_t connection_id;
+        uint8_t type;
+        uint32_t id;
+        uint8_t status;
+        std::vector<Observation> observations;
+        std::vector<LookupResult> results;
+        PositionEstimate estimate;
+    };
+
+    std::vector<const DwarfIdeaReader*> readers_;
+    std::vector<std::unique_ptr<DecodedBlocksCache>> caches_;
+    PositionSolver solver_;
+    int num_threads_;
+    std::string socket_path_;
+    int listen_fd_, signal_fd_, epoll_fd_;
+    uint64_t next_connection_id_;
+    std::unordered_map<uint64_t, Connection> connections_;
+    std::vector<Request> batch_;
+    uint64_t num_batches_, num_requests_;
+
+    void acceptConnections();
+
+    void readConnection(uint64_t connection_id);
+
+    void parseRequest(uint64_t connection_id, const uint8_t* data, size_t size);
+
+    void processBatch();
+
+    void writeResponse(const Request& request);
+
+    void flushConnection(uint64_t connection_id);
+
+    void closeConnection(uint64_t connection_id);
+};
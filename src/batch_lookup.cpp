@@ -0,0 +1,108 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "batch_lookup.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct BlockKeys
+{
+    size_t block_index;
+    // Range of the sorted keys that belong to this block.
+    size_t begin, end;
+};
+
+}
+
+void lookupBatch(
+    const DwarfIdeaReader& reader, const BlockGetter& get_block,
+    const std::string* keys, size_t num_keys, LookupResult* results, int num_threads)
+{
+    // Mapped keys + their positions in the input, the keys that cannot be
+    // present in the DB, including the ones rejected by the membership filter,
+    // are skipped right away.
+    std::vector<std::pair<uint64_t, size_t>> sorted_keys;
+    sorted_keys.reserve(num_keys);
+    for (size_t i = 0; i < num_keys; ++i)
+    {
+        results[i].found = false;
+        uint64_t mapped_key = 0;
+        if (reader.mapKey(keys[i], mapped_key) && reader.mayContain(mapped_key))
+        {
+            sorted_keys.emplace_back(mapped_key, i);
+        }
+    }
+    std::sort(sorted_keys.begin(), sorted_keys.end());
+
+    std::vector<BlockKeys> blocks;
+    for (size_t i = 0; i < sorted_keys.size(); ++i)
+    {
+        size_t block_index = 0;
+        if (!reader.findBlock(sorted_keys[i].first, block_index))
+        {
+            continue;
+        }
+        if (!blocks.empty() && blocks.back().block_index == block_index)
+        {
+            blocks.back().end = i + 1;
+        }
+        else
+        {
+            blocks.push_back(BlockKeys{block_index, i, i + 1});
+        }
+    }
+
+    const size_t extra_data_size = reader.getHeader().extra_data_size;
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads) if(num_threads > 1 && blocks.size() > 1)
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        std::shared_ptr<const DecodedBlock> block = get_block(blocks[i].block_index);
+        if (!block)
+        {
+            continue;
+        }
+        // Both the keys and the entries of the block are sorted, so a single pass is enough.
+        // Duplicate keys in the batch match the same entry.
+        size_t entry_index = 0;
+        for (size_t j = blocks[i].begin; j < blocks[i].end; ++j)
+        {
+            const uint64_t mapped_key = sorted_keys[j].first;
+            while (entry_index < block->size() && block->keys[entry_index] < mapped_key)
+            {
+                ++entry_index;
+            }
+            if (entry_index == block->size())
+            {
+                break;
+            }
+            if (block->keys[entry_index] == mapped_key)
+            {
+                LookupResult& result = results[sorted_keys[j].second];
+                result.found = true;
+                result.point = block->getPoint(entry_index);
+                const uint8_t* entry_extra_data = block->extra_data.data() + entry_index * extra_data_size;
+                result.extra_data.assign(entry_extra_data, entry_extra_data + extra_data_size);
+            }
+        }
+    }
+}
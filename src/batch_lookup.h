@@ -0,0 +1,38 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "dwarf_idea_reader.h"
+
+// Returns the decoded block with the given index or nullptr if the block is malformed.
+typedef std::function<std::shared_ptr<const DecodedBlock>(size_t block_index)> BlockGetter;
+
+// Batched lookup shared by 'DwarfIdeaReader' and 'DecodedBlocksCache': the keys are
+// sorted and grouped by the block they belong to, then each block is obtained once
+// via 'get_block' and all keys of the group are resolved by merging the sorted keys
+// with the sorted entries of the block. 'get_block' is called concurrently if
+// 'num_threads' > 1.
+void lookupBatch(
+    const DwarfIdeaReader& reader, const BlockGetter& get_block,
+    const std::string* keys, size_t num_keys, LookupResult* results, int num_threads);
@@ -0,0 +1,200 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "block_stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <map>
+
+#include <glog/logging.h>
+
+namespace {
+
+const char* const kStreamNames[kNumBlockStreams] = {"keys", "coords", "extra_data"};
+
+// Size of the position histograms buckets, in degrees.
+const double kBandSize = 10.0;
+
+uint32_t getCompressedSize(const BlockStatsRecord& record)
+{
+    uint32_t size = 0;
+    for (const BlockStreamStats& stream: record.streams)
+    {
+        size += stream.compressed_size;
+    }
+    return size;
+}
+
+} // namespace
+
+BlockStats::BlockStats(size_t num_blocks, bool has_extra_data):
+    blocks_(num_blocks),
+    num_streams_(has_extra_data ? kNumBlockStreams : kBlockStreamExtraData)
+{
+}
+
+void BlockStats::setBlock(size_t index, const BlockStatsRecord& record)
+{
+    blocks_[index] = record;
+}
+
+std::vector<BlockStats::Histogram> BlockStats::buildHistograms() const
+{
+    // Buckets are keyed by their index, so that only non-empty buckets are output.
+    std::vector<std::pair<std::string, std::map<int, Bucket>>> histograms;
+    auto add = [&histograms](size_t histogram, int index, double min, double max, const BlockStatsRecord& record)
+    {
+        Bucket& bucket = histograms[histogram].second[index];
+        bucket.min = min;
+        bucket.max = max;
+        ++bucket.num_blocks;
+        bucket.num_entries += record.num_entries;
+        bucket.compressed_size += getCompressedSize(record);
+    };
+
+    const size_t entries_histogram = histograms.size();
+    histograms.emplace_back("entries_per_block", std::map<int, Bucket>());
+    const size_t lat_bits_histogram = histograms.size();
+    histograms.emplace_back("lat_bits", std::map<int, Bucket>());
+    const size_t lon_bits_histogram = histograms.size();
+    histograms.emplace_back("lon_bits", std::map<int, Bucket>());
+    const size_t streams_histogram = histograms.size();
+    for (int i = 0; i < num_streams_; ++i)
+    {
+        histograms.emplace_back(std::string(kStreamNames[i]) + "_bits_per_entry", std::map<int, Bucket>());
+    }
+    const size_t lat_band_histogram = histograms.size();
+    histograms.emplace_back("lat_band", std::map<int, Bucket>());
+    const size_t lon_band_histogram = histograms.size();
+    histograms.emplace_back("lon_band", std::map<int, Bucket>());
+
+    for (const BlockStatsRecord& record: blocks_)
+    {
+        if (!record.num_entries)
+        {
+            continue;
+        }
+        const int entries_log2 = int(std::log2(record.num_entries));
+        add(entries_histogram, entries_log2, std::exp2(entries_log2), std::exp2(entries_log2 + 1), record);
+        add(lat_bits_histogram, record.lat_bits, record.lat_bits, record.lat_bits + 1, record);
+        add(lon_bits_histogram, record.lon_bits, record.lon_bits, record.lon_bits + 1, record);
+        for (int i = 0; i < num_streams_; ++i)
+        {
+            const int bits = int(8.0 * record.streams[i].compressed_size / record.num_entries);
+            add(streams_histogram + i, bits, bits, bits + 1, record);
+        }
+        const double lat = (record.min_corner.lat + record.max_corner.lat) / 2.0;
+        const double lon = (record.min_corner.lon + record.max_corner.lon) / 2.0;
+        const int lat_band = int(std::floor(lat / kBandSize));
+        const int lon_band = int(std::floor(lon / kBandSize));
+        add(lat_band_histogram, lat_band, lat_band * kBandSize, (lat_band + 1) * kBandSize, record);
+        add(lon_band_histogram, lon_band, lon_band * kBandSize, (lon_band + 1) * kBandSize, record);
+    }
+
+    std::vector<Histogram> result;
+    for (const auto& histogram: histograms)
+    {
+        result.emplace_back();
+        result.back().name = histogram.first;
+        for (const auto& bucket: histogram.second)
+        {
+            result.back().buckets.push_back(bucket.second);
+        }
+    }
+    return result;
+}
+
+bool BlockStats::write(const std::string& path) const
+{
+    std::ofstream os(path.c_str());
+    os << "block\tfirst_key\tnum_entries\tlat_bits\tlon_bits\tlat_steps\tlon_steps\t"
+        "min_lat\tmin_lon\tmax_lat\tmax_lon";
+    for (int i = 0; i < num_streams_; ++i)
+    {
+        const std::string name = kStreamNames[i];
+        os << "\t" << name << "_raw\t" << name << "_transformed\t" << name << "_compressed\t" <<
+            name << "_entropy_skipped";
+    }
+    os << "\n" << std::setprecision(8);
+    for (size_t i = 0; i < blocks_.size(); ++i)
+    {
+        const BlockStatsRecord& record = blocks_[i];
+        os << i << "\t" << std::hex << std::setfill('0') << std::setw(16) << record.first_key <<
+            std::dec << std::setfill(' ') << std::setw(0) << "\t" << record.num_entries << "\t" <<
+            int(record.lat_bits) << "\t" << int(record.lon_bits) << "\t" <<
+            record.lat_steps << "\t" << record.lon_steps << "\t" <<
+            record.min_corner.lat << "\t" << record.min_corner.lon << "\t" <<
+            record.max_corner.lat << "\t" << record.max_corner.lon;
+        for (int j = 0; j < num_streams_; ++j)
+        {
+            const BlockStreamStats& stream = record.streams[j];
+            os << "\t" << stream.raw_size << "\t" << stream.transformed_size << "\t" <<
+                stream.compressed_size << "\t" << int(stream.entropy_skipped);
+        }
+        os << "\n";
+    }
+    if (!os)
+    {
+        return false;
+    }
+
+    std::ofstream hos((path + ".histograms").c_str());
+    hos << "histogram\tmin\tmax\tnum_blocks\tnum_entries\tcompressed_size\n";
+    for (const Histogram& histogram: buildHistograms())
+    {
+        for (const Bucket& bucket: histogram.buckets)
+        {
+            hos << histogram.name << "\t" << bucket.min << "\t" << bucket.max << "\t" << bucket.num_blocks <<
+                "\t" << bucket.num_entries << "\t" << bucket.compressed_size << "\n";
+        }
+    }
+    return bool(hos);
+}
+
+void BlockStats::log() const
+{
+    uint64_t num_entries = 0, total_size = 0;
+    for (const BlockStatsRecord& record: blocks_)
+    {
+        num_entries += record.num_entries;
+        total_size += getCompressedSize(record);
+    }
+    LOG(INFO) << "Blocks: " << blocks_.size() << ", " << num_entries << " entries, " <<
+        total_size << " bytes compressed";
+    for (int i = 0; i < num_streams_; ++i)
+    {
+        uint64_t raw_size = 0, transformed_size = 0, compressed_size = 0, num_skipped = 0;
+        for (const BlockStatsRecord& record: blocks_)
+        {
+            const BlockStreamStats& stream = record.streams[i];
+            raw_size += stream.raw_size;
+            transformed_size += stream.transformed_size;
+            compressed_size += stream.compressed_size;
+            num_skipped += stream.entropy_skipped;
+        }
+        LOG(INFO) << "  " << kStreamNames[i] << ": " << raw_size << " bytes raw, " <<
+            transformed_size << " bytes transformed, " << compressed_size << " bytes compressed (" <<
+            100.0 * compressed_size / std::max<uint64_t>(total_size, 1) << "% of total), " <<
+            8.0 * compressed_size / std::max<uint64_t>(num_entries, 1) << " bits / entry, entropy coding skipped in " <<
+            num_skipped << " blocks";
+    }
+}
@@ -0,0 +1,96 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+
+enum BlockStream
+{
+    kBlockStreamKeys,
+    kBlockStreamCoords,
+    kBlockStreamExtraData,
+    kNumBlockStreams,
+};
+
+// Sizes of a single stream of the block after each encoding stage, in bytes.
+struct BlockStreamStats
+{
+    // Encoded entries, before the transform chain.
+    uint32_t raw_size = 0;
+    // After the transform chain, e.g. BWTS + SBRT + ZRLT.
+    uint32_t transformed_size = 0;
+    // As written to the file, including the stream framing.
+    uint32_t compressed_size = 0;
+    // Entropy coding failed or would expand the data, so it was skipped.
+    bool entropy_skipped = false;
+};
+
+struct BlockStatsRecord
+{
+    uint64_t first_key = 0;
+    uint32_t num_entries = 0;
+    int8_t lat_bits = 0, lon_bits = 0;
+    uint32_t lat_steps = 0, lon_steps = 0;
+    Point min_corner, max_corner;
+    BlockStreamStats streams[kNumBlockStreams];
+};
+
+// Per block statistics of the builder output, used to tune the blocks and the
+// bounding box parameters.
+//
+// 'write' outputs one tab-separated row per block, plus the summary histograms
+// of the number of entries, lat / lon bits, bits per entry of every stream and
+// the block positions, with the number of blocks, entries and compressed bytes
+// in each bucket, into '<path>.histograms'.
+class BlockStats
+{
+  public:
+    BlockStats(size_t num_blocks, bool has_extra_data);
+
+    // Thread-safe as long as different threads set different blocks.
+    void setBlock(size_t index, const BlockStatsRecord& record);
+
+    bool write(const std::string& path) const;
+
+    // Logs the total size of every stream after each encoding stage.
+    void log() const;
+
+  private:
+    struct Bucket
+    {
+        double min, max;
+        uint64_t num_blocks = 0, num_entries = 0, compressed_size = 0;
+    };
+
+    struct Histogram
+    {
+        std::string name;
+        std::vector<Bucket> buckets;
+    };
+
+    std::vector<BlockStatsRecord> blocks_;
+    int num_streams_;
+
+    std::vector<Histogram> buildHistograms() const;
+};
@@ -69,7 +69,7 @@ void BssidsCsvParser::parseLine(const std::string& line, ILocationAggregator& ag
     split(line, kFormatSeparator[format_index_], tokens);
     if (tokens.size() != kFormatColumns[format_index_])
     {
-        LOG(ERROR) << "Failed to parse CSV line " << line << ": found " << tokens.size() << " tokens";
+        stats_.addRejectedRow("wrong_columns");
     }
     else if (line.compare(0, strlen(kFormat[format_index_]), kFormat[format_index_]) == 0)
     {
@@ -82,6 +82,6 @@ void BssidsCsvParser::parseLine(const std::string& line, ILocationAggregator& ag
             tokens[kFormatIndices[format_index_][0]],
             tokens[kFormatIndices[format_index_][1]],
             tokens[kFormatIndices[format_index_][2]],
-            aggregator);
+            aggregator, stats_);
     }
 }
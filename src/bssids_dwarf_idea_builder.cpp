@@ -0,0 +1,110 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "bssids_dwarf_idea_builder.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+
+#include "dwarf_idea_format.h"
+
+namespace {
+
+uint32_t getOui(const std::array<uint8_t, kBssidKeySize>& key)
+{
+    uint32_t oui = 0;
+    for (int i = 0; i < kOuiSize; ++i)
+    {
+        oui = (oui << 8) | key[i];
+    }
+    return oui;
+}
+
+}
+
+BssidsDwarfIdeaBuilder::BssidsDwarfIdeaBuilder(const DwarfIdeaBuilderOptions& options):
+    DwarfIdeaBuilder<kBssidKeySize, kBssidExtraDataSize>(options),
+    oui_index_(options.oui_index)
+{
+}
+
+void BssidsDwarfIdeaBuilder::build(std::ostream& os)
+{
+    if (oui_index_)
+    {
+        // The keys are sorted, so are their OUIs, and the mapping keeps the keys order.
+        for (const auto& key: getKeys())
+        {
+            const uint32_t oui = getOui(key);
+            if (ouis_.empty() || ouis_.back() != oui)
+            {
+                CHECK(ouis_.empty() || ouis_.back() < oui) << "BSSIDs are not sorted";
+                ouis_.push_back(oui);
+            }
+        }
+        LOG(INFO) << "Found " << ouis_.size() << " OUIs";
+    }
+
+    DwarfIdeaBuilder<kBssidKeySize, kBssidExtraDataSize>::build(os);
+}
+
+uint64_t BssidsDwarfIdeaBuilder::mapKey(const Key& key) const
+{
+    const uint64_t mapped_key = DwarfIdeaBuilder<kBssidKeySize, kBssidExtraDataSize>::mapKey(key);
+    if (!oui_index_)
+    {
+        return mapped_key;
+    }
+    auto oui_it = std::lower_bound(ouis_.begin(), ouis_.end(), getOui(key));
+    CHECK(oui_it != ouis_.end() && *oui_it == getOui(key)) << "Cannot find OUI " << getOui(key);
+    const int nic_bits = 8 * (kBssidKeySize - kOuiSize);
+    return (uint64_t(oui_it - ouis_.begin()) << nic_bits) | (mapped_key & ((uint64_t(1) << nic_bits) - 1));
+}
+
+int BssidsDwarfIdeaBuilder::mappedKeySize() const
+{
+    // The OUI index takes 2 bytes unless there are too many OUIs.
+    if (oui_index_ && ouis_.size() <= kMaxShortOuiIndexSize)
+    {
+        return kBssidKeySize - 1;
+    }
+    return kBssidKeySize;
+}
+
+uint32_t BssidsDwarfIdeaBuilder::keyFormatFlags() const
+{
+    return oui_index_ ? kFormatFlagOuiIndex : 0;
+}
+
+void BssidsDwarfIdeaBuilder::writeHeaderExtra(std::ostream& os) const
+{
+    // No MCC / MNC pairs.
+    DwarfIdeaBuilder<kBssidKeySize, kBssidExtraDataSize>::writeHeaderExtra(os);
+    if (oui_index_)
+    {
+        // OUIs are sorted, so store them as varint deltas.
+        Bytes ouis;
+        for (size_t i = 0; i < ouis_.size(); ++i)
+        {
+            appendVarInt(i ? ouis_[i] - ouis_[i - 1] : ouis_[i], ouis);
+        }
+        putValue(uint32_t(ouis_.size()), os);
+        os.write((const char*)ouis.data(), ouis.size());
+    }
+}
@@ -0,0 +1,52 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "dwarf_idea_builder.h"
+#include "utils.h"
+
+#include <vector>
+
+// Specialization of DwarfIdeaBuilder that performs BSSIDs-specific keys encoding.
+//
+// The first 3 bytes of BSSID are the vendor OUI and the real-world datasets contain only
+// tens of thousands of distinct OUIs, so if requested the OUI is replaced with the index
+// in the table of OUIs present in the data, see kFormatFlagOuiIndex. This saves 1 byte
+// per key in the index and makes the deltas between the keys of different vendors smaller.
+class BssidsDwarfIdeaBuilder: public DwarfIdeaBuilder<kBssidKeySize, kBssidExtraDataSize>
+{
+  public:
+    explicit BssidsDwarfIdeaBuilder(const DwarfIdeaBuilderOptions& options);
+
+    void build(std::ostream& os) override;
+
+  protected:
+    uint64_t mapKey(const Key& key) const override;
+
+    int mappedKeySize() const override;
+
+    uint32_t keyFormatFlags() const override;
+
+    void writeHeaderExtra(std::ostream& os) const override;
+
+  private:
+    bool oui_index_;
+    // All OUIs present in the data, in ascending order.
+    std::vector<uint32_t> ouis_;
+};
@@ -19,15 +19,15 @@
 #include "bssids_parser.h"
 
 #include "ilocation_aggregator.h"
+#include "parser_stats.h"
 #include "utils.h"
 
-#include <glog/logging.h>
-
 void BssidsParser::addBssidEntry(
     const std::string& bssid_str,
     const std::string& lat_str,
     const std::string& lon_str,
-    ILocationAggregator& aggregator)
+    ILocationAggregator& aggregator,
+    ParserStats& stats)
 {
     Bytes bssid;
     bssid.reserve(kBssidKeySize);
@@ -40,7 +40,7 @@ void BssidsParser::addBssidEntry(
         }
         catch (std::invalid_argument)
         {
-            VLOG(1) << "Failed to parse BSSID: '" << bssid_str << "'";
+            stats.addRejectedRow("unparsable_bssid");
             return;
         }
 	bssid.push_back(uint8_t(val));
@@ -48,7 +48,7 @@ void BssidsParser::addBssidEntry(
 
     if (bssid.size() != kBssidKeySize)
     {
-	VLOG(1) << "Wrong BSSID format: '" << bssid_str << "'";
+        stats.addRejectedRow("wrong_bssid_size");
         return;
     }
 
@@ -58,17 +58,18 @@ void BssidsParser::addBssidEntry(
         lat = std::stof(lat_str);
         lon = std::stof(lon_str);
     }
-    catch (std::out_of_range)
+    catch (...)
     {
-        VLOG(1) << "Failed to parse coords for BSSID '" << bssid_str << "'";
+        stats.addRejectedRow("unparsable_coords");
         return;
     }
 
     if (lat == 0.0f && lon == 0.0f)
     {
-        VLOG(1) << "Coordinates are zero, skipping BSSID '" << bssid_str << "'";
+        stats.addRejectedRow("zero_coords");
         return;
     }
 
     aggregator.addLocation(bssid, lat, lon, 0, 1);
+    stats.addRow();
 }
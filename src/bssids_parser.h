@@ -21,6 +21,7 @@
 #include <string>
 
 class ILocationAggregator;
+class ParserStats;
 
 class BssidsParser
 {
@@ -29,5 +30,6 @@ class BssidsParser
         const std::string& bssid_str,
         const std::string& lat_str,
         const std::string& lon_str,
-        ILocationAggregator& aggregator);
+        ILocationAggregator& aggregator,
+        ParserStats& stats);
 };
@@ -30,6 +30,12 @@ void BssidsSqliteParser::parseRow(int cols, char* row[], char* names[], ILocatio
     CHECK_EQ(cols, 4) << "Internal error: unexpected results from SQLite3 query!";
     // Note: we don't use 'samples' so don't check whether it's null or not.
     for (int i = 0; i < 3; ++i)
-        if (!row[i]) return;
-    addBssidEntry(row[0], row[1], row[2], aggregator);
+    {
+        if (!row[i])
+        {
+            stats_.addRejectedRow("null_column");
+            return;
+        }
+    }
+    addBssidEntry(row[0], row[1], row[2], aggregator, stats_);
 }
@@ -20,8 +20,6 @@
 
 #include "utils.h"
 
-#include <glog/logging.h>
-
 namespace {
 
 // OpenCell and Mozilla
@@ -47,16 +45,16 @@ void CellsCsvParser::parseLine(const std::string& line, ILocationAggregator& agg
         // Note that lat, lon are reversed in OpenCellID CSV format.
         addCellEntry(
             tokens[0], tokens[1], tokens[2], tokens[3], tokens[4],
-            tokens[7], tokens[6], tokens[8], tokens[9], aggregator);
+            tokens[7], tokens[6], tokens[8], tokens[9], aggregator, stats_);
     }
     else if (tokens.size() == 12)
     {
         addCellEntry(
             tokens[2], tokens[3], tokens[4], tokens[5], tokens[6],
-            tokens[7], tokens[8], tokens[9], "1", aggregator);
+            tokens[7], tokens[8], tokens[9], "1", aggregator, stats_);
     }
     else
     {
-        LOG(ERROR) << "Failed to parse CSV line " << line << ": found " << tokens.size() << " tokens";
+        stats_.addRejectedRow("wrong_columns");
     }
 }
@@ -36,10 +36,10 @@ void CellsDwarfIdeaBuilder::build(std::ostream& os)
 {
     // Accumulate MCC and MNC values that are actually
     // present in the data so that we can remap them later.
-    for (const auto& entry: getEntries())
+    for (const auto& key: getKeys())
     {
-        uint16_t mcc = (char2short(entry.key[0]) << 8) | char2short(entry.key[1]);
-        uint16_t mnc = (char2short(entry.key[2]) << 8) | char2short(entry.key[3]);
+        uint16_t mcc = (char2short(key[0]) << 8) | char2short(key[1]);
+        uint16_t mnc = (char2short(key[2]) << 8) | char2short(key[3]);
         uint32_t mcc_mnc = (uint32_t(mcc) << 16) | mnc;
         if (!mccs_mncs_map_.count(mcc_mnc))
         {
@@ -63,21 +63,31 @@ void CellsDwarfIdeaBuilder::writeHeaderExtra(std::ostream& os) const
     }
 }
 
-Bytes CellsDwarfIdeaBuilder::mapKey(const Key& key) const
+uint64_t CellsDwarfIdeaBuilder::mapKey(const Key& key) const
 {
-    std::string key_str;
     uint16_t mcc = (char2short(key[0]) << 8) | char2short(key[1]);
     uint16_t mnc = (char2short(key[2]) << 8) | char2short(key[3]);
     uint32_t mcc_mnc = (uint32_t(mcc) << 16) | mnc;
     auto mcc_mnc_it = mccs_mncs_map_.find(mcc_mnc);
     CHECK(mcc_mnc_it != mccs_mncs_map_.end()) << "Cannot find MCC, MNC " << mcc << ", " << mnc;
-    key_str.append(1, static_cast<char>((mcc_mnc_it->second >> 8) & 0xFF));
-    key_str.append(1, static_cast<char>(mcc_mnc_it->second & 0xFF));
-    std::copy(&key[4], &key[key.size()], std::back_inserter(key_str));
-    return Bytes(key_str.begin(), key_str.end());
+    // The index of MCC, MNC pair followed by the remaining 6 bytes of the key.
+    uint64_t mapped_key = mcc_mnc_it->second;
+    for (size_t i = 4; i < key.size(); ++i)
+    {
+        mapped_key = (mapped_key << 8) | key[i];
+    }
+    return mapped_key;
 }
 
 int CellsDwarfIdeaBuilder::mappedKeySize() const
 {
     return 8;
 }
+
+std::vector<int> CellsDwarfIdeaBuilder::keySplitShifts() const
+{
+    // The key doesn't have the radio type, so offer the splits of all radios that have the
+    // structured cell ID: LTE ECI is eNB ID * 256 + sector and UMTS UC-Id is RNC ID * 65536 + CID.
+    // GSM cell IDs are just 16 bits, so they are left as is.
+    return {8, 16};
+}
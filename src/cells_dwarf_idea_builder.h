@@ -37,10 +37,12 @@ class CellsDwarfIdeaBuilder: public DwarfIdeaBuilder<kCellKeySize, kCellExtraDat
     void build(std::ostream& os) override;
 
   protected:
-    Bytes mapKey(const Key& key) const override;
+    uint64_t mapKey(const Key& key) const override;
 
     int mappedKeySize() const override;
 
+    std::vector<int> keySplitShifts() const override;
+
     void writeHeaderExtra(std::ostream& os) const override;
 
   private:
@@ -19,14 +19,13 @@
 #include "cells_parser.h"
 
 #include "ilocation_aggregator.h"
+#include "parser_stats.h"
 #include "utils.h"
 
 #include <algorithm>
 #include <string>
 #include <vector>
 
-#include <glog/logging.h>
-
 CellsParser::CellsParser(const std::string& blacklisted_standards)
 {
     split(blacklisted_standards, ',', blacklisted_standards_);
@@ -42,13 +41,18 @@ void CellsParser::addCellEntry(
     const std::string& lon_str,
     const std::string& radius_str,
     const std::string& samples_str,
-    ILocationAggregator& aggregator)
+    ILocationAggregator& aggregator,
+    ParserStats& stats)
 {
     if (std::find(
             blacklisted_standards_.begin(),
             blacklisted_standards_.end(),
-            standard_str) ==
+            standard_str) !=
         blacklisted_standards_.end())
+    {
+        stats.addRejectedRow("blacklisted_standard");
+    }
+    else
     {
         int mcc, mnc, lac, cell, radius, samples;
         float lat, lon;
@@ -65,29 +69,20 @@ void CellsParser::addCellEntry(
         }
         catch (...)
         {
-            VLOG(1) << "Failed to parse cell " <<
-                standard_str << ", " << mcc_str << ", " <<
-                mnc_str << ", " << lac_str << ", " <<
-                cell_str << ", " << lon_str << ", " <<
-                lat_str << ", " << radius_str << ", " <<
-                samples_str;
+            stats.addRejectedRow("unparsable_number");
             return;
         }
 
         // According to https://en.wikipedia.org/wiki/Mobile_country_code, the valid range for MCC is [200 - 800)
         if (mcc < 200 || mcc >= 800 || mnc < 0 || mnc > 0xFFFF || lac < 0 || lac > 0xFFFF || cell < 0 || cell > 0xFFFFFFFF)
         {
-             VLOG(1) << "Cell data is out of bounds: Standard = " << standard_str <<
-                 ", MCC = " << mcc << ", MNC = " << mnc <<
-                 ", LAC = " << lac << ", CELL = " << cell;
+             stats.addRejectedRow("out_of_bounds");
              return;
         }
 
         if (lat == 0.0f && lon == 0.0f)
         {
-             VLOG(1) << "Coordinates are zero, skipping the cell: Net = " << standard_str <<
-                 ", MCC = " << mcc << ", MNC = " << mnc <<
-                 ", LAC = " << lac << ", CELL = " << cell;
+             stats.addRejectedRow("zero_coords");
              return;
         }
 
@@ -97,5 +92,6 @@ void CellsParser::addCellEntry(
         appendBytes(asBytes(uint16_t(lac), true), key);
         appendBytes(asBytes(uint32_t(cell), true), key);
         aggregator.addLocation(key, lat, lon, radius, samples);
+        stats.addRow();
     }
 }
@@ -22,6 +22,7 @@
 #include <vector>
 
 class ILocationAggregator;
+class ParserStats;
 
 class CellsParser
 {
@@ -39,7 +40,8 @@ class CellsParser
         const std::string& lon_str,
         const std::string& radius_str,
         const std::string& samples_str,
-        ILocationAggregator& aggregator);
+        ILocationAggregator& aggregator,
+        ParserStats& stats);
 
   private:
     std::vector<std::string> blacklisted_standards_;
@@ -30,8 +30,14 @@ void CellsSqliteParser::parseRow(int cols, char* row[], char* names[], ILocation
 {
     CHECK_EQ(cols, 8) << "Internal error: unexpected results from SQLite3 query!";
     for (int i = 0; i < 8; ++i)
-        if (!row[i]) return;
+    {
+        if (!row[i])
+        {
+            stats_.addRejectedRow("null_column");
+            return;
+        }
+    }
     addCellEntry(
         row[0], row[1], row[2], row[3], row[4],
-        row[5], row[6], "500", row[7], aggregator);
+        row[5], row[6], "500", row[7], aggregator, stats_);
 }
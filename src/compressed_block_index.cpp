@@ -0,0 +1,208 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "compressed_block_index.h"
+
+#include <algorithm>
+
+namespace {
+
+// Group size + bottom level size.
+const size_t kHeaderSize = sizeof(uint32_t) + sizeof(uint64_t);
+// First key + first block offset + bottom level offset.
+const size_t kGroupSize = 3 * sizeof(uint64_t);
+
+}
+
+Bytes buildCompressedBlockIndex(
+    const std::vector<uint64_t>& keys, const std::vector<uint64_t>& offsets, size_t group_size)
+{
+    Bytes groups, bottom;
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        if (i % group_size == 0)
+        {
+            appendBytes(asBytes(keys[i]), groups);
+            appendBytes(asBytes(offsets[i]), groups);
+            appendBytes(asBytes(uint64_t(bottom.size())), groups);
+        }
+        else
+        {
+            appendBytes(asVarInt(keys[i] - keys[i - 1]), bottom);
+            appendBytes(asVarInt(offsets[i] - offsets[i - 1]), bottom);
+        }
+    }
+
+    Bytes output = asBytes(uint32_t(group_size));
+    appendBytes(asBytes(uint64_t(bottom.size())), output);
+    appendBytes(groups, output);
+    appendBytes(bottom, output);
+    return output;
+}
+
+CompressedBlockIndex::CompressedBlockIndex():
+    groups_(nullptr),
+    bottom_(nullptr),
+    bottom_size_(0),
+    num_blocks_(0),
+    num_groups_(0),
+    group_size_(0)
+{
+}
+
+bool CompressedBlockIndex::reset(const uint8_t* data, size_t size, size_t num_blocks, size_t& index_size)
+{
+    num_blocks_ = 0;
+    if (size < kHeaderSize || !num_blocks)
+    {
+        return false;
+    }
+    group_size_ = getLittleEndian(data, sizeof(uint32_t));
+    bottom_size_ = getLittleEndian(data + sizeof(uint32_t), sizeof(uint64_t));
+    if (!group_size_)
+    {
+        return false;
+    }
+    num_groups_ = (num_blocks + group_size_ - 1) / group_size_;
+    if ((size - kHeaderSize) / kGroupSize < num_groups_ || size - kHeaderSize - num_groups_ * kGroupSize < bottom_size_)
+    {
+        return false;
+    }
+    groups_ = data + kHeaderSize;
+    bottom_ = groups_ + num_groups_ * kGroupSize;
+
+    for (size_t group = 0; group < num_groups_; ++group)
+    {
+        const uint8_t* entry = groups_ + group * kGroupSize;
+        const uint64_t bottom_offset = getLittleEndian(entry + 2 * sizeof(uint64_t), sizeof(uint64_t));
+        if (bottom_offset > bottom_size_ ||
+            (group && (getGroupKey(group) <= getGroupKey(group - 1) ||
+                getGroupOffset(group) <= getGroupOffset(group - 1) ||
+                bottom_offset < getLittleEndian(entry - sizeof(uint64_t), sizeof(uint64_t)))))
+        {
+            return false;
+        }
+    }
+    if (getGroupOffset(0))
+    {
+        return false;
+    }
+
+    num_blocks_ = num_blocks;
+    index_size = kHeaderSize + num_groups_ * kGroupSize + bottom_size_;
+    return true;
+}
+
+uint64_t CompressedBlockIndex::getGroupKey(size_t group) const
+{
+    return getLittleEndian(groups_ + group * kGroupSize, sizeof(uint64_t));
+}
+
+uint64_t CompressedBlockIndex::getGroupOffset(size_t group) const
+{
+    return getLittleEndian(groups_ + group * kGroupSize + sizeof(uint64_t), sizeof(uint64_t));
+}
+
+uint64_t CompressedBlockIndex::getLastGroupOffset() const
+{
+    return getGroupOffset(num_groups_ - 1);
+}
+
+uint64_t CompressedBlockIndex::getLastGroupKey() const
+{
+    return getGroupKey(num_groups_ - 1);
+}
+
+bool CompressedBlockIndex::decodeGroup(
+    size_t group, size_t max_index, uint64_t max_key, size_t& index, uint64_t& key, uint64_t& offset,
+    uint64_t& next_offset) const
+{
+    const bool is_last_group = group + 1 == num_groups_;
+    const size_t num_group_blocks = is_last_group ? num_blocks_ - group * group_size_ : group_size_;
+    // The keys and offsets of the group must stay below the ones of the next group.
+    const uint64_t key_limit = is_last_group ? kNoEnd : getGroupKey(group + 1);
+    const uint64_t offset_limit = is_last_group ? kNoEnd : getGroupOffset(group + 1);
+
+    const uint8_t* data = bottom_ + getLittleEndian(groups_ + group * kGroupSize + 2 * sizeof(uint64_t), sizeof(uint64_t));
+    const uint8_t* end = bottom_ + bottom_size_;
+    index = 0;
+    key = getGroupKey(group);
+    offset = getGroupOffset(group);
+    next_offset = offset_limit;
+    for (size_t i = 1; i < num_group_blocks; ++i)
+    {
+        uint64_t key_diff = 0, offset_diff = 0;
+        if (!readVarInt(data, end, key_diff) || !readVarInt(data, end, offset_diff) ||
+            !key_diff || !offset_diff || key_diff >= key_limit - key || offset_diff >= offset_limit - offset)
+        {
+            return false;
+        }
+        next_offset = offset + offset_diff;
+        if (i > max_index || key_diff > max_key - key)
+        {
+            return true;
+        }
+        key += key_diff;
+        offset = next_offset;
+        next_offset = offset_limit;
+        index = i;
+    }
+    return true;
+}
+
+bool CompressedBlockIndex::find(uint64_t key, size_t& block_index) const
+{
+    if (!num_blocks_ || key < getGroupKey(0))
+    {
+        return false;
+    }
+    // The last group with the first key <= 'key'.
+    size_t min_group = 0, max_group = num_groups_ - 1;
+    while (min_group < max_group)
+    {
+        const size_t group = (min_group + max_group + 1) / 2;
+        if (getGroupKey(group) <= key)
+        {
+            min_group = group;
+        }
+        else
+        {
+            max_group = group - 1;
+        }
+    }
+    size_t index = 0;
+    uint64_t block_key = 0, offset = 0, next_offset = 0;
+    if (!decodeGroup(min_group, group_size_, key, index, block_key, offset, next_offset))
+    {
+        return false;
+    }
+    block_index = min_group * group_size_ + index;
+    return true;
+}
+
+bool CompressedBlockIndex::getBlock(size_t block_index, uint64_t& key, uint64_t& begin, uint64_t& end) const
+{
+    if (block_index >= num_blocks_)
+    {
+        return false;
+    }
+    size_t index = 0;
+    return decodeGroup(block_index / group_size_, block_index % group_size_, kNoEnd, index, key, begin, end) &&
+        index == block_index % group_size_;
+}
@@ -0,0 +1,98 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "utils.h"
+
+// Block index split into groups of 'group_size' consecutive blocks. The top level
+// has fixed size entries with the first key and offset of every group and is
+// searched in place, the rest of the keys and offsets of the group are delta-coded
+// in the bottom level and decoded on every lookup. Unlike the flat index nothing has
+// to be copied or decoded when the file is opened and only the top level is accessed
+// by every lookup, at the cost of decoding up to 'group_size' varint pairs per lookup.
+//
+// Serialized layout, all values are little-endian:
+// - u32 group size.
+// - u64 size of the bottom level.
+// - For every group: u64 first key, u64 offset of the first block, u64 offset of
+//   the group in the bottom level.
+// - The bottom level: for every block except the first one in its group, varints
+//   of the difference with the previous block key and offset.
+// The block offsets are relative to the first block, which immediately follows
+// all index sections, so that the index doesn't depend on their size.
+
+// Larger groups make the index slightly smaller, but the lookups are proportionally slower.
+constexpr size_t kDefaultCompressedBlockIndexGroupSize = 16;
+
+// Returns the serialized index for the sorted keys and the corresponding increasing offsets.
+Bytes buildCompressedBlockIndex(
+    const std::vector<uint64_t>& keys, const std::vector<uint64_t>& offsets, size_t group_size);
+
+class CompressedBlockIndex
+{
+  public:
+    // The end offset of the last block, which extends to the end of the file.
+    static constexpr uint64_t kNoEnd = uint64_t(-1);
+
+    CompressedBlockIndex();
+
+    // Uses the serialized index at 'data' in place, 'data' must outlive the index.
+    // Returns false if the index is malformed, otherwise sets 'index_size' to its
+    // size. Only the top level is validated, the bottom level is validated when
+    // the groups are decoded.
+    bool reset(const uint8_t* data, size_t size, size_t num_blocks, size_t& index_size);
+
+    bool empty() const { return !num_blocks_; }
+
+    // Finds the last block with the first key <= 'key', returns false if there's
+    // none or the group is malformed.
+    bool find(uint64_t key, size_t& block_index) const;
+
+    // Returns the first key of the block and its [begin, end) offsets relative to
+    // the first block, 'end' is kNoEnd for the last block. Returns false if the
+    // group is malformed.
+    bool getBlock(size_t block_index, uint64_t& key, uint64_t& begin, uint64_t& end) const;
+
+    // Offset of the last group, the offsets of all blocks are not smaller.
+    uint64_t getLastGroupOffset() const;
+
+    uint64_t getLastGroupKey() const;
+
+  private:
+    const uint8_t* groups_;
+    const uint8_t* bottom_;
+    size_t bottom_size_;
+    size_t num_blocks_, num_groups_, group_size_;
+
+    uint64_t getGroupKey(size_t group) const;
+
+    uint64_t getGroupOffset(size_t group) const;
+
+    // Decodes the keys and offsets of the group up to and including 'max_index'
+    // within the group, or up to the first key > 'max_key'. Sets 'index' to the
+    // last decoded block within the group.
+    bool decodeGroup(
+        size_t group, size_t max_index, uint64_t max_key, size_t& index, uint64_t& key, uint64_t& offset,
+        uint64_t& next_offset) const;
+};
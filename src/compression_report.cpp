@@ -0,0 +1,169 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "compression_report.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include <glog/logging.h>
+
+#include "dwarf_idea_format.h"
+
+CompressionReport::CompressionReport(const std::vector<TransformChain>& chains):
+    chains_(chains)
+{
+}
+
+size_t CompressionReport::addStream(const std::string& name, const std::vector<EntropyCodecType>& codecs)
+{
+    StreamStats stream;
+    stream.name = name;
+    for (size_t i = 0; i < chains_.size(); ++i)
+    {
+        ChainStats chain_stats;
+        chain_stats.chain = chains_[i];
+        chain_stats.freqs.assign(256, 0);
+        stream.chains.emplace_back(std::move(chain_stats));
+
+        for (EntropyCodecType codec_type: codecs)
+        {
+            VariantStats variant;
+            variant.chain_index = i;
+            variant.codec_type = codec_type;
+            variant.codec = createEntropyCodec(codec_type);
+            stream.variants.emplace_back(std::move(variant));
+        }
+    }
+    streams_.emplace_back(std::move(stream));
+    return streams_.size() - 1;
+}
+
+void CompressionReport::addStatsBlock(size_t stream, const Bytes& data)
+{
+    for (ChainStats& chain_stats: streams_[stream].chains)
+    {
+        Bytes transformed = forwardTransform(chain_stats.chain, data);
+        for (uint8_t c: transformed)
+        {
+#pragma omp atomic
+            ++chain_stats.freqs[c];
+        }
+#pragma omp atomic
+        chain_stats.total_size += transformed.size();
+    }
+}
+
+void CompressionReport::buildTables()
+{
+    for (StreamStats& stream_stats: streams_)
+    {
+        for (VariantStats& variant: stream_stats.variants)
+        {
+            const ChainStats& chain_stats = stream_stats.chains[variant.chain_index];
+            Bytes table = variant.codec->buildTable(chain_stats.freqs, chain_stats.total_size);
+            variant.table_size = table.size();
+            // The decoder needs its own tables, loading them from the serialized form
+            // also verifies the table round-trips correctly.
+            CHECK(variant.codec->loadTable(table.data(), table.size())) <<
+                "Failed to load " << getEntropyCodecName(variant.codec_type) << " table for " << stream_stats.name;
+        }
+    }
+}
+
+void CompressionReport::addBlock(size_t stream, const Bytes& data)
+{
+    StreamStats& stream_stats = streams_[stream];
+    std::vector<Bytes> transformed;
+    for (const ChainStats& chain_stats: stream_stats.chains)
+    {
+        transformed.emplace_back(forwardTransform(chain_stats.chain, data));
+    }
+
+    for (VariantStats& variant: stream_stats.variants)
+    {
+        const Bytes& input = transformed[variant.chain_index];
+        const size_t size = input.size() - 1;
+        uint8_t flags = input.back();
+        Bytes compressed = variant.codec->compress(input.data(), size);
+        bool is_raw = compressed.empty() || compressed.size() > size + 1;
+
+        // Decode the block the same way the readers do it.
+        Bytes entropy_decoded, decoded;
+        auto start = std::chrono::steady_clock::now();
+        bool entropy_ok = true;
+        if (is_raw)
+        {
+            entropy_decoded.assign(input.begin(), input.end() - 1);
+        }
+        else
+        {
+            entropy_ok = variant.codec->decompress(compressed.data(), compressed.size(), size, entropy_decoded);
+        }
+        auto entropy_end = std::chrono::steady_clock::now();
+        bool transform_ok = entropy_ok && inverseTransform(
+            chains_[variant.chain_index], entropy_decoded.data(), entropy_decoded.size(),
+            flags, data.size(), decoded);
+        auto end = std::chrono::steady_clock::now();
+        CHECK(transform_ok && decoded == data) <<
+            getTransformChainName(chains_[variant.chain_index]) << " + " <<
+            getEntropyCodecName(variant.codec_type) << " round-trip failed for " << stream_stats.name;
+        double entropy_decode_time = std::chrono::duration<double, std::micro>(entropy_end - start).count();
+        double decode_time = std::chrono::duration<double, std::micro>(end - start).count();
+
+        // Mirrors the framing used by the builder: varint of the size + 2 bits of flags.
+        size_t payload_size = is_raw ? size : compressed.size();
+        size_t block_size = asVarInt(payload_size << 2).size() + payload_size;
+
+#pragma omp critical
+        {
+            variant.compressed_size += block_size;
+            variant.num_raw_blocks += is_raw;
+            variant.total_entropy_decode_time += entropy_decode_time;
+            variant.total_decode_time += decode_time;
+            variant.max_decode_time = std::max(variant.max_decode_time, decode_time);
+        }
+    }
+
+#pragma omp critical
+    {
+        stream_stats.raw_size += data.size();
+        ++stream_stats.num_blocks;
+    }
+}
+
+void CompressionReport::log() const
+{
+    for (const auto& stream_stats: streams_)
+    {
+        size_t num_blocks = std::max<size_t>(1, stream_stats.num_blocks);
+        LOG(INFO) << "Compression of " << stream_stats.name << " stream: " <<
+            stream_stats.num_blocks << " blocks, " << stream_stats.raw_size << " bytes raw";
+        for (const auto& variant: stream_stats.variants)
+        {
+            LOG(INFO) << "  " << getTransformChainName(chains_[variant.chain_index]) << " + " <<
+                getEntropyCodecName(variant.codec_type) << ": " <<
+                variant.compressed_size << " bytes + " << variant.table_size << " bytes table, " <<
+                variant.num_raw_blocks << " blocks without entropy coding, decode time avg " <<
+                variant.total_decode_time / num_blocks << " us / block (entropy " <<
+                variant.total_entropy_decode_time / num_blocks << " us), max " <<
+                variant.max_decode_time << " us / block";
+        }
+    }
+}
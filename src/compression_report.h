@@ -0,0 +1,89 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "entropy_codecs.h"
+#include "transforms.h"
+#include "utils.h"
+
+// Compares transform chains and entropy codecs on the actual block streams produced by the builder.
+//
+// Each stream is evaluated with every transform chain and every entropy codec given for
+// this stream. The symbols statistics for each transform chain are gathered during the
+// builder stats pass, just like for the actual output. For every variant the total
+// compressed size is reported, including the per-block framing and the fallback to the
+// uncompressed data, plus the average and max time needed to decode a single block.
+class CompressionReport
+{
+  public:
+    explicit CompressionReport(const std::vector<TransformChain>& chains);
+
+    // Adds the stream evaluated with the given codecs, returns its index.
+    size_t addStream(const std::string& name, const std::vector<EntropyCodecType>& codecs);
+
+    // Accumulates the statistics for the given stream data in a single block. Thread-safe.
+    void addStatsBlock(size_t stream, const Bytes& data);
+
+    // Builds the entropy coding tables, must be called after all 'addStatsBlock' calls.
+    void buildTables();
+
+    // Compresses the given stream data in a single block with all variants,
+    // decodes it back and accumulates the results. Thread-safe.
+    void addBlock(size_t stream, const Bytes& data);
+
+    void log() const;
+
+  private:
+    struct ChainStats
+    {
+        TransformChain chain;
+        std::vector<unsigned> freqs;
+        size_t total_size = 0;
+    };
+
+    struct VariantStats
+    {
+        size_t chain_index;
+        EntropyCodecType codec_type;
+        std::unique_ptr<IEntropyCodec> codec;
+        size_t table_size = 0;
+        size_t compressed_size = 0;
+        size_t num_raw_blocks = 0;
+        double total_entropy_decode_time = 0.0;
+        double total_decode_time = 0.0;
+        double max_decode_time = 0.0;
+    };
+
+    struct StreamStats
+    {
+        std::string name;
+        size_t raw_size = 0;
+        size_t num_blocks = 0;
+        std::vector<ChainStats> chains;
+        std::vector<VariantStats> variants;
+    };
+
+    std::vector<TransformChain> chains_;
+    std::vector<StreamStats> streams_;
+};
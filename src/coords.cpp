@@ -0,0 +1,185 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "coords.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "dwarf_idea_format.h"
+
+int8_t bitsFor(uint64_t max_value)
+{
+    int8_t bits = 0;
+    while (bits < 64 && (max_value >> bits) != 0)
+    {
+        ++bits;
+    }
+    return bits;
+}
+
+size_t coordsGroupSize(uint64_t combinations)
+{
+    size_t group_size = 1;
+    for (uint64_t max_value = combinations;
+         max_value <= (std::numeric_limits<uint64_t>::max() >> 1) / combinations;
+         max_value *= combinations)
+    {
+        ++group_size;
+    }
+    return group_size;
+}
+
+uint32_t quantizeCoord(double value, double min, double diff, uint32_t steps)
+{
+    double ratio = std::max(0.0, std::min((value - min) / diff, 1.0));
+    return std::min((uint32_t)std::round(ratio * steps), steps);
+}
+
+float dequantizeCoord(uint32_t index, double min, double diff, uint32_t steps)
+{
+    return steps ? min + diff * index / steps : min;
+}
+
+uint64_t readBits(const uint8_t* data, uint64_t bit_offset, int count)
+{
+    uint64_t value = 0;
+    const uint8_t* cur = data + bit_offset / 8;
+    int skip_bits = bit_offset % 8;
+    int avail_bits = 8 - skip_bits;
+    uint8_t cur_byte = *cur++ & (0xFF >> skip_bits);
+    while (count > avail_bits)
+    {
+        value = (value << avail_bits) | cur_byte;
+        count -= avail_bits;
+        cur_byte = *cur++;
+        avail_bits = 8;
+    }
+    return (value << count) | (cur_byte >> (avail_bits - count));
+}
+
+CoordsReader::CoordsReader(int bounding_box_bits, bool coords_steps):
+    bounding_box_bits_(bounding_box_bits),
+    coords_steps_(coords_steps),
+    data_(nullptr)
+{
+    int32_t bounding_box_max_index = (1 << bounding_box_bits_) - 1;
+    bounding_box_lat_step_ = (kMaxLat - kMinLat) / bounding_box_max_index;
+    bounding_box_lon_step_ = (kMaxLon - kMinLon) / bounding_box_max_index;
+}
+
+bool CoordsReader::reset(const uint8_t* data, size_t size, size_t num_entries)
+{
+    const uint64_t total_bits = uint64_t(size) * 8;
+    uint64_t offset = 0;
+    auto read = [&](int count) -> uint64_t
+    {
+        uint64_t value = offset + count <= total_bits ? readBits(data, offset, count) : 0;
+        offset += count;
+        return value;
+    };
+
+    int32_t lat_min_index = read(bounding_box_bits_);
+    int32_t lon_min_index = read(bounding_box_bits_);
+    int32_t lat_max_index = read(bounding_box_bits_);
+    int32_t lon_max_index = read(bounding_box_bits_);
+    lat_bits_ = read(kCoordsBitsBits);
+    lon_bits_ = read(kCoordsBitsBits);
+    lat_steps_ = (1u << lat_bits_) - 1;
+    lon_steps_ = (1u << lon_bits_) - 1;
+    if (coords_steps_)
+    {
+        lat_steps_ = read(lat_bits_);
+        lon_steps_ = read(lon_bits_);
+        if (!lat_steps_ || !lon_steps_)
+        {
+            return false;
+        }
+    }
+    lat_combinations_ = uint64_t(lat_steps_) + 1;
+    combinations_ = lat_combinations_ * (uint64_t(lon_steps_) + 1);
+
+    min_corner_ = Point(
+        lat_min_index * bounding_box_lat_step_ + kMinLat,
+	lon_min_index * bounding_box_lon_step_ + kMinLon);
+    max_corner_ = Point(
+        lat_max_index * bounding_box_lat_step_ + kMinLat,
+	lon_max_index * bounding_box_lon_step_ + kMinLon);
+    max_lat_diff_ = max_corner_.lat - min_corner_.lat;
+    max_lon_diff_ = max_corner_.lon - min_corner_.lon;
+
+    data_ = data;
+    num_entries_ = num_entries;
+    entries_offset_ = offset;
+    uint64_t entries_bits = 0;
+    if (coords_steps_)
+    {
+        group_size_ = coordsGroupSize(combinations_);
+        uint64_t group_combinations = 1, last_group_combinations = 1;
+        for (size_t i = 0; i < group_size_; ++i)
+        {
+            group_combinations *= combinations_;
+            if (i < num_entries % group_size_)
+            {
+                last_group_combinations *= combinations_;
+            }
+        }
+        group_bits_ = bitsFor(group_combinations - 1);
+        last_group_bits_ = bitsFor(last_group_combinations - 1);
+        entries_bits = (num_entries / group_size_) * group_bits_ + last_group_bits_;
+    }
+    else
+    {
+        group_size_ = 1;
+        group_bits_ = last_group_bits_ = lat_bits_ + lon_bits_;
+        entries_bits = num_entries * group_bits_;
+    }
+    return entries_offset_ + entries_bits <= total_bits;
+}
+
+Point CoordsReader::getPoint(size_t index) const
+{
+    uint32_t lat_idx, lon_idx;
+    if (coords_steps_)
+    {
+        // Entries are packed into groups as mixed-radix numbers with the first entry of the group
+        // being the least significant "digit". Only the last group might have less entries and
+        // thus use less bits, so the offset of every group is the same as if all groups were full.
+        size_t group_index = index / group_size_;
+        int group_bits = group_index == num_entries_ / group_size_ ? last_group_bits_ : group_bits_;
+        uint64_t group = readBits(data_, entries_offset_ + group_index * group_bits_, group_bits);
+        for (size_t i = index % group_size_; i > 0; --i)
+        {
+            group /= combinations_;
+        }
+        uint64_t combined = group % combinations_;
+        lat_idx = combined % lat_combinations_;
+        lon_idx = combined / lat_combinations_;
+    }
+    else
+    {
+        uint64_t combined = readBits(data_, entries_offset_ + index * group_bits_, group_bits_);
+        lat_idx = combined & lat_steps_;
+        lon_idx = combined >> lat_bits_;
+    }
+    return Point(
+        dequantizeCoord(lat_idx, min_corner_.lat, max_lat_diff_, lat_steps_),
+        dequantizeCoord(lon_idx, min_corner_.lon, max_lon_diff_, lon_steps_));
+}
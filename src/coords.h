@@ -0,0 +1,77 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "utils.h"
+
+// Helpers for the coordinates quantization shared between the builder and the readers.
+
+// Returns the number of bits needed to represent values in [0, max_value] range.
+int8_t bitsFor(uint64_t max_value);
+
+// Returns how many entries with 'combinations' possible values each can be packed
+// together as a single mixed-radix number that fits into 63 bits.
+size_t coordsGroupSize(uint64_t combinations);
+
+uint32_t quantizeCoord(double value, double min, double diff, uint32_t steps);
+
+float dequantizeCoord(uint32_t index, double min, double diff, uint32_t steps);
+
+// Reads 'count' <= 64 bits starting at 'bit_offset' of the MSB-first bitstream, as written by
+// kanzi::DefaultOutputBitStream. The caller is responsible for checking the bounds.
+uint64_t readBits(const uint8_t* data, uint64_t bit_offset, int count);
+
+// Provides random access to the coordinates of the entries in the block coordinates stream,
+// see 'DwarfIdeaBuilder::encodeCoords' for the layout.
+class CoordsReader
+{
+  public:
+    // 'coords_steps' corresponds to kFormatFlagCoordsSteps.
+    CoordsReader(int bounding_box_bits, bool coords_steps);
+
+    // Parses the header of the coordinates stream with 'num_entries' entries.
+    // Returns false if the data is malformed or truncated.
+    bool reset(const uint8_t* data, size_t size, size_t num_entries);
+
+    // Returns the coordinates of the entry with the given index in the block.
+    Point getPoint(size_t index) const;
+
+    const Point& getMinCorner() const { return min_corner_; }
+
+    const Point& getMaxCorner() const { return max_corner_; }
+
+  private:
+    int bounding_box_bits_;
+    bool coords_steps_;
+    double bounding_box_lat_step_, bounding_box_lon_step_;
+    const uint8_t* data_;
+    size_t num_entries_;
+    uint64_t entries_offset_;
+    Point min_corner_, max_corner_;
+    double max_lat_diff_, max_lon_diff_;
+    int lat_bits_, lon_bits_;
+    uint32_t lat_steps_, lon_steps_;
+    uint64_t lat_combinations_, combinations_;
+    size_t group_size_;
+    int group_bits_, last_group_bits_;
+};
@@ -0,0 +1,157 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "decoded_blocks_cache.h"
+
+#include <glog/logging.h>
+
+#include "batch_lookup.h"
+
+namespace {
+
+// Rough per-block overhead of the LRU list and hash map nodes.
+const size_t kItemOverhead = 64;
+
+}
+
+DecodedBlocksCache::DecodedBlocksCache(
+    const DwarfIdeaReader& reader, size_t max_memory_usage, size_t num_shards):
+    reader_(reader),
+    shards_(num_shards),
+    hits_(0),
+    misses_(0)
+{
+    CHECK_GT(num_shards, 0) << "At least one cache shard is required!";
+    max_shard_memory_usage_ = max_memory_usage / num_shards;
+}
+
+std::shared_ptr<const DecodedBlock> DecodedBlocksCache::getBlock(size_t block_index)
+{
+    Shard& shard = shards_[block_index % shards_.size()];
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto item_it = shard.items.find(block_index);
+        if (item_it != shard.items.end())
+        {
+            shard.lru.splice(shard.lru.begin(), shard.lru, item_it->second.lru_it);
+            ++hits_;
+            return item_it->second.block;
+        }
+    }
+
+    // Decode without holding the lock: if several threads miss the same block
+    // simultaneously, each decodes it and the first one to finish wins.
+    ++misses_;
+    std::shared_ptr<DecodedBlock> block = std::make_shared<DecodedBlock>();
+    if (!reader_.decodeBlock(block_index, *block))
+    {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto inserted = shard.items.insert(std::make_pair(block_index, Shard::Item()));
+    Shard::Item& item = inserted.first->second;
+    if (!inserted.second)
+    {
+        shard.lru.splice(shard.lru.begin(), shard.lru, item.lru_it);
+        return item.block;
+    }
+    item.block = block;
+    item.memory_usage = block->getMemoryUsage() + kItemOverhead;
+    item.lru_it = shard.lru.insert(shard.lru.begin(), block_index);
+    shard.memory_usage += item.memory_usage;
+    evict(shard);
+    return block;
+}
+
+void DecodedBlocksCache::evict(Shard& shard)
+{
+    while (shard.memory_usage > max_shard_memory_usage_ && !shard.lru.empty())
+    {
+        auto item_it = shard.items.find(shard.lru.back());
+        shard.memory_usage -= item_it->second.memory_usage;
+        shard.items.erase(item_it);
+        shard.lru.pop_back();
+        ++shard.evictions;
+    }
+}
+
+bool DecodedBlocksCache::lookup(const std::string& key, Point& point, std::string* extra_data)
+{
+    uint64_t mapped_key = 0;
+    return reader_.mapKey(key, mapped_key) && lookupMappedKey(mapped_key, point, extra_data);
+}
+
+bool DecodedBlocksCache::lookupMappedKey(uint64_t mapped_key, Point& point, std::string* extra_data)
+{
+    size_t block_index = 0, entry_index = 0;
+    if (!reader_.mayContain(mapped_key) || !reader_.findBlock(mapped_key, block_index))
+    {
+        return false;
+    }
+    std::shared_ptr<const DecodedBlock> block = getBlock(block_index);
+    if (!block || !block->findEntry(mapped_key, entry_index))
+    {
+        return false;
+    }
+    point = block->getPoint(entry_index);
+    if (extra_data)
+    {
+        const size_t extra_data_size = reader_.getHeader().extra_data_size;
+        const uint8_t* entry_extra_data = block->extra_data.data() + entry_index * extra_data_size;
+        extra_data->assign(entry_extra_data, entry_extra_data + extra_data_size);
+    }
+    return true;
+}
+
+void DecodedBlocksCache::lookupBatch(
+    const std::string* keys, size_t num_keys, LookupResult* results, int num_threads)
+{
+    auto get_block = [this](size_t block_index) { return getBlock(block_index); };
+    ::lookupBatch(reader_, get_block, keys, num_keys, results, num_threads);
+}
+
+DecodedBlocksCacheStats DecodedBlocksCache::getStats() const
+{
+    DecodedBlocksCacheStats stats;
+    stats.hits = hits_;
+    stats.misses = misses_;
+    stats.evictions = 0;
+    stats.num_blocks = 0;
+    stats.memory_usage = 0;
+    for (const Shard& shard: shards_)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        stats.evictions += shard.evictions;
+        stats.num_blocks += shard.items.size();
+        stats.memory_usage += shard.memory_usage;
+    }
+    return stats;
+}
+
+void DecodedBlocksCache::clear()
+{
+    for (Shard& shard: shards_)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.lru.clear();
+        shard.items.clear();
+        shard.memory_usage = 0;
+    }
+}
@@ -0,0 +1,94 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dwarf_idea_reader.h"
+
+// LRU cache of decoded blocks on top of 'DwarfIdeaReader' for the repeated point
+// lookups that hit the same blocks.
+//
+// The cache is split into shards by the block index, each shard has its own lock
+// and its own share of the memory budget. The blocks are decoded outside of the
+// locks and are returned as shared pointers, so eviction never invalidates the
+// blocks that are still in use. All methods are safe to call concurrently.
+
+struct DecodedBlocksCacheStats
+{
+    uint64_t hits, misses, evictions;
+    size_t num_blocks, memory_usage;
+};
+
+class DecodedBlocksCache
+{
+  public:
+    // 'reader' must outlive the cache, 'max_memory_usage' is in bytes.
+    DecodedBlocksCache(const DwarfIdeaReader& reader, size_t max_memory_usage, size_t num_shards = 16);
+
+    // Returns the decoded block or nullptr if the block is malformed.
+    std::shared_ptr<const DecodedBlock> getBlock(size_t block_index);
+
+    // Same as 'DwarfIdeaReader::lookup', but goes through the cache.
+    bool lookup(const std::string& key, Point& point, std::string* extra_data = nullptr);
+
+    bool lookupMappedKey(uint64_t mapped_key, Point& point, std::string* extra_data = nullptr);
+
+    // Same as 'DwarfIdeaReader::lookupBatch', but goes through the cache.
+    void lookupBatch(const std::string* keys, size_t num_keys, LookupResult* results, int num_threads = 1);
+
+    DecodedBlocksCacheStats getStats() const;
+
+    void clear();
+
+  private:
+    struct Shard
+    {
+        typedef std::list<size_t> LruList;
+
+        struct Item
+        {
+            std::shared_ptr<const DecodedBlock> block;
+            size_t memory_usage;
+            LruList::iterator lru_it;
+        };
+
+        mutable std::mutex mutex;
+        // Most recently used blocks first.
+        LruList lru;
+        std::unordered_map<size_t, Item> items;
+        size_t memory_usage = 0;
+        uint64_t evictions = 0;
+    };
+
+    const DwarfIdeaReader& reader_;
+    size_t max_shard_memory_usage_;
+    std::vector<Shard> shards_;
+    std::atomic<uint64_t> hits_, misses_;
+
+    void evict(Shard& shard);
+};
@@ -23,88 +23,205 @@
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <limits>
+#include <random>
 #include <sstream>
 #include <string>
 
 #include <glog/logging.h>
+#include <omp.h>
 
 #include <bitstream/DefaultOutputBitStream.hpp>
-#include <function/ZRLT.hpp>
-#include <transform/BWTS.hpp>
-#include <transform/SBRT.hpp>
+
+#include "compressed_block_index.h"
+#include "coords.h"
+#include "dwarf_idea_format.h"
+#include "dwarf_idea_reader.h"
+#include "eytzinger_index.h"
+#include "membership_filter.h"
+#include "stats_report.h"
 
 namespace {
 
-const char* kFileSignature = "DwarfIdea";
-const uint16_t kFileFormatVersion = 1;
+// Max number of quantization steps per coordinate, so that the number of steps fits into 31 bits.
+const uint32_t kMaxCoordsSteps = (1u << 31) - 1;
+// How much to shrink the error budget if the analytical estimate turns out to be too optimistic.
+const double kBudgetShrinkFactor = 0.99;
+// Step multiplier used when searching for the best number of lat steps for kExact quantization.
+const double kLatStepsSearchFactor = 1.01;
+// Number of keys per batch when verifying batched lookups.
+const size_t kVerifyBatchSize = 4096;
+// Number of random keys used to measure the membership filter false positive rate.
+const size_t kFilterCheckKeys = 1000000;
+
+template <typename T>
+void writeVarInt(std::ostream& os, T value) {
+  Bytes value_bytes = asVarInt(value);
+  os.write((const char*)value_bytes.data(), value_bytes.size());
+}
 
 template <typename T>
-Bytes asVarInt(T value)
+T clamp(T value, T min = 0, T max = 1)
 {
-    Bytes result;
-    T cur_value = value;
+    return std::max(min, std::min(value, max));
+}
+
+// Returns the min number of steps so that the rounding error, which is half of the step,
+// doesn't exceed 'max_error'; all values are in radians.
+double minCoordsSteps(double diff, double max_error)
+{
+    return std::max(1.0, std::ceil(diff / (2.0 * max_error)));
+}
 
-    while (true)
+// Returns the size of the data with the given symbols frequencies in bits if coded
+// with the order 0 entropy coder.
+template <typename Freqs>
+double estimateCodedBits(const Freqs& freqs)
+{
+    double total = 0.0;
+    for (auto freq: freqs)
     {
-        if (cur_value < 0x80)
-	{
-	    result.push_back(cur_value);
-	    break;
-	}
-	else
-	{
-	    result.push_back((cur_value & 0x7F) | 0x80);
-	    cur_value >>= 7;
-	}
+        total += freq;
+    }
+    double bits = 0.0;
+    for (auto freq: freqs)
+    {
+        if (freq)
+        {
+            bits -= freq * std::log2(freq / total);
+        }
     }
+    return bits;
+}
 
-    return result;
+double estimateCodedBits(const Bytes& data)
+{
+    std::array<size_t, 256> freqs = {};
+    for (uint8_t c: data)
+    {
+        ++freqs[c];
+    }
+    return estimateCodedBits(freqs);
 }
 
-template <typename T>
-void writeVarInt(std::ostream& os, T value) {
-  Bytes value_bytes = asVarInt(value);
-  os.write((const char*)value_bytes.data(), value_bytes.size());
+// Returns the size of the transformed data compressed with the codec and framed as
+// by 'entropyCompress'.
+size_t getFramedSize(const Bytes& data, const IEntropyCodec& codec, size_t table_index_size)
+{
+    // The last byte of the transformed data holds the stream flags.
+    size_t size = codec.compress(data.data(), data.size() - 1).size();
+    if (!size || size + table_index_size > data.size())
+    {
+        size = data.size() - 1;
+    }
+    else
+    {
+        size += table_index_size;
+    }
+    return asVarInt(size << 2).size() + size;
 }
 
-template <typename T>
-T clamp(T value, T min = 0, T max = 1)
+// Prepends the stream data with its size and flags, see 'StreamFlags'.
+Bytes frameStream(const Bytes& data, uint8_t flags)
 {
-    return std::max(min, std::min(value, max));
+    Bytes output = asVarInt((data.size() << 2) | flags);
+    appendBytes(data, output);
+    return output;
 }
 
 } // namespace
 
-template <int KeySize, int ExtraDataSize>
-DwarfIdeaBuilder<KeySize, ExtraDataSize>::Entry::Entry(
-    const Key& key, const Point& point, const std::string& extra_data_str):
-    key(key), point(point)
+CoordsQuantization parseCoordsQuantization(const std::string& name)
 {
-    std::copy(extra_data_str.begin(), extra_data_str.end(), &extra_data[0]);
+    if (name == "conservative")
+    {
+        return CoordsQuantization::kConservative;
+    }
+    else if (name == "joint")
+    {
+        return CoordsQuantization::kJoint;
+    }
+    else if (name == "exact")
+    {
+        return CoordsQuantization::kExact;
+    }
+    LOG(FATAL) << "Unknown coordinates quantization " << name;
+    return CoordsQuantization::kJoint;
 }
 
 template <int KeySize, int ExtraDataSize>
-DwarfIdeaBuilder<KeySize, ExtraDataSize>::FseInfo::FseInfo():
-    total_size(0),
+DwarfIdeaBuilder<KeySize, ExtraDataSize>::StreamInfo::StreamInfo(const char* name, EntropyCodecType codec_type):
+    name(name),
     freqs(256, 0),
-    freqs_normalized(256, 0)
+    total_size(0),
+    codec_type(codec_type),
+    report_index(0),
+    single_table_size(0),
+    single_table_compressed_size(0),
+    compressed_size(0)
 {
 }
 
 template <int KeySize, int ExtraDataSize>
 DwarfIdeaBuilder<KeySize, ExtraDataSize>::DwarfIdeaBuilder(
-    float max_dist_error, uint16_t min_entries_per_block,
-    uint16_t max_entries_per_block, uint8_t bounding_box_bits):
-    min_entries_per_block_(min_entries_per_block),
-    max_entries_per_block_(max_entries_per_block),
-    bounding_box_bits_(bounding_box_bits),
-    max_dist_error_(max_dist_error)
+    const DwarfIdeaBuilderOptions& options):
+    max_dist_error_(options.max_dist_error),
+    min_entries_per_block_(options.min_entries_per_block),
+    max_entries_per_block_(options.max_entries_per_block),
+    bounding_box_bits_(options.bounding_box_bits),
+    coords_quantization_(options.coords_quantization),
+    check_coords_error_(options.check_coords_error),
+    max_coords_error_(0.0),
+    sum_coords_error_(0.0),
+    keys_stream_("keys", options.keys_codec),
+    coords_stream_("coords", options.coords_codec),
+    extra_data_stream_("extra data", options.extra_data_codec),
+    transform_chain_(options.transform_chain),
+    entropy_tables_(options.entropy_tables),
+    stats_sample_ratio_(options.stats_sample_ratio),
+    packed_coords_(options.packed_coords),
+    eytzinger_index_(options.eytzinger_index),
+    membership_filter_(options.membership_filter),
+    wide_offsets_(options.wide_offsets),
+    compressed_index_(options.compressed_index),
+    spatial_index_(options.spatial_index),
+    split_keys_(options.split_keys),
+    stats_report_(options.stats_report),
+    block_stats_path_(options.block_stats_path),
+    trace_(options.trace),
+    previous_path_(options.previous_path)
 {
     CHECK_LT(bounding_box_bits_, 32) << "Too many bounding box bits requested!";
+    CHECK(!compressed_index_ || !eytzinger_index_) << "Eytzinger index requires the uncompressed index";
+    CHECK_GE(entropy_tables_, 1) << "At least one entropy coding table per stream is required";
+    CHECK(stats_sample_ratio_ > 0.0 && stats_sample_ratio_ <= 1.0) << "Invalid stats sample ratio " <<
+        stats_sample_ratio_;
     bounding_box_max_index_ = (1 << (int32_t)bounding_box_bits_) - 1;
+    if (options.entropy_codecs_report || options.transform_chains_report)
+    {
+        std::vector<TransformChain> chains(1, transform_chain_);
+        if (options.transform_chains_report)
+        {
+            chains.assign(std::begin(kAllTransformChains), std::end(kAllTransformChains));
+        }
+        auto codecs = [&options](EntropyCodecType codec_type)
+        {
+            return options.entropy_codecs_report ?
+                std::vector<EntropyCodecType>(std::begin(kAllEntropyCodecTypes), std::end(kAllEntropyCodecTypes)) :
+                std::vector<EntropyCodecType>(1, codec_type);
+        };
+        compression_report_.reset(new CompressionReport(chains));
+        keys_stream_.report_index = compression_report_->addStream("keys", codecs(keys_stream_.codec_type));
+        coords_stream_.report_index = compression_report_->addStream("coords", codecs(coords_stream_.codec_type));
+        if (ExtraDataSize)
+        {
+            extra_data_stream_.report_index = compression_report_->addStream(
+                "extra data", codecs(extra_data_stream_.codec_type));
+        }
+    }
     bounding_box_lat_step_ = (kMaxLat - kMinLat) / bounding_box_max_index_;
     bounding_box_lon_step_ = (kMaxLon - kMinLon) / bounding_box_max_index_;
-    double max_central_angle = max_dist_error / kEarthRadius;
+    double max_central_angle = max_dist_error_ / kEarthRadius;
     double sin_ca2 = std::sin(max_central_angle / 2.0);
     sin2_ca2_2_ = sin_ca2 * sin_ca2 / 2.0;
     dlat_ = 180.0 * 2.0 / M_PI * std::asin(std::sqrt(sin2_ca2_2_));
@@ -119,20 +236,167 @@ void DwarfIdeaBuilder<KeySize, ExtraDataSize>::addLocation(
     Key key;
     CHECK_EQ(key_str.size(), KeySize) << "Unexpected key size " <<
        key_str.size() << " for key " << key_str;
+    CHECK_EQ(extra_data.size(), ExtraDataSize) << "Unexpected extra data size " <<
+       extra_data.size() << " for key " << key_str;
     std::copy(key_str.begin(), key_str.end(), key.begin());
-    entries_.emplace_back(Entry(key, Point(lat, lon), extra_data));
+    keys_.push_back(key);
+    lats_.push_back(lat);
+    lons_.push_back(lon);
+    extra_data_.insert(extra_data_.end(), extra_data.begin(), extra_data.end());
+}
+
+template <int KeySize, int ExtraDataSize>
+void DwarfIdeaBuilder<KeySize, ExtraDataSize>::mapKeys()
+{
+    // Mapping may be expensive, e.g. for cells it involves the hash lookup, so do it
+    // just once instead of in every pass.
+    mapped_keys_.resize(keys_.size());
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < keys_.size(); ++i)
+    {
+        mapped_keys_[i] = mapKey(keys_[i]);
+    }
+}
+
+template <int KeySize, int ExtraDataSize>
+Bytes DwarfIdeaBuilder<KeySize, ExtraDataSize>::mappedKeyBytes(uint64_t mapped_key) const
+{
+    const Bytes bytes = asBytes(mapped_key, true);
+    return Bytes(bytes.end() - mappedKeySize(), bytes.end());
+}
+
+template <int KeySize, int ExtraDataSize>
+void DwarfIdeaBuilder<KeySize, ExtraDataSize>::loadPrevious()
+{
+    DwarfIdeaReader reader;
+    CHECK(reader.open(previous_path_)) << "Failed to open previous build " << previous_path_;
+    const DwarfIdeaHeader& header = reader.getHeader();
+    // The previous build may have found the split keys not worth it, see 'chooseKeysLayout'.
+    uint32_t format_flags = formatFlags();
+    if (!(header.format_flags & kFormatFlagSplitKeys))
+    {
+        format_flags &= ~kFormatFlagSplitKeys;
+    }
+    // With any of these different the blocks can't match anyway.
+    if (header.key_size != KeySize || header.extra_data_size != ExtraDataSize ||
+        header.format_flags != format_flags || header.transform_chain != transform_chain_ ||
+        header.min_entries_per_block != min_entries_per_block_ ||
+        header.max_entries_per_block != max_entries_per_block_ ||
+        header.bounding_box_bits != bounding_box_bits_ || header.max_dist_error != max_dist_error_)
+    {
+        LOG(WARNING) << "Previous build " << previous_path_ << " uses different format or parameters, ignoring it";
+        return;
+    }
+    split_keys_ = split_keys_ && (header.format_flags & kFormatFlagSplitKeys);
+
+    // Raw keys are used as the mapping of cells keys depends on the set of MCC / MNC pairs.
+    previous_first_keys_.resize(reader.getNumBlocks());
+    for (size_t i = 0; i < reader.getNumBlocks(); ++i)
+    {
+        uint64_t first_key = 0;
+        const uint8_t* data = nullptr;
+        size_t size = 0;
+        std::string key;
+        CHECK(reader.getBlockData(i, first_key, data, size) && reader.unmapKey(first_key, key)) <<
+            "Malformed block " << i << " in previous build " << previous_path_;
+        std::copy(key.begin(), key.end(), previous_first_keys_[i].begin());
+    }
+
+    loadPreviousTables(reader.getKeysTables(), keys_stream_);
+    if (!packed_coords_)
+    {
+        loadPreviousTables(reader.getCoordsTables(), coords_stream_);
+        if (ExtraDataSize)
+        {
+            loadPreviousTables(reader.getExtraDataTables(), extra_data_stream_);
+        }
+    }
+    LOG(INFO) << "Anchoring to " << previous_first_keys_.size() << " blocks of previous build " << previous_path_;
+}
+
+template <int KeySize, int ExtraDataSize>
+void DwarfIdeaBuilder<KeySize, ExtraDataSize>::loadPreviousTables(
+    const std::vector<EntropyTable>& tables, StreamInfo& stream)
+{
+    // The symbols absent from the previous tables make 'compress' fail, such streams
+    // are then stored without entropy coding, see 'entropyCompress'.
+    std::vector<std::unique_ptr<IEntropyCodec>> codecs;
+    for (const EntropyTable& table: tables)
+    {
+        codecs.push_back(createEntropyCodec(stream.codec_type));
+        if (table.codec_type != stream.codec_type || tables.size() > entropy_tables_ ||
+            !codecs.back()->loadCompressionTable(table.data, table.size))
+        {
+            LOG(WARNING) << "Cannot reuse " << stream.name << " entropy coding tables of previous build, " <<
+                "the blocks will differ";
+            return;
+        }
+    }
+    stream.codecs = std::move(codecs);
+    for (const EntropyTable& table: tables)
+    {
+        stream.tables.emplace_back(table.data, table.data + table.size);
+    }
+}
+
+template <int KeySize, int ExtraDataSize>
+void DwarfIdeaBuilder<KeySize, ExtraDataSize>::chooseKeysLayout()
+{
+    // E.g. for the regularly numbered cells BWTS does better on the plain deltas, and then
+    // the split only costs the shift byte per block, which the per block choice can't avoid.
+    // So compare the order 0 coded size of the transformed keys of the stats blocks with and
+    // without the split, which follows the actual size with the single table closely enough.
+    std::vector<unsigned> plain_freqs(256, 0), split_freqs(256, 0);
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < index_.size(); ++i)
+    {
+        size_t num_cur_entries =
+            ((i == index_.size() - 1) ? keys_.size() : index_[i + 1]) - index_[i];
+        if (num_cur_entries > 0 && isStatsBlock(i))
+        {
+            updateFreqs(compressBytes(encodeKeyDeltas(&mapped_keys_[index_[i]], num_cur_entries)), plain_freqs);
+            updateFreqs(compressBytes(encodeKeys(i, num_cur_entries, 0)), split_freqs);
+        }
+    }
+    const double plain_bits = estimateCodedBits(plain_freqs);
+    const double split_bits = estimateCodedBits(split_freqs);
+    LOG(INFO) << "Estimated keys size: " << size_t(plain_bits / 8) << " bytes plain, " <<
+        size_t(split_bits / 8) << " bytes split";
+    if (split_bits >= plain_bits)
+    {
+        LOG(INFO) << "Split keys don't reduce the keys size, not using them";
+        split_keys_ = false;
+    }
 }
 
 template <int KeySize, int ExtraDataSize>
 void DwarfIdeaBuilder<KeySize, ExtraDataSize>::buildIndex()
 {
-    index_dist_.resize(entries_.size() - 1, 0.0f);
-    for (size_t i = 0; i < entries_.size() - 1; ++i)
+    index_dist_.resize(keys_.size() - 1, 0.0f);
+    for (size_t i = 0; i < keys_.size() - 1; ++i)
     {
-        index_dist_[i] = getDist(entries_[i].point, entries_[i + 1].point);
+        index_dist_[i] = getDist(getPoint(i), getPoint(i + 1));
     }
     index_.push_back(0);
-    findIndexSplit(0, entries_.size() - 1);
+
+    // Split at the first keys of the previous build blocks, so that the runs of the
+    // unchanged entries stay in the same blocks, and only split further the ranges
+    // that grew too large. The anchors that would produce too small blocks are skipped.
+    size_t range_begin = 0;
+    auto anchor_it = keys_.begin();
+    for (const Key& first_key: previous_first_keys_)
+    {
+        anchor_it = std::lower_bound(anchor_it, keys_.end(), first_key);
+        const size_t anchor_index = anchor_it - keys_.begin();
+        if (anchor_index - range_begin >= min_entries_per_block_ &&
+            keys_.size() - anchor_index >= min_entries_per_block_)
+        {
+            findIndexSplit(range_begin, anchor_index - 1);
+            index_.push_back(anchor_index);
+            range_begin = anchor_index;
+        }
+    }
+    findIndexSplit(range_begin, keys_.size() - 1);
     std::sort(index_.begin(), index_.end());
 }
 
@@ -161,19 +425,131 @@ void DwarfIdeaBuilder<KeySize, ExtraDataSize>::findIndexSplit(
 }
 
 template <int KeySize, int ExtraDataSize>
-void DwarfIdeaBuilder<KeySize, ExtraDataSize>::writeFseHeader(std::ostream& os, FseInfo& fse_info)
+bool DwarfIdeaBuilder<KeySize, ExtraDataSize>::isStatsBlock(size_t index) const
 {
-    unsigned table_log = FSE_optimalTableLog(0, fse_info.total_size, 255);
-    FSE_normalizeCount(
-        &fse_info.freqs_normalized[0], table_log, &fse_info.freqs[0], fse_info.total_size, 255);
-    fse_info.ctable.reset(FSE_createCTable(255, table_log));
-    FSE_buildCTable(fse_info.ctable.get(), &fse_info.freqs_normalized[0], 255, table_log);
-    Bytes buffer(FSE_NCountWriteBound(255, table_log), 0);
-    size_t header_size = FSE_writeNCount(
-            (void*)buffer.data(), buffer.size(), &fse_info.freqs_normalized[0],
-	    255, table_log);
-    putValue(uint32_t(header_size), os);
-    os.write((const char*)buffer.data(), header_size);
+    // The blocks are ordered by keys, so taking the first block of every 1 / ratio blocks
+    // samples all parts of the keys space, e.g. all MCC / MNC pairs and radio types.
+    return !index || size_t(index * stats_sample_ratio_) != size_t((index - 1) * stats_sample_ratio_);
+}
+
+template <int KeySize, int ExtraDataSize>
+void DwarfIdeaBuilder<KeySize, ExtraDataSize>::buildTables()
+{
+    buildStreamTables(keys_stream_);
+    if (!packed_coords_)
+    {
+        buildStreamTables(coords_stream_);
+        if (ExtraDataSize)
+        {
+            buildStreamTables(extra_data_stream_);
+        }
+    }
+}
+
+template <int KeySize, int ExtraDataSize>
+void DwarfIdeaBuilder<KeySize, ExtraDataSize>::buildStreamTables(StreamInfo& stream)
+{
+    if (!stream.tables.empty())
+    {
+        // Loaded from the previous build.
+        return;
+    }
+
+    if (stream.block_data.empty())
+    {
+        stream.codecs.push_back(createEntropyCodec(stream.codec_type));
+        stream.tables.push_back(buildTable(*stream.codecs.back(), stream.freqs, stream.total_size));
+        return;
+    }
+
+    // Only the sampled blocks have the data.
+    auto not_sampled = [](const Bytes& data) { return data.empty(); };
+    stream.block_data.erase(
+        std::remove_if(stream.block_data.begin(), stream.block_data.end(), not_sampled), stream.block_data.end());
+    std::vector<SparseFreqs> block_freqs(stream.block_data.size());
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < block_freqs.size(); ++i)
+    {
+        const Bytes& data = stream.block_data[i];
+        block_freqs[i] = getSparseFreqs(data.data(), data.size() - 1);
+    }
+
+    // The actual size of the stream with the clusters tables, as written by 'writeCodecHeader'
+    // and 'entropyCompress', except that every block uses the table of its cluster.
+    auto get_size = [this, &stream](const FreqsClusters& clusters)
+    {
+        std::vector<std::unique_ptr<IEntropyCodec>> codecs;
+        size_t tables_size = sizeof(uint8_t);
+        for (size_t i = 0; i < clusters.freqs.size(); ++i)
+        {
+            codecs.push_back(createEntropyCodec(stream.codec_type));
+            tables_size += sizeof(uint32_t) +
+                buildTable(*codecs.back(), clusters.freqs[i], clusters.total_sizes[i]).size();
+        }
+        const size_t table_index_size = codecs.size() > 1 ? 1 : 0;
+        size_t blocks_size = 0;
+#pragma omp parallel for schedule(static) reduction(+: blocks_size)
+        for (size_t i = 0; i < stream.block_data.size(); ++i)
+        {
+            blocks_size += getFramedSize(stream.block_data[i], *codecs[clusters.assignment[i]], table_index_size);
+        }
+        // Extrapolate from the sampled blocks to all of them, see 'isStatsBlock'.
+        return tables_size + blocks_size / stats_sample_ratio_;
+    };
+
+    FreqsClusters clusters = clusterFreqs(block_freqs, entropy_tables_, get_size);
+    for (size_t i = 0; i < clusters.freqs.size(); ++i)
+    {
+        stream.codecs.push_back(createEntropyCodec(stream.codec_type));
+        stream.tables.push_back(buildTable(*stream.codecs.back(), clusters.freqs[i], clusters.total_sizes[i]));
+    }
+    stream.single_table_codec = createEntropyCodec(stream.codec_type);
+    stream.single_table_size = buildTable(*stream.single_table_codec, stream.freqs, stream.total_size).size();
+    LOG(INFO) << "Clustered " << block_freqs.size() << " blocks of " << stream.name << " stream into " <<
+        clusters.freqs.size() << " entropy coding tables";
+    std::vector<Bytes>().swap(stream.block_data);
+}
+
+template <int KeySize, int ExtraDataSize>
+Bytes DwarfIdeaBuilder<KeySize, ExtraDataSize>::buildTable(
+    IEntropyCodec& codec, std::vector<unsigned> freqs, size_t total_size) const
+{
+    if (stats_sample_ratio_ < 1.0)
+    {
+        // The symbols not seen in the sample may still occur in other blocks, which otherwise
+        // would have to be stored without entropy coding.
+        for (unsigned& freq: freqs)
+        {
+            if (!freq)
+            {
+                freq = 1;
+                ++total_size;
+            }
+        }
+    }
+    return codec.buildTable(freqs, total_size);
+}
+
+template <int KeySize, int ExtraDataSize>
+void DwarfIdeaBuilder<KeySize, ExtraDataSize>::writeCodecHeader(std::ostream& os, const StreamInfo& stream)
+{
+    if (formatFlags() & kFormatFlagEntropyCodecs)
+    {
+        putValue(uint8_t(stream.codec_type), os);
+    }
+    if (formatFlags() & kFormatFlagEntropyTables)
+    {
+        putValue(uint8_t(stream.tables.size()), os);
+    }
+    else
+    {
+        CHECK_EQ(stream.tables.size(), 1) << "Multiple " << stream.name << " entropy coding tables are not enabled";
+    }
+    for (const Bytes& table: stream.tables)
+    {
+        putValue(uint32_t(table.size()), os);
+        os.write((const char*)table.data(), table.size());
+    }
 }
 
 template <int KeySize, int ExtraDataSize>
@@ -181,21 +557,21 @@ void DwarfIdeaBuilder<KeySize, ExtraDataSize>::encodePass(std::ostream& os, size
 {
     if (iteration > 0)
     {
-        writeFseHeader(os, keys_fse_info_);
-        writeFseHeader(os, coords_fse_info_);
+        writeCodecHeader(os, keys_stream_);
 
-        if (ExtraDataSize)
+        if (!packed_coords_)
         {
-            writeFseHeader(os, extra_data_fse_info_);
+            writeCodecHeader(os, coords_stream_);
+
+            if (ExtraDataSize)
+            {
+                writeCodecHeader(os, extra_data_stream_);
+            }
         }
 
-        index_offset_ = os.tellp();
-        for (size_t i = 0; i < index_.size(); ++i)
+        if (compression_report_)
         {
-            const Entry& entry = entries_[index_[i]];
-	    Bytes mapped_key = mapKey(entry.key);
-            os.write((const char*)mapped_key.data(), mapped_key.size());
-	    putValue(uint32_t(0), os);
+            compression_report_->buildTables();
         }
     }
 
@@ -206,24 +582,79 @@ void DwarfIdeaBuilder<KeySize, ExtraDataSize>::encodePass(std::ostream& os, size
     // However, all the alternatives I can think of seem to be pretty complex
     // and not worth the hassle.
     std::vector<Bytes> result(iteration > 0 ? index_.size() : 0);
+    std::vector<GridBox> block_boxes(iteration > 0 && spatial_index_ ? index_.size() : 0);
+    if (iteration > 0 && !block_stats_path_.empty())
+    {
+        block_stats_.reset(new BlockStats(index_.size(), ExtraDataSize > 0));
+    }
+    if (iteration == 0 && entropy_tables_ > 1)
+    {
+        // The tables of the previous build are reused as is.
+        auto gather_block_freqs = [this](StreamInfo& stream)
+        {
+            if (stream.tables.empty())
+            {
+                stream.block_data.resize(index_.size());
+            }
+        };
+        gather_block_freqs(keys_stream_);
+        if (!packed_coords_)
+        {
+            gather_block_freqs(coords_stream_);
+            if (ExtraDataSize)
+            {
+                gather_block_freqs(extra_data_stream_);
+            }
+        }
+    }
 
-#pragma omp parallel for schedule(static)
-    for (size_t i = 0; i < index_.size(); ++i)
     {
-        size_t num_cur_entries =
-	    ((i == index_.size() - 1) ? entries_.size() : index_[i + 1]) - index_[i];
-	if (num_cur_entries > 0)
-	{
-            BlockInfo block_info = computeBlockInfo(i, num_cur_entries);
-            flushBlock(iteration > 0 ? &result[i] : nullptr, iteration, block_info, i, num_cur_entries);
-	}
+        StatsReport::Phase phase(stats_report_, iteration > 0 ? "encode_pass_1" : "encode_pass_0");
+#pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < index_.size(); ++i)
+        {
+            size_t num_cur_entries =
+                ((i == index_.size() - 1) ? keys_.size() : index_[i + 1]) - index_[i];
+            if (num_cur_entries > 0 && (iteration > 0 || isStatsBlock(i)))
+            {
+                BlockInfo block_info = computeBlockInfo(i, num_cur_entries);
+                if (!block_boxes.empty())
+                {
+                    block_boxes[i] = GridBox{
+                        uint32_t(block_info.lat_min_index), uint32_t(block_info.lon_min_index),
+                        uint32_t(block_info.lat_max_index), uint32_t(block_info.lon_max_index)};
+                }
+                flushBlock(iteration > 0 ? &result[i] : nullptr, iteration, block_info, i, num_cur_entries);
+            }
+        }
     }
 
     if (iteration > 0)
     {
+        StatsReport::Phase phase(stats_report_, "write");
+        writeIndex(os, result);
+
+        if (eytzinger_index_)
+        {
+            writeEytzingerIndex(os);
+        }
+
+        if (membership_filter_)
+        {
+            writeMembershipFilter(os);
+        }
+
+        if (spatial_index_)
+        {
+            writeSpatialIndex(os, block_boxes);
+        }
+
         for (size_t i = 0; i < index_.size(); ++i)
         {
-            writeIndexPos(os, i);
+            if (!compressed_index_)
+            {
+                writeIndexPos(os, i);
+            }
             os.write((const char*)result[i].data(), result[i].size());
         }
     }
@@ -232,16 +663,19 @@ void DwarfIdeaBuilder<KeySize, ExtraDataSize>::encodePass(std::ostream& os, size
 template <int KeySize, int ExtraDataSize>
 BlockInfo DwarfIdeaBuilder<KeySize, ExtraDataSize>::computeBlockInfo(size_t index, size_t num_entries)
 {
-    size_t entry_index = index_[index];
+    const float* lats = &lats_[index_[index]];
+    const float* lons = &lons_[index_[index]];
     Point min_corner(kMaxLat, kMaxLon);
     Point max_corner(kMinLat, kMinLon);
     for (size_t i = 0; i < num_entries; ++i)
     {
-        const Point& pnt = entries_[entry_index + i].point;
-        min_corner.lat = std::min(min_corner.lat, pnt.lat);
-        min_corner.lon = std::min(min_corner.lon, pnt.lon);
-        max_corner.lat = std::max(max_corner.lat, pnt.lat);
-        max_corner.lon = std::max(max_corner.lon, pnt.lon);
+        min_corner.lat = std::min(min_corner.lat, lats[i]);
+        max_corner.lat = std::max(max_corner.lat, lats[i]);
+    }
+    for (size_t i = 0; i < num_entries; ++i)
+    {
+        min_corner.lon = std::min(min_corner.lon, lons[i]);
+        max_corner.lon = std::max(max_corner.lon, lons[i]);
     }
 
     BlockInfo block_info;
@@ -265,64 +699,174 @@ BlockInfo DwarfIdeaBuilder<KeySize, ExtraDataSize>::computeBlockInfo(size_t inde
 	block_info.lon_max_index * bounding_box_lon_step_ + kMinLon);
     block_info.max_lat_diff = block_info.max_corner.lat - block_info.min_corner.lat;
     block_info.max_lon_diff = block_info.max_corner.lon - block_info.min_corner.lon;
+
+    if (coords_quantization_ == CoordsQuantization::kConservative)
+    {
+        computeConservativeSteps(block_info, index, num_entries);
+    }
+    else
+    {
+        computeJointSteps(block_info, index, num_entries);
+    }
+
+    CHECK_LT(block_info.lat_bits, 32) << "Too many lat bits!";
+    CHECK_LT(block_info.lon_bits, 32) << "Too many lon bits!";
+
+    return block_info;
+}
+
+template <int KeySize, int ExtraDataSize>
+void DwarfIdeaBuilder<KeySize, ExtraDataSize>::computeConservativeSteps(
+    BlockInfo& block_info, size_t index, size_t num_entries)
+{
+    const float* lats = &lats_[index_[index]];
     block_info.lat_bits = (int8_t)std::ceil(
         std::log(std::ceil(block_info.max_lat_diff / dlat_)) / log(2.0));
     block_info.lon_bits = 1;
     for (size_t i = 0; i < num_entries; ++i)
     {
-        const Point& pnt = entries_[entry_index + i].point;
 	// The error in coords representation comes from the rounding which is controlled by the number of bits
 	// used to quantize the indices. Transforming the https://en.wikipedia.org/wiki/Haversine_formula we get
 	// the following equality: sin^2(dCA / 2) = sin^2(dLAT / 2) + cos^2(LAT) * sin^2(dLON / 2).
 	// Splitting the error between these two components equally, we get:
 	// dLAT = 2 * asin(sqrt(sin^2(dCA / 2) / 2)),
 	// dLON = 2 * asin(sqrt(sin^2(dCA / 2) / 2 / cos^2(LAT - dLAT))) where dCA is central angle.
-	double cos_lat = std::cos(M_PI * (pnt.lat - dlat_) / 180.0);
+	double cos_lat = std::cos(M_PI * (lats[i] - dlat_) / 180.0);
 	double dlon = dlon_coef_ * std::asin(std::sqrt(sin2_ca2_2_ / (cos_lat * cos_lat)));
 	block_info.lon_bits = std::max(
 	    block_info.lon_bits,
 	    (int8_t)std::ceil(std::log(std::ceil(block_info.max_lon_diff / dlon)) / log(2.0)));
     }
-
-    CHECK_LT(block_info.lat_bits, 32) << "Too many lat bits!";
-    CHECK_LT(block_info.lon_bits, 32) << "Too many lon bits!";
-
-    return block_info;
+    block_info.lat_steps = (1u << block_info.lat_bits) - 1;
+    block_info.lon_steps = (1u << block_info.lon_bits) - 1;
 }
 
 template <int KeySize, int ExtraDataSize>
-Bytes DwarfIdeaBuilder<KeySize, ExtraDataSize>::compressBytes(const Bytes& input, size_t index)
+void DwarfIdeaBuilder<KeySize, ExtraDataSize>::computeJointSteps(
+    BlockInfo& block_info, size_t index, size_t num_entries)
 {
-    // Step 1: BWTS
-    kanzi::BWTS bwts;
-    Bytes bwts_output(input.size(), 0);
-    auto bwts_sliced_input = kanzi::SliceArray<byte>((byte*)input.data(), input.size(), 0);
-    auto bwts_sliced_output = kanzi::SliceArray<byte>((byte*)bwts_output.data(), bwts_output.size(), 0);
-    CHECK(bwts.forward(bwts_sliced_input, bwts_sliced_output, input.size())) << "BWTS failed @ index " << index;
+    // With rounding to the nearest index the max error per coordinate is half of the step.
+    // From the haversine formula sin^2(dCA / 2) = sin^2(dLAT / 2) + cos(LAT0) * cos(LAT1) * sin^2(dLON / 2),
+    // where cos(LAT0) * cos(LAT1) is bounded by the max cos^2(LAT) over the block extents. Thus for any
+    // number of lat steps we can find the min number of lon steps that keeps dCA within the budget
+    // and then pick the combination that needs the least number of bits per entry.
+    const double lat_diff = block_info.max_lat_diff * M_PI / 180.0;
+    const double lon_diff = block_info.max_lon_diff * M_PI / 180.0;
+    const bool crosses_equator = block_info.min_corner.lat <= 0.0f && block_info.max_corner.lat >= 0.0f;
+    const double max_cos_lat = crosses_equator ? 1.0 : std::cos(M_PI / 180.0 * std::min(
+        std::abs(block_info.min_corner.lat), std::abs(block_info.max_corner.lat)));
+    const double max_cos2_lat = max_cos_lat * max_cos_lat;
 
-    // Step 2: SBRT
-    kanzi::SBRT sbrt(kanzi::SBRT::MODE_RANK);
-    Bytes sbrt_output(bwts_output.size(), 0);
-    auto sbrt_sliced_input = kanzi::SliceArray<byte>((byte*)bwts_output.data(), bwts_output.size(), 0);
-    auto sbrt_sliced_output = kanzi::SliceArray<byte>((byte*)sbrt_output.data(), sbrt_output.size(), 0);
-    CHECK(sbrt.forward(sbrt_sliced_input, sbrt_sliced_output, bwts_output.size())) << "SBRT failed @ index " << index;
-
-    // Step 3: ZRLT
-    kanzi::ZRLT zrlt;
-    Bytes zrlt_output(sbrt_output.size(), 0);
-    auto zrlt_sliced_input = kanzi::SliceArray<byte>((byte*)sbrt_output.data(), sbrt_output.size(), 0);
-    auto zrlt_sliced_output = kanzi::SliceArray<byte>((byte*)zrlt_output.data(), zrlt_output.size(), 0);
-    if (zrlt.forward(zrlt_sliced_input, zrlt_sliced_output, sbrt_output.size()))
+    // The estimate above doesn't account for float rounding of the reconstructed coordinates,
+    // so verify the actual error and retry with slightly smaller budget if it's exceeded.
+    for (double budget = max_dist_error_; ; budget *= kBudgetShrinkFactor)
     {
-        zrlt_output.resize(zrlt_sliced_output._index + 1);
-        zrlt_output.back() = 0;
-        return zrlt_output;
+        CHECK_GT(budget, 0.5 * max_dist_error_) << "Failed to quantize coords @ index " << index;
+        const double max_ca = budget / kEarthRadius;
+        const double sin_ca2 = std::sin(max_ca / 2.0);
+        const double sin2_ca2 = sin_ca2 * sin_ca2;
+
+        // Returns the min number of lon steps given the number of lat steps or 0 if the lat error
+        // alone already exceeds the budget.
+        auto lon_steps_for = [&](double lat_steps) -> double
+        {
+            double sin_dlat2 = std::sin(lat_diff / (2.0 * lat_steps) / 2.0);
+            double lon_budget = (sin2_ca2 - sin_dlat2 * sin_dlat2) / max_cos2_lat;
+            if (lon_budget <= 0.0)
+            {
+                return 0.0;
+            }
+            return minCoordsSteps(lon_diff, 2.0 * std::asin(std::sqrt(std::min(1.0, lon_budget))));
+        };
+
+        if (coords_quantization_ == CoordsQuantization::kJoint)
+        {
+            int best_bits = 64;
+            for (int8_t lat_bits = 1; lat_bits < 32; ++lat_bits)
+            {
+                double lon_steps = lon_steps_for((1u << lat_bits) - 1);
+                if (lon_steps == 0.0 || lon_steps > kMaxCoordsSteps)
+                {
+                    continue;
+                }
+                int8_t lon_bits = bitsFor(uint64_t(lon_steps));
+                if (lat_bits + lon_bits < best_bits)
+                {
+                    best_bits = lat_bits + lon_bits;
+                    block_info.lat_bits = lat_bits;
+                    block_info.lon_bits = lon_bits;
+                }
+            }
+            CHECK_LT(best_bits, 64) << "Failed to allocate coords bits @ index " << index;
+            block_info.lat_steps = (1u << block_info.lat_bits) - 1;
+            block_info.lon_steps = (1u << block_info.lon_bits) - 1;
+        }
+        else
+        {
+            // The total number of combinations (lat_steps + 1) * (lon_steps + 1) is minimized
+            // somewhere between spending the whole budget on lat and on lon, walk this range
+            // with geometrically increasing lat steps.
+            const double min_lon_steps = lon_steps_for(std::numeric_limits<double>::infinity());
+            double best_combinations = std::numeric_limits<double>::infinity();
+            for (double lat_steps = minCoordsSteps(lat_diff, max_ca); lat_steps <= kMaxCoordsSteps;
+                 lat_steps = std::max(lat_steps + 1.0, std::floor(lat_steps * kLatStepsSearchFactor)))
+            {
+                double lon_steps = lon_steps_for(lat_steps);
+                if (lon_steps == 0.0 || lon_steps > kMaxCoordsSteps)
+                {
+                    continue;
+                }
+                double combinations = (lat_steps + 1.0) * (lon_steps + 1.0);
+                if (combinations < best_combinations)
+                {
+                    best_combinations = combinations;
+                    block_info.lat_steps = uint32_t(lat_steps);
+                    block_info.lon_steps = uint32_t(lon_steps);
+                }
+                if (lon_steps <= min_lon_steps)
+                {
+                    break;
+                }
+            }
+            CHECK(std::isfinite(best_combinations)) << "Failed to allocate coords steps @ index " << index;
+            block_info.lat_bits = bitsFor(block_info.lat_steps);
+            block_info.lon_bits = bitsFor(block_info.lon_steps);
+        }
+
+        if (getMaxCoordsError(block_info, index, num_entries) <= max_dist_error_)
+        {
+            break;
+        }
     }
-    else
+}
+
+template <int KeySize, int ExtraDataSize>
+double DwarfIdeaBuilder<KeySize, ExtraDataSize>::getMaxCoordsError(
+    const BlockInfo& block_info, size_t index, size_t num_entries)
+{
+    double max_error = 0.0;
+    size_t entry_index = index_[index];
+    for (size_t i = 0; i < num_entries; ++i)
     {
-        sbrt_output.push_back(1);
-        return sbrt_output;
+        const Point pnt = getPoint(entry_index + i);
+        Point rec_pnt(
+            dequantizeCoord(
+                quantizeCoord(pnt.lat, block_info.min_corner.lat, block_info.max_lat_diff, block_info.lat_steps),
+                block_info.min_corner.lat, block_info.max_lat_diff, block_info.lat_steps),
+            dequantizeCoord(
+                quantizeCoord(pnt.lon, block_info.min_corner.lon, block_info.max_lon_diff, block_info.lon_steps),
+                block_info.min_corner.lon, block_info.max_lon_diff, block_info.lon_steps));
+        max_error = std::max(max_error, getDist(pnt, rec_pnt));
     }
+    return max_error;
+}
+
+template <int KeySize, int ExtraDataSize>
+Bytes DwarfIdeaBuilder<KeySize, ExtraDataSize>::compressBytes(const Bytes& input)
+{
+    TraceRecorder::Scope scope(trace_, "transform", "encode");
+    scope.addArg("bytes", input.size());
+    return forwardTransform(transform_chain_, input);
 }
 
 template <int KeySize, int ExtraDataSize>
@@ -336,16 +880,28 @@ void DwarfIdeaBuilder<KeySize, ExtraDataSize>::updateFreqs(const Bytes& data, st
 }
 
 template <int KeySize, int ExtraDataSize>
-Bytes DwarfIdeaBuilder<KeySize, ExtraDataSize>::entropyCompress(const Bytes& data, FSE_CTable* ctable)
+Bytes DwarfIdeaBuilder<KeySize, ExtraDataSize>::entropyCompress(
+    const Bytes& data, StreamInfo& stream, BlockStreamStats* stats)
 {
-    Bytes output(FSE_compressBound(data.size() - 1), 0);
-    size_t dst_size = FSE_compress_usingCTable(
-        (void*)output.data(), output.size(), data.data(), data.size() - 1, ctable);
+    TraceRecorder::Scope scope(trace_, "entropy_coding", "encode");
+    scope.addArg("bytes", data.size());
+    Bytes output;
+    for (size_t i = 0; i < stream.codecs.size(); ++i)
+    {
+        Bytes table_output = stream.codecs[i]->compress(data.data(), data.size() - 1);
+        if (!table_output.empty() && (output.empty() || table_output.size() + 1 < output.size()))
+        {
+            // The table index is only stored if there's a choice.
+            output.assign(stream.codecs.size() > 1 ? 1 : 0, uint8_t(i));
+            appendBytes(table_output, output);
+        }
+    }
+    const size_t dst_size = output.size();
     uint8_t flags = data.back();
     bool ignore_fse = false;
-    if (!dst_size || FSE_isError(dst_size))
+    if (!dst_size)
     {
-        LOG(ERROR) << "FSE compression failed with code " << dst_size << ", ignoring";
+        VLOG(1) << "Entropy coding failed, ignoring";
 	ignore_fse = true;
     }
     else
@@ -357,74 +913,303 @@ Bytes DwarfIdeaBuilder<KeySize, ExtraDataSize>::entropyCompress(const Bytes& dat
     {
         output = data;
         output.pop_back();
-        dst_size = output.size();
-        flags |= 0x02;
+        flags |= kStreamFlagNoEntropyCoding;
+    }
+
+    output = frameStream(output, flags);
+    if (stream.single_table_codec)
+    {
+        const size_t single_table_size = getFramedSize(data, *stream.single_table_codec, 0);
+#pragma omp atomic
+        stream.single_table_compressed_size += single_table_size;
+#pragma omp atomic
+        stream.compressed_size += output.size();
+    }
+    if (stats)
+    {
+        // The last byte of the transformed data holds the stream flags.
+        stats->transformed_size = data.size() - 1;
+        stats->compressed_size = output.size();
+        stats->entropy_skipped = ignore_fse;
+    }
+    return output;
+}
+
+template <int KeySize, int ExtraDataSize>
+size_t DwarfIdeaBuilder<KeySize, ExtraDataSize>::getCompressedSize(const Bytes& data, const StreamInfo& stream) const
+{
+    const size_t table_index_size = stream.codecs.size() > 1 ? 1 : 0;
+    size_t size = std::numeric_limits<size_t>::max();
+    for (const std::unique_ptr<IEntropyCodec>& codec: stream.codecs)
+    {
+        size = std::min(size, getFramedSize(data, *codec, table_index_size));
+    }
+    return size;
+}
+
+template <int KeySize, int ExtraDataSize>
+void DwarfIdeaBuilder<KeySize, ExtraDataSize>::logTablesGain(const StreamInfo& stream) const
+{
+    // Both include the tables as stored in the header.
+    size_t tables_size = sizeof(uint8_t);
+    for (const Bytes& table: stream.tables)
+    {
+        tables_size += sizeof(uint32_t) + table.size();
+    }
+    const double size = stream.compressed_size + tables_size;
+    const double single_table_size =
+        stream.single_table_compressed_size + sizeof(uint32_t) + stream.single_table_size;
+    LOG(INFO) << "Entropy coding tables of " << stream.name << " stream: " << stream.tables.size() << " tables, " <<
+        size / keys_.size() << " bytes per entry vs " << single_table_size / keys_.size() <<
+        " with the single table, gain = " << 100.0 * (1.0 - size / single_table_size) << "%";
+}
+
+template <int KeySize, int ExtraDataSize>
+void DwarfIdeaBuilder<KeySize, ExtraDataSize>::writeCount(std::ostream& os, uint64_t value, const char* name) const
+{
+    if (wide_offsets_)
+    {
+        putValue(value, os);
     }
     else
     {
-        output.resize(dst_size);
+        CHECK_LE(value, std::numeric_limits<uint32_t>::max()) << "Too large " << name <<
+            " for 32 bits, use wide offsets";
+        putValue(uint32_t(value), os);
     }
+}
 
-    dst_size <<= 2;
-    dst_size |= flags;
+template <int KeySize, int ExtraDataSize>
+void DwarfIdeaBuilder<KeySize, ExtraDataSize>::writeIndex(std::ostream& os, const std::vector<Bytes>& blocks)
+{
+    if (compressed_index_)
+    {
+        // All blocks are already encoded, so their offsets relative to the first one are known.
+        std::vector<uint64_t> keys(index_.size()), offsets(index_.size());
+        uint64_t offset = 0;
+        for (size_t i = 0; i < index_.size(); ++i)
+        {
+            keys[i] = mapped_keys_[index_[i]];
+            offsets[i] = offset;
+            offset += blocks[i].size();
+        }
+        Bytes index = buildCompressedBlockIndex(keys, offsets, kDefaultCompressedBlockIndexGroupSize);
+        os.write((const char*)index.data(), index.size());
+        LOG(INFO) << "Compressed index: " << index.size() << " bytes, " <<
+            double(index.size()) / index_.size() << " bytes per block";
+        return;
+    }
 
-    Bytes enc_dst_size_bytes = asVarInt(dst_size);
-    output.insert(output.begin(), enc_dst_size_bytes.begin(), enc_dst_size_bytes.end());
-    return output;
+    // The offsets are written once the blocks are, see 'writeIndexPos'.
+    index_offset_ = os.tellp();
+    for (size_t i = 0; i < index_.size(); ++i)
+    {
+        Bytes mapped_key = mappedKeyBytes(mapped_keys_[index_[i]]);
+        os.write((const char*)mapped_key.data(), mapped_key.size());
+        writeCount(os, 0, "block offset");
+    }
 }
 
 template <int KeySize, int ExtraDataSize>
 void DwarfIdeaBuilder<KeySize, ExtraDataSize>::writeIndexPos(std::ostream& os, size_t index)
 {
-    long cur_pos = os.tellp();
-    os.seekp(index_offset_ + index * (mappedKeySize() + sizeof(uint32)) + mappedKeySize());
-    putValue(uint32_t(cur_pos), os);
+    const long cur_pos = os.tellp();
+    const size_t offset_size = wide_offsets_ ? sizeof(uint64_t) : sizeof(uint32_t);
+    os.seekp(index_offset_ + index * (mappedKeySize() + offset_size) + mappedKeySize());
+    writeCount(os, cur_pos, "block offset");
     os.seekp(cur_pos);
 }
 
+template <int KeySize, int ExtraDataSize>
+void DwarfIdeaBuilder<KeySize, ExtraDataSize>::writeEytzingerIndex(std::ostream& os)
+{
+    const long padding = (kEytzingerIndexAlignment - os.tellp() % kEytzingerIndexAlignment) % kEytzingerIndexAlignment;
+    for (long i = 0; i < padding; ++i)
+    {
+        putValue(uint8_t(0), os);
+    }
+    std::vector<uint64_t> keys(index_.size());
+    for (size_t i = 0; i < index_.size(); ++i)
+    {
+        keys[i] = mapped_keys_[index_[i]];
+    }
+    Bytes index = buildEytzingerIndex(keys);
+    os.write((const char*)index.data(), index.size());
+}
+
+template <int KeySize, int ExtraDataSize>
+void DwarfIdeaBuilder<KeySize, ExtraDataSize>::writeMembershipFilter(std::ostream& os)
+{
+    const std::vector<uint64_t>& keys = mapped_keys_;
+    MembershipFilter filter;
+    CHECK(filter.build(keys)) << "Failed to build membership filter";
+
+    // Measure the actual false positive rate on the keys that are absent from the DB.
+    std::mt19937_64 rng(keys.size());
+    std::uniform_int_distribution<uint64_t> key_dist(keys.front(), keys.back());
+    size_t num_absent = 0, num_false_positives = 0;
+    for (size_t i = 0; i < kFilterCheckKeys; ++i)
+    {
+        const uint64_t key = key_dist(rng);
+        if (!std::binary_search(keys.begin(), keys.end(), key))
+        {
+            ++num_absent;
+            num_false_positives += filter.mayContain(key);
+        }
+    }
+
+    Bytes serialized = filter.serialize();
+    putValue(uint32_t(serialized.size()), os);
+    os.write((const char*)serialized.data(), serialized.size());
+    LOG(INFO) << "Membership filter: " << serialized.size() << " bytes (" <<
+        8.0 * serialized.size() / keys.size() << " bits per key), false positive rate = " <<
+        100.0 * num_false_positives / std::max<size_t>(num_absent, 1) << "%";
+}
+
+template <int KeySize, int ExtraDataSize>
+void DwarfIdeaBuilder<KeySize, ExtraDataSize>::writeSpatialIndex(
+    std::ostream& os, const std::vector<GridBox>& block_boxes)
+{
+    Bytes index = buildSpatialBlockIndex(block_boxes, bounding_box_bits_, kDefaultSpatialBlockIndexNodeSize);
+    putValue(uint32_t(index.size()), os);
+    os.write((const char*)index.data(), index.size());
+    LOG(INFO) << "Spatial index: " << index.size() << " bytes, " <<
+        double(index.size()) / block_boxes.size() << " bytes per block";
+}
+
 template <int KeySize, int ExtraDataSize>
 void DwarfIdeaBuilder<KeySize, ExtraDataSize>::flushBlock(
     Bytes* output, size_t iteration, const BlockInfo& block_info,
     size_t index, size_t num_entries)
 {
-    Bytes encoded_keys = encodeKeys(index, num_entries);
-    Bytes encoded_coords = encodeCoords(block_info, index, num_entries);
-    Bytes encoded_extra_data =
-        ExtraDataSize ? encodeExtraData(index, num_entries) : Bytes();
+    TraceRecorder::Scope scope(trace_, iteration > 0 ? "encode_block" : "stats_block", "encode");
+    scope.addArg("block", index);
+    scope.addArg("entries", num_entries);
+
+    Bytes encoded_keys, encoded_coords, encoded_extra_data;
+    {
+        TraceRecorder::Scope encode_scope(trace_, "encode_entries", "encode");
+        encoded_keys = encodeKeys(index, num_entries, iteration);
+        encoded_coords = encodeCoords(block_info, index, num_entries);
+        if (ExtraDataSize)
+        {
+            encoded_extra_data = encodeExtraData(index, num_entries);
+        }
+    }
+    if (compression_report_)
+    {
+        if (iteration == 0)
+        {
+            compression_report_->addStatsBlock(keys_stream_.report_index, encoded_keys);
+            compression_report_->addStatsBlock(coords_stream_.report_index, encoded_coords);
+            if (ExtraDataSize)
+            {
+                compression_report_->addStatsBlock(extra_data_stream_.report_index, encoded_extra_data);
+            }
+        }
+        else
+        {
+            compression_report_->addBlock(keys_stream_.report_index, encoded_keys);
+            compression_report_->addBlock(coords_stream_.report_index, encoded_coords);
+            if (ExtraDataSize)
+            {
+                compression_report_->addBlock(extra_data_stream_.report_index, encoded_extra_data);
+            }
+        }
+    }
+
     if (iteration == 0)
     {
-        Bytes compressed_keys = compressBytes(encoded_keys, index);
-        updateFreqs(compressed_keys, keys_fse_info_.freqs);
+        auto update_block_data = [index](const Bytes& data, StreamInfo& stream)
+        {
+            if (!stream.block_data.empty())
+            {
+                stream.block_data[index] = data;
+            }
+        };
+
+        Bytes compressed_keys = compressBytes(encoded_keys);
+        updateFreqs(compressed_keys, keys_stream_.freqs);
+        update_block_data(compressed_keys, keys_stream_);
 #pragma omp atomic
-        keys_fse_info_.total_size += compressed_keys.size();
+        keys_stream_.total_size += compressed_keys.size();
 
-        Bytes compressed_coords = compressBytes(encoded_coords, index);
-        updateFreqs(compressed_coords, coords_fse_info_.freqs);
+        if (!packed_coords_)
+        {
+            Bytes compressed_coords = compressBytes(encoded_coords);
+            updateFreqs(compressed_coords, coords_stream_.freqs);
+            update_block_data(compressed_coords, coords_stream_);
 #pragma omp atomic
-        coords_fse_info_.total_size += compressed_coords.size();
+            coords_stream_.total_size += compressed_coords.size();
+        }
 
-        if (ExtraDataSize)
+        if (ExtraDataSize && !packed_coords_)
         {
-            Bytes compressed_extra_data = compressBytes(encoded_extra_data, index);
-            updateFreqs(compressed_extra_data, extra_data_fse_info_.freqs);
+            Bytes compressed_extra_data = compressBytes(encoded_extra_data);
+            updateFreqs(compressed_extra_data, extra_data_stream_.freqs);
+            update_block_data(compressed_extra_data, extra_data_stream_);
 #pragma omp atomic
-            extra_data_fse_info_.total_size += compressed_extra_data.size();
+            extra_data_stream_.total_size += compressed_extra_data.size();
         }
     }
     else
     {
+        if (check_coords_error_)
+        {
+            TraceRecorder::Scope check_scope(trace_, "check_coords", "encode");
+            checkCoords(encoded_coords, index, num_entries);
+        }
+
 	Bytes compressed_keys, compressed_coords, compressed_extra_data;
+        BlockStatsRecord stats;
+        const bool has_stats = bool(block_stats_);
 
-        compressed_keys = compressBytes(encoded_keys, index);
-        compressed_keys = entropyCompress(compressed_keys, keys_fse_info_.ctable.get());
+        compressed_keys = compressBytes(encoded_keys);
+        compressed_keys = entropyCompress(
+            compressed_keys, keys_stream_, has_stats ? &stats.streams[kBlockStreamKeys] : nullptr);
 
-        compressed_coords = compressBytes(encoded_coords, index);
-        compressed_coords = entropyCompress(compressed_coords, coords_fse_info_.ctable.get());
+        if (packed_coords_)
+        {
+            const uint8_t flags = kStreamFlagNoZrlt | kStreamFlagNoEntropyCoding;
+            compressed_coords = frameStream(encoded_coords, flags);
+            stats.streams[kBlockStreamCoords].transformed_size = encoded_coords.size();
+            stats.streams[kBlockStreamCoords].compressed_size = compressed_coords.size();
+            if (ExtraDataSize)
+            {
+                compressed_extra_data = frameStream(encoded_extra_data, flags);
+                stats.streams[kBlockStreamExtraData].transformed_size = encoded_extra_data.size();
+                stats.streams[kBlockStreamExtraData].compressed_size = compressed_extra_data.size();
+            }
+        }
+        else
+        {
+            compressed_coords = compressBytes(encoded_coords);
+            compressed_coords = entropyCompress(
+                compressed_coords, coords_stream_, has_stats ? &stats.streams[kBlockStreamCoords] : nullptr);
 
-        if (ExtraDataSize)
+            if (ExtraDataSize)
+            {
+                compressed_extra_data = compressBytes(encoded_extra_data);
+                compressed_extra_data = entropyCompress(
+                    compressed_extra_data, extra_data_stream_,
+                    has_stats ? &stats.streams[kBlockStreamExtraData] : nullptr);
+            }
+        }
+
+        if (has_stats)
         {
-            compressed_extra_data = compressBytes(encoded_extra_data, index);
-            compressed_extra_data = entropyCompress(compressed_extra_data, extra_data_fse_info_.ctable.get());
+            stats.first_key = mapped_keys_[index_[index]];
+            stats.num_entries = num_entries;
+            stats.lat_bits = block_info.lat_bits;
+            stats.lon_bits = block_info.lon_bits;
+            stats.lat_steps = block_info.lat_steps;
+            stats.lon_steps = block_info.lon_steps;
+            stats.min_corner = block_info.min_corner;
+            stats.max_corner = block_info.max_corner;
+            stats.streams[kBlockStreamKeys].raw_size = encoded_keys.size();
+            stats.streams[kBlockStreamCoords].raw_size = encoded_coords.size();
+            stats.streams[kBlockStreamExtraData].raw_size = encoded_extra_data.size();
+            block_stats_->setBlock(index, stats);
         }
 
         output->reserve(compressed_keys.size() + compressed_coords.size() + compressed_extra_data.size());
@@ -439,27 +1224,119 @@ void DwarfIdeaBuilder<KeySize, ExtraDataSize>::flushBlock(
 }
 
 template <int KeySize, int ExtraDataSize>
-Bytes DwarfIdeaBuilder<KeySize, ExtraDataSize>::encodeKeys(size_t index, size_t num_entries)
+Bytes DwarfIdeaBuilder<KeySize, ExtraDataSize>::encodeKeys(size_t index, size_t num_entries, size_t iteration)
+{
+    const uint64_t* keys = &mapped_keys_[index_[index]];
+    if (formatFlags() & kFormatFlagSplitKeys)
+    {
+        // Whether the split helps depends on the structure of the keys of the particular block,
+        // e.g. on the radio type for cells, so try all of them. The first pass has no tables
+        // yet, so it estimates the coded size, which ignores the transforms, but picks the
+        // smaller option more often than the same estimate of the transformed keys. The second
+        // pass compares the actual compressed sizes, so the split is only used where it helps.
+        auto getSize = [this, iteration](const Bytes& encoded_keys)
+        {
+            return iteration > 0 ?
+                double(getCompressedSize(compressBytes(encoded_keys), keys_stream_)) :
+                estimateCodedBits(encoded_keys);
+        };
+        Bytes best_keys = encodeSplitKeys(keys, num_entries, 0);
+        double best_size = getSize(best_keys);
+        for (int shift: keySplitShifts())
+        {
+            Bytes split_keys = encodeSplitKeys(keys, num_entries, shift);
+            const double size = getSize(split_keys);
+            if (size < best_size)
+            {
+                best_keys.swap(split_keys);
+                best_size = size;
+            }
+        }
+        return best_keys;
+    }
+    return encodeKeyDeltas(keys, num_entries);
+}
+
+template <int KeySize, int ExtraDataSize>
+Bytes DwarfIdeaBuilder<KeySize, ExtraDataSize>::encodeKeyDeltas(const uint64_t* keys, size_t num_entries) const
 {
-    Bytes encoded_keys;
-    size_t entry_index = index_[index];
-    uint64_t prev_key = asInt<uint64_t>(mapKey(entries_[entry_index].key), true);
     // Skip the first key, it's written in the index anyway.
+    std::vector<uint64_t> key_diffs(num_entries - 1);
     for (size_t i = 1; i < num_entries; ++i)
     {
-        uint64_t cur_key = asInt<uint64_t>(mapKey(entries_[entry_index + i].key), true);
-        Bytes varint_key_diff = asVarInt(cur_key - prev_key);
-        encoded_keys.insert(encoded_keys.end(), varint_key_diff.begin(), varint_key_diff.end());
-        prev_key = cur_key;
+        key_diffs[i - 1] = keys[i] - keys[i - 1];
+    }
+    Bytes encoded_keys;
+    encoded_keys.reserve(key_diffs.size());
+    for (uint64_t key_diff: key_diffs)
+    {
+        appendVarInt(key_diff, encoded_keys);
     }
     return encoded_keys;
 }
 
 template <int KeySize, int ExtraDataSize>
-Bytes DwarfIdeaBuilder<KeySize, ExtraDataSize>::mapKey(const Key& key) const
+Bytes DwarfIdeaBuilder<KeySize, ExtraDataSize>::encodeSplitKeys(
+    const uint64_t* keys, size_t num_entries, int shift) const
+{
+    Bytes codes(1, uint8_t(shift));
+    if (!shift)
+    {
+        for (size_t i = 1; i < num_entries; ++i)
+        {
+            appendVarInt(keys[i] - keys[i - 1], codes);
+        }
+        return codes;
+    }
+
+    // If the high parts are the same, e.g. for the sectors of the same LTE site, the code is
+    // (low part delta - 1) << 1. Otherwise it's (high part delta - 1) << 1 | 1 and the low
+    // part is stored as is in the second section, as the low parts of different sites are
+    // unrelated. Without the split the deltas between the sites would depend on both.
+    appendVarInt(num_entries - 1, codes);
+    Bytes low_parts;
+    const uint64_t low_mask = (uint64_t(1) << shift) - 1;
+    for (size_t i = 1; i < num_entries; ++i)
+    {
+        const uint64_t high_delta = (keys[i] >> shift) - (keys[i - 1] >> shift);
+        const uint64_t low = keys[i] & low_mask;
+        if (high_delta)
+        {
+            appendVarInt(((high_delta - 1) << 1) | 1, codes);
+            appendVarInt(low, low_parts);
+        }
+        else
+        {
+            appendVarInt((low - (keys[i - 1] & low_mask) - 1) << 1, codes);
+        }
+    }
+    appendBytes(low_parts, codes);
+    return codes;
+}
+
+template <int KeySize, int ExtraDataSize>
+std::vector<int> DwarfIdeaBuilder<KeySize, ExtraDataSize>::keySplitShifts() const
+{
+    return std::vector<int>();
+}
+
+template <int KeySize, int ExtraDataSize>
+uint32_t DwarfIdeaBuilder<KeySize, ExtraDataSize>::keyFormatFlags() const
+{
+    return 0;
+}
+
+template <int KeySize, int ExtraDataSize>
+uint64_t DwarfIdeaBuilder<KeySize, ExtraDataSize>::mapKey(const Key& key) const
 {
     // Default implementation just uses identity mapping.
-    return Bytes(key.begin(), key.end());
+    CHECK_LE(KeySize, sizeof(uint64_t)) << "Key does not fit mapped key, mapping should be overridden";
+    uint64_t mapped_key = 0;
+    for (uint8_t c: key)
+    {
+        mapped_key = (mapped_key << 8) | c;
+    }
+    return mapped_key;
 }
 
 template <int KeySize, int ExtraDataSize>
@@ -480,33 +1357,50 @@ Bytes DwarfIdeaBuilder<KeySize, ExtraDataSize>::encodeCoords(
     bs.writeBits(block_info.lon_min_index, bounding_box_bits_);
     bs.writeBits(block_info.lat_max_index, bounding_box_bits_);
     bs.writeBits(block_info.lon_max_index, bounding_box_bits_);
-    bs.writeBits(block_info.lat_bits, 5);
-    bs.writeBits(block_info.lon_bits, 5);
-
-    uint32_t lat_mask = (1 << (block_info.lat_bits)) - 1;
-    uint32_t lon_mask = (1 << (block_info.lon_bits)) - 1;
+    bs.writeBits(block_info.lat_bits, kCoordsBitsBits);
+    bs.writeBits(block_info.lon_bits, kCoordsBitsBits);
 
     size_t entry_index = index_[index];
-    for (size_t i = 0; i < num_entries; ++i)
+    if (coords_quantization_ != CoordsQuantization::kExact)
     {
-        double lat_ratio = clamp(
-	    (entries_[entry_index + i].point.lat - block_info.min_corner.lat) /
-	    block_info.max_lat_diff);
-        double lon_ratio = clamp(
-	    (entries_[entry_index + i].point.lon - block_info.min_corner.lon) /
-	    block_info.max_lon_diff);
-        uint32_t lat_idx = std::min(
-	    (uint32_t)std::round(lat_ratio * lat_mask), lat_mask);
-        uint32_t lon_idx = std::min(
-	    (uint32_t)std::round(lon_ratio * lon_mask), lon_mask);
-        uint64_t combined = ((uint64_t)lon_idx << block_info.lat_bits) | lat_idx;
-	float rec_lat = block_info.min_corner.lat +
-	    block_info.max_lat_diff * lat_idx / ((1 << block_info.lat_bits) - 1);
-	float rec_lon = block_info.min_corner.lon +
-	    block_info.max_lon_diff * lon_idx / ((1 << block_info.lon_bits) - 1);
-	double rec_dist = getDist(
-	    entries_[entry_index + i].point, Point(rec_lat, rec_lon));
-	bs.writeBits(combined, block_info.lat_bits + block_info.lon_bits);
+        for (size_t i = 0; i < num_entries; ++i)
+        {
+            const Point pnt = getPoint(entry_index + i);
+            uint32_t lat_idx = quantizeCoord(
+                pnt.lat, block_info.min_corner.lat, block_info.max_lat_diff, block_info.lat_steps);
+            uint32_t lon_idx = quantizeCoord(
+                pnt.lon, block_info.min_corner.lon, block_info.max_lon_diff, block_info.lon_steps);
+            uint64_t combined = ((uint64_t)lon_idx << block_info.lat_bits) | lat_idx;
+	    bs.writeBits(combined, block_info.lat_bits + block_info.lon_bits);
+        }
+    }
+    else
+    {
+        // For arbitrary number of steps, store the number of steps and then pack lat / lon indices
+        // of every entry into the single number lon_idx * (lat_steps + 1) + lat_idx. Rounding the
+        // number of bits up for every entry would waste up to 1 bit per entry, so the entries are
+        // additionally packed into groups as mixed-radix numbers, with the first entry of the
+        // group being the least significant "digit".
+        bs.writeBits(block_info.lat_steps, block_info.lat_bits);
+        bs.writeBits(block_info.lon_steps, block_info.lon_bits);
+        const uint64_t lat_combinations = uint64_t(block_info.lat_steps) + 1;
+        const uint64_t combinations = lat_combinations * (uint64_t(block_info.lon_steps) + 1);
+        const size_t group_size = coordsGroupSize(combinations);
+        for (size_t i = 0; i < num_entries; i += group_size)
+        {
+            uint64_t group = 0, group_combinations = 1;
+            for (size_t j = std::min(num_entries, i + group_size); j-- > i; )
+            {
+                const Point pnt = getPoint(entry_index + j);
+                uint32_t lat_idx = quantizeCoord(
+                    pnt.lat, block_info.min_corner.lat, block_info.max_lat_diff, block_info.lat_steps);
+                uint32_t lon_idx = quantizeCoord(
+                    pnt.lon, block_info.min_corner.lon, block_info.max_lon_diff, block_info.lon_steps);
+                group = group * combinations + lon_idx * lat_combinations + lat_idx;
+                group_combinations *= combinations;
+            }
+	    bs.writeBits(group, bitsFor(group_combinations - 1));
+        }
     }
     bs.close();
     const std::string& buffer = ss.str();
@@ -515,35 +1409,67 @@ Bytes DwarfIdeaBuilder<KeySize, ExtraDataSize>::encodeCoords(
 }
 
 template <int KeySize, int ExtraDataSize>
-Bytes DwarfIdeaBuilder<KeySize, ExtraDataSize>::encodeExtraData(size_t index, size_t num_entries)
+void DwarfIdeaBuilder<KeySize, ExtraDataSize>::checkCoords(
+    const Bytes& encoded_coords, size_t index, size_t num_entries)
 {
-    Bytes encoded_data;
+    // Decode the coordinates the same way the readers do it, independently from 'BlockInfo'.
+    CoordsReader coords_reader(bounding_box_bits_, coords_quantization_ == CoordsQuantization::kExact);
+    CHECK(coords_reader.reset(encoded_coords.data(), encoded_coords.size(), num_entries)) <<
+        "Failed to decode coords @ index " << index;
+
+    double max_error = 0.0, sum_error = 0.0;
     size_t entry_index = index_[index];
     for (size_t i = 0; i < num_entries; ++i)
     {
-        encoded_data.insert(
-	    encoded_data.end(),
-	    entries_[entry_index + i].extra_data.begin(),
-	    entries_[entry_index + i].extra_data.end());
+        double error = getDist(getPoint(entry_index + i), coords_reader.getPoint(i));
+        max_error = std::max(max_error, error);
+        sum_error += error;
+    }
+
+    CHECK_LE(max_error, max_dist_error_) << "Coords error is exceeded @ index " << index;
+
+#pragma omp critical
+    {
+        max_coords_error_ = std::max(max_coords_error_, max_error);
+        sum_coords_error_ += sum_error;
     }
-    return encoded_data;
+}
+
+template <int KeySize, int ExtraDataSize>
+Bytes DwarfIdeaBuilder<KeySize, ExtraDataSize>::encodeExtraData(size_t index, size_t num_entries)
+{
+    auto begin = extra_data_.begin() + index_[index] * ExtraDataSize;
+    return Bytes(begin, begin + num_entries * ExtraDataSize);
 }
 
 template <int KeySize, int ExtraDataSize>
 void DwarfIdeaBuilder<KeySize, ExtraDataSize>::writeHeader(std::ostream& os) const
 {
     os.write(kFileSignature, strlen(kFileSignature));
-    putValue(uint16_t(kFileFormatVersion), os);
+    const uint32_t format_flags = formatFlags();
+    if (format_flags)
+    {
+        putValue(uint16_t(kExtendedFileFormatVersion), os);
+        putValue(format_flags, os);
+        if (format_flags & kFormatFlagTransformChain)
+        {
+            putValue(uint8_t(transform_chain_), os);
+        }
+    }
+    else
+    {
+        putValue(uint16_t(kFileFormatVersion), os);
+    }
     putValue(uint16_t(KeySize), os);
     putValue(uint16_t(ExtraDataSize), os);
-    putValue(uint32_t(entries_.size()), os);
-    putValue(uint32_t(index_.size()), os);
+    writeCount(os, keys_.size(), "number of entries");
+    writeCount(os, index_.size(), "number of blocks");
     putValue(uint16_t(min_entries_per_block_), os);
     putValue(uint16_t(max_entries_per_block_), os);
     putValue(uint16_t(bounding_box_bits_), os);
     os.write((const char*)&max_dist_error_, sizeof(max_dist_error_));
     writeHeaderExtra(os);
-    Bytes mapped_key = mapKey(entries_.back().key);
+    Bytes mapped_key = mappedKeyBytes(mapped_keys_.back());
     os.write((const char*)mapped_key.data(), mapped_key.size());
 }
 
@@ -554,18 +1480,214 @@ void DwarfIdeaBuilder<KeySize, ExtraDataSize>::writeHeaderExtra(std::ostream& os
     putValue(uint16_t(0), os);
 }
 
+template <int KeySize, int ExtraDataSize>
+uint32_t DwarfIdeaBuilder<KeySize, ExtraDataSize>::formatFlags() const
+{
+    uint32_t flags = keyFormatFlags();
+    if (coords_quantization_ == CoordsQuantization::kExact)
+    {
+        flags |= kFormatFlagCoordsSteps;
+    }
+    if (keys_stream_.codec_type != EntropyCodecType::kFse ||
+        coords_stream_.codec_type != EntropyCodecType::kFse ||
+        (ExtraDataSize && extra_data_stream_.codec_type != EntropyCodecType::kFse))
+    {
+        flags |= kFormatFlagEntropyCodecs;
+    }
+    if (transform_chain_ != TransformChain::kBwts)
+    {
+        flags |= kFormatFlagTransformChain;
+    }
+    if (packed_coords_)
+    {
+        flags |= kFormatFlagPackedCoords;
+    }
+    if (eytzinger_index_)
+    {
+        flags |= kFormatFlagEytzingerIndex;
+    }
+    if (membership_filter_)
+    {
+        flags |= kFormatFlagMembershipFilter;
+    }
+    if (wide_offsets_)
+    {
+        flags |= kFormatFlagWideOffsets;
+    }
+    if (compressed_index_)
+    {
+        flags |= kFormatFlagCompressedIndex;
+    }
+    if (spatial_index_)
+    {
+        flags |= kFormatFlagSpatialIndex;
+    }
+    if (split_keys_ && !keySplitShifts().empty())
+    {
+        flags |= kFormatFlagSplitKeys;
+    }
+    if (entropy_tables_ > 1)
+    {
+        flags |= kFormatFlagEntropyTables;
+    }
+    return flags;
+}
+
 template <int KeySize, int ExtraDataSize>
 void DwarfIdeaBuilder<KeySize, ExtraDataSize>::build(std::ostream& os)
 {
+    if (!previous_path_.empty())
+    {
+        StatsReport::Phase phase(stats_report_, "load_previous");
+        loadPrevious();
+    }
+
+    {
+        StatsReport::Phase phase(stats_report_, "map_keys");
+        mapKeys();
+    }
+
     // Find split points for index.
-    buildIndex();
+    {
+        StatsReport::Phase phase(stats_report_, "build_index");
+        buildIndex();
+    }
+
+    // The keys layout of the anchored build follows the previous build.
+    if ((formatFlags() & kFormatFlagSplitKeys) && previous_first_keys_.empty())
+    {
+        StatsReport::Phase phase(stats_report_, "choose_keys_layout");
+        chooseKeysLayout();
+    }
 
     // Stats gathering.
     encodePass(os, 0);
 
+    {
+        StatsReport::Phase phase(stats_report_, "build_tables");
+        buildTables();
+    }
+
     // Actual data generation.
     writeHeader(os);
     encodePass(os, 1);
+
+    for (const StreamInfo* stream: {&keys_stream_, &coords_stream_, &extra_data_stream_})
+    {
+        if (stream->single_table_codec)
+        {
+            logTablesGain(*stream);
+        }
+    }
+
+    if (check_coords_error_)
+    {
+        LOG(INFO) << "Coords error: max = " << max_coords_error_ << " m, average = " <<
+            sum_coords_error_ / keys_.size() << " m";
+    }
+
+    if (compression_report_)
+    {
+        compression_report_->log();
+    }
+
+    if (block_stats_)
+    {
+        block_stats_->log();
+        CHECK(block_stats_->write(block_stats_path_)) << "Failed to write " << block_stats_path_;
+        block_stats_.reset();
+    }
+}
+
+template <int KeySize, int ExtraDataSize>
+void DwarfIdeaBuilder<KeySize, ExtraDataSize>::verify(const std::string& path) const
+{
+    DwarfIdeaReader reader;
+    CHECK(reader.open(path)) << "Failed to open " << path;
+    CHECK_EQ(reader.getHeader().num_entries, keys_.size()) << "Unexpected number of entries in " << path;
+    CHECK_EQ(reader.getNumBlocks(), index_.size()) << "Unexpected number of blocks in " << path;
+
+    auto get_extra_data = [this](size_t entry_index)
+    {
+        auto begin = extra_data_.begin() + entry_index * ExtraDataSize;
+        return std::string(begin, begin + ExtraDataSize);
+    };
+
+    double max_error = 0.0;
+#pragma omp parallel for schedule(static) reduction(max: max_error)
+    for (size_t i = 0; i < index_.size(); ++i)
+    {
+        size_t entry_index = index_[i];
+        size_t num_entries = ((i == index_.size() - 1) ? keys_.size() : index_[i + 1]) - entry_index;
+        DecodedBlock block;
+        CHECK(reader.decodeBlock(i, block)) << "Failed to decode block " << i;
+        CHECK_EQ(block.keys.size(), num_entries) << "Unexpected number of entries @ block " << i;
+        for (size_t j = 0; j < num_entries; ++j)
+        {
+            CHECK_EQ(block.keys[j], mapped_keys_[entry_index + j]) << "Key mismatch @ block " << i;
+            double error = getDist(getPoint(entry_index + j), block.getPoint(j));
+            CHECK_LE(error, max_dist_error_) << "Coords error is exceeded @ block " << i;
+            max_error = std::max(max_error, error);
+            CHECK(std::equal(block.extra_data.begin() + j * ExtraDataSize,
+                             block.extra_data.begin() + (j + 1) * ExtraDataSize,
+                             extra_data_.begin() + (entry_index + j) * ExtraDataSize)) <<
+                "Extra data mismatch @ block " << i;
+        }
+
+        // Point lookups go through the index search and partial block decoding,
+        // so check them on the block boundaries.
+        for (size_t j: {size_t(0), num_entries - 1})
+        {
+            const Key& key = keys_[entry_index + j];
+            Point point;
+            std::string extra_data;
+            CHECK(reader.lookup(std::string(key.begin(), key.end()), point, &extra_data)) <<
+                "Lookup failed @ block " << i;
+            CHECK(point.lat == block.lats[j] && point.lon == block.lons[j]) <<
+                "Lookup coords mismatch @ block " << i;
+            CHECK(extra_data == get_extra_data(entry_index + j)) <<
+                "Lookup extra data mismatch @ block " << i;
+        }
+        Point point;
+        if (i > 0 && block.keys[0] - 1 != mapped_keys_[entry_index - 1])
+        {
+            CHECK(!reader.lookupMappedKey(block.keys[0] - 1, point)) << "Absent key found @ block " << i;
+        }
+
+        if (reader.hasSpatialIndex())
+        {
+            std::vector<size_t> blocks;
+            CHECK(reader.findBlocksInBox(block.getPoint(0), block.getPoint(0), blocks) &&
+                  std::find(blocks.begin(), blocks.end(), i) != blocks.end()) << "Spatial index misses block " << i;
+        }
+    }
+
+    // Batched lookups of all keys, in reverse order so that they have to be sorted.
+    std::vector<std::string> keys;
+    std::vector<LookupResult> results;
+    for (size_t batch_end = keys_.size(); batch_end > 0; )
+    {
+        const size_t batch_begin = batch_end > kVerifyBatchSize ? batch_end - kVerifyBatchSize : 0;
+        keys.clear();
+        for (size_t i = batch_end; i-- > batch_begin; )
+        {
+            keys.emplace_back(keys_[i].begin(), keys_[i].end());
+        }
+        results.resize(keys.size());
+        reader.lookupBatch(keys.data(), keys.size(), results.data(), omp_get_max_threads());
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            const size_t entry_index = batch_end - 1 - i;
+            CHECK(results[i].found) << "Batch lookup failed @ entry " << entry_index;
+            CHECK_LE(getDist(getPoint(entry_index), results[i].point), max_dist_error_) <<
+                "Batch lookup coords error is exceeded @ entry " << entry_index;
+            CHECK(results[i].extra_data == get_extra_data(entry_index)) <<
+                "Batch lookup extra data mismatch @ entry " << entry_index;
+        }
+        batch_end = batch_begin;
+    }
+
+    LOG(INFO) << "Verified " << path << ": max coords error = " << max_error << " m";
 }
 
 template class DwarfIdeaBuilder<kCellKeySize, kCellExtraDataSize>;
@@ -21,47 +21,136 @@
 #include <array>
 #include <memory>
 #include <ostream>
+#include <string>
 #include <vector>
 
-#include <fse.h>
-
+#include "block_stats.h"
+#include "compression_report.h"
+#include "entropy_codecs.h"
+#include "freqs_clustering.h"
 #include "idwarf_idea_builder.h"
+#include "spatial_block_index.h"
+#include "trace_recorder.h"
+#include "transforms.h"
 #include "utils.h"
 
+class StatsReport;
+struct EntropyTable;
+
 struct BlockInfo
 {
     int32_t lat_min_index, lon_min_index, lat_max_index, lon_max_index;
     Point min_corner, max_corner;
     double max_lat_diff, max_lon_diff;
     int8_t lat_bits, lon_bits;
+    // Number of quantization steps, the coordinates indices are in [0, steps] range.
+    uint32_t lat_steps, lon_steps;
+};
+
+// How the number of quantization steps for coordinates is selected per block.
+enum class CoordsQuantization
+{
+    // Splits the error budget equally between lat and lon and assumes the worst-case
+    // latitude for the whole block. Simple, but the actual max error is ~2x smaller
+    // than requested.
+    kConservative,
+    // Selects lat / lon bits jointly so that the whole error budget is used.
+    // The output is compatible with the original format.
+    kJoint,
+    // Same as kJoint, but the number of steps is not restricted to (2 ^ bits - 1)
+    // and lat / lon indices are packed together. Requires kFormatFlagCoordsSteps.
+    kExact,
 };
 
+CoordsQuantization parseCoordsQuantization(const std::string& name);
+
+struct DwarfIdeaBuilderOptions
+{
+    float max_dist_error = 50.0f;
+    uint16_t min_entries_per_block = 64;
+    uint16_t max_entries_per_block = 256;
+    uint8_t bounding_box_bits = 16;
+    CoordsQuantization coords_quantization = CoordsQuantization::kJoint;
+    // If set, decode the coordinates of every block after encoding and verify
+    // the max error doesn't exceed 'max_dist_error'.
+    bool check_coords_error = true;
+    // Entropy codecs used for each of the streams, anything other than FSE
+    // requires kFormatFlagEntropyCodecs.
+    EntropyCodecType keys_codec = EntropyCodecType::kFse;
+    EntropyCodecType coords_codec = EntropyCodecType::kFse;
+    EntropyCodecType extra_data_codec = EntropyCodecType::kFse;
+    // Max number of entropy coding tables per stream, more than one requires kFormatFlagEntropyTables.
+    uint8_t entropy_tables = 1;
+    // Fraction of the blocks, evenly spread over the keys, from which the entropy coding
+    // statistics are gathered.
+    double stats_sample_ratio = 1.0;
+    // Transform chain used for all streams, anything other than BWTS requires
+    // kFormatFlagTransformChain.
+    TransformChain transform_chain = TransformChain::kBwts;
+    // If set, store coordinates and extra data as is, see kFormatFlagPackedCoords.
+    bool packed_coords = false;
+    // If set, add the cache-friendly copy of the index, see kFormatFlagEytzingerIndex.
+    bool eytzinger_index = false;
+    // If set, add the membership filter for fast negative lookups, see kFormatFlagMembershipFilter.
+    bool membership_filter = false;
+    // If set, store 64 bits counts and block offsets, see kFormatFlagWideOffsets.
+    bool wide_offsets = false;
+    // If set, store the index compressed, see kFormatFlagCompressedIndex.
+    bool compressed_index = false;
+    // If set, add the R-tree over the blocks bounding boxes for area queries, see kFormatFlagSpatialIndex.
+    bool spatial_index = false;
+    // If set and the builder supports it, code the parts of the keys separately, see kFormatFlagSplitKeys.
+    bool split_keys = false;
+    // If set, replace the OUIs of BSSIDs with the index in the table of OUIs, see kFormatFlagOuiIndex.
+    bool oui_index = false;
+    // If set, compare all entropy codecs / transform chains on every block and log the results.
+    bool entropy_codecs_report = false;
+    bool transform_chains_report = false;
+    // If set, the timings of the build phases are added there.
+    StatsReport* stats_report = nullptr;
+    // If set, per block statistics are written there, see 'BlockStats'.
+    std::string block_stats_path;
+    // If set, the encoding of every block is recorded there.
+    TraceRecorder* trace = nullptr;
+    // If set, the blocks boundaries and the entropy coding tables are anchored to this
+    // previous build of the same DB, so that the blocks whose entries didn't change are
+    // encoded to the same bytes, see diff/.
+    std::string previous_path;
+};
+
+// Exposes the individual build stages to the benchmarks, see bench/.
+template <int KeySize, int ExtraDataSize>
+class DwarfIdeaBuilderBenchmark;
+
 template <int KeySize, int ExtraDataSize>
 class DwarfIdeaBuilder: public IDwarfIdeaBuilder
 {
   public:
-    DwarfIdeaBuilder(float max_dist_error, uint16_t min_entries_per_block, uint16_t max_entries_per_block, uint8_t bounding_box_bits);
+    explicit DwarfIdeaBuilder(const DwarfIdeaBuilderOptions& options);
 
     void addLocation(const std::string& key, float lat, float lon, const std::string& extra_data) override;
 
     void build(std::ostream& os) override;
 
+    void verify(const std::string& path) const override;
+
   protected:
     typedef std::array<uint8_t, KeySize> Key;
-    typedef std::array<uint8_t, ExtraDataSize> ExtraData;
 
-    struct __attribute__((__packed__)) Entry
-    {
-        Key key;
-        Point point;
-        ExtraData extra_data;
+    // Keys as passed to 'addLocation', in the same order.
+    const std::vector<Key>& getKeys() const { return keys_; }
 
-        Entry(const Key& key, const Point& point, const std::string& extra_data_str);
-    };
+    // Returns the key as big-endian integer of 'mappedKeySize' bytes. Called once
+    // per entry at the start of 'build', so may depend on the state built by the
+    // subclass 'build' from all keys.
+    virtual uint64_t mapKey(const Key& key) const;
 
-    const std::vector<Entry>& getEntries() const { return entries_; }
+    // The shifts at which the mapped keys may be split into the high and low parts that
+    // are delta coded separately, see kFormatFlagSplitKeys. Empty by default.
+    virtual std::vector<int> keySplitShifts() const;
 
-    virtual Bytes mapKey(const Key& key) const;
+    // Format flags that describe the keys mapping done by the subclass.
+    virtual uint32_t keyFormatFlags() const;
 
     virtual int mappedKeySize() const;
 
@@ -69,21 +158,31 @@ class DwarfIdeaBuilder: public IDwarfIdeaBuilder
 
     virtual void writeHeaderExtra(std::ostream& os) const;
 
+    uint32_t formatFlags() const;
+
   private:
-    struct CTableDeleter
-    {
-        void operator() (FSE_CTable* table) { FSE_freeCTable(table); }
-    };
-    typedef std::unique_ptr<FSE_CTable, CTableDeleter> CTableUniquePtr;
+    friend class DwarfIdeaBuilderBenchmark<KeySize, ExtraDataSize>;
 
-    struct FseInfo
+    struct StreamInfo
     {
-        FseInfo();
+        StreamInfo(const char* name, EntropyCodecType codec_type);
 
+        const char* name;
         std::vector<unsigned> freqs;
-        std::vector<short> freqs_normalized;
-        CTableUniquePtr ctable;
 	size_t total_size;
+        EntropyCodecType codec_type;
+        // One per entropy coding table, the tables are built by 'buildTables' or loaded
+        // from the previous build.
+        std::vector<std::unique_ptr<IEntropyCodec>> codecs;
+        std::vector<Bytes> tables;
+        size_t report_index;
+        // The transformed data of every block, only kept by the first pass if multiple
+        // tables are requested.
+        std::vector<Bytes> block_data;
+        // The table built from 'freqs' as the baseline for multiple tables, and the total
+        // compressed size of the stream with it and with 'tables'.
+        std::unique_ptr<IEntropyCodec> single_table_codec;
+        size_t single_table_size, single_table_compressed_size, compressed_size;
     };
 
     double sin2_ca2_2_, dlat_, dlon_coef_;
@@ -92,21 +191,75 @@ class DwarfIdeaBuilder: public IDwarfIdeaBuilder
     int32_t bounding_box_max_index_;
     uint16_t min_entries_per_block_, max_entries_per_block_;
     uint8_t bounding_box_bits_;
-    std::vector<Entry> entries_;
+    CoordsQuantization coords_quantization_;
+    bool check_coords_error_;
+    double max_coords_error_, sum_coords_error_;
+    // The entries are stored column-wise, so that the per block loops over keys
+    // or coordinates access only the data they need.
+    std::vector<Key> keys_;
+    // Filled by 'mapKeys'.
+    std::vector<uint64_t> mapped_keys_;
+    std::vector<float> lats_, lons_;
+    // ExtraDataSize bytes per entry.
+    Bytes extra_data_;
     std::vector<size_t> index_;
     std::vector<float> index_dist_;
-    FseInfo keys_fse_info_, coords_fse_info_, extra_data_fse_info_;
+    StreamInfo keys_stream_, coords_stream_, extra_data_stream_;
+    TransformChain transform_chain_;
+    uint8_t entropy_tables_;
+    double stats_sample_ratio_;
+    bool packed_coords_;
+    bool eytzinger_index_;
+    bool membership_filter_;
+    bool wide_offsets_;
+    bool compressed_index_;
+    bool spatial_index_;
+    bool split_keys_;
+    std::unique_ptr<CompressionReport> compression_report_;
+    StatsReport* stats_report_;
+    std::string block_stats_path_;
+    std::unique_ptr<BlockStats> block_stats_;
+    TraceRecorder* trace_;
+    std::string previous_path_;
+    // Raw first keys of the previous build blocks, see 'loadPrevious'.
+    std::vector<Key> previous_first_keys_;
     long index_offset_;
 
+    Point getPoint(size_t entry_index) const { return Point(lats_[entry_index], lons_[entry_index]); }
+
+    void mapKeys();
+
+    // The mapped key as stored in the file, 'mappedKeySize' bytes.
+    Bytes mappedKeyBytes(uint64_t mapped_key) const;
+
+    void loadPrevious();
+
+    void loadPreviousTables(const std::vector<EntropyTable>& tables, StreamInfo& stream);
+
+    // Turns off the split keys if they don't reduce the size, see kFormatFlagSplitKeys.
+    void chooseKeysLayout();
+
     void buildIndex();
 
     void findIndexSplit(size_t min_index, size_t max_index);
 
-    Bytes compressBytes(const Bytes& input, size_t index);
+    Bytes compressBytes(const Bytes& input);
 
     BlockInfo computeBlockInfo(size_t index, size_t num_entries);
 
-    Bytes encodeKeys(size_t index, size_t num_entries);
+    void computeConservativeSteps(BlockInfo& block_info, size_t index, size_t num_entries);
+
+    void computeJointSteps(BlockInfo& block_info, size_t index, size_t num_entries);
+
+    double getMaxCoordsError(const BlockInfo& block_info, size_t index, size_t num_entries);
+
+    void checkCoords(const Bytes& encoded_coords, size_t index, size_t num_entries);
+
+    Bytes encodeKeys(size_t index, size_t num_entries, size_t iteration);
+
+    Bytes encodeKeyDeltas(const uint64_t* keys, size_t num_entries) const;
+
+    Bytes encodeSplitKeys(const uint64_t* keys, size_t num_entries, int shift) const;
 
     Bytes encodeCoords(const BlockInfo& block_info, size_t index, size_t num_entries);
 
@@ -114,13 +267,42 @@ class DwarfIdeaBuilder: public IDwarfIdeaBuilder
 
     void encodePass(std::ostream& os, size_t iteration);
 
+    // Writes u64 if kFormatFlagWideOffsets is used or u32 otherwise.
+    void writeCount(std::ostream& os, uint64_t value, const char* name) const;
+
+    void writeIndex(std::ostream& os, const std::vector<Bytes>& blocks);
+
     void writeIndexPos(std::ostream& os, size_t index);
 
+    void writeEytzingerIndex(std::ostream& os);
+
+    void writeMembershipFilter(std::ostream& os);
+
+    void writeSpatialIndex(std::ostream& os, const std::vector<GridBox>& block_boxes);
+
     void flushBlock(Bytes* output, size_t iteration, const BlockInfo& block_info, size_t index, size_t num_entries);
 
     void updateFreqs(const Bytes& data, std::vector<unsigned>& freqs);
 
-    void writeFseHeader(std::ostream& os, FseInfo& fse_info);
+    // Returns true if the block is in the sample the first pass gathers the statistics from.
+    bool isStatsBlock(size_t index) const;
+
+    // Builds the entropy coding tables of all streams from the statistics gathered by the first pass.
+    void buildTables();
+
+    // Builds the table of the codec, making sure the symbols absent from the sample remain encodable.
+    Bytes buildTable(IEntropyCodec& codec, std::vector<unsigned> freqs, size_t total_size) const;
+
+    void buildStreamTables(StreamInfo& stream);
+
+    void writeCodecHeader(std::ostream& os, const StreamInfo& stream);
+
+    // Compresses with the table that gives the smallest output.
+    Bytes entropyCompress(const Bytes& data, StreamInfo& stream, BlockStreamStats* stats = nullptr);
+
+    // Returns the size of the 'entropyCompress' output, without updating the stream statistics.
+    size_t getCompressedSize(const Bytes& data, const StreamInfo& stream) const;
 
-    Bytes entropyCompress(const Bytes& data, FSE_CTable* ctable);
+    // Logs the gain of multiple entropy coding tables over the single one.
+    void logTablesGain(const StreamInfo& stream) const;
 };
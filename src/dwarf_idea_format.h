@@ -0,0 +1,100 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Constants describing DwarfIdea file layout.
+
+constexpr const char* kFileSignature = "DwarfIdea";
+
+// The original format, understood by all existing readers.
+constexpr uint16_t kFileFormatVersion = 1;
+
+// Same as version 1, but 32 bits of format flags (see below) follow the version field.
+// The builder emits it only if some of the flags are actually set.
+constexpr uint16_t kExtendedFileFormatVersion = 2;
+
+enum FormatFlags: uint32_t
+{
+    // Coordinates are quantized using arbitrary number of steps per block instead of
+    // (2 ^ bits - 1) steps and are packed as mixed-radix numbers, see
+    // 'DwarfIdeaBuilder::encodeCoords' for the layout.
+    kFormatFlagCoordsSteps = 1 << 0,
+    // Each entropy coding table is preceded by the byte with the codec type,
+    // see 'EntropyCodecType'. Without this flag all streams use FSE.
+    kFormatFlagEntropyCodecs = 1 << 1,
+    // The byte with the transform chain type, see 'TransformChain', follows the
+    // format flags. Without this flag all streams use BWTS + SBRT + ZRLT.
+    kFormatFlagTransformChain = 1 << 2,
+    // Coordinates and extra data streams are stored as is, without transforms and
+    // entropy coding, and have no entropy coding tables. As both have fixed number
+    // of bits per entry, the entry can be extracted directly once its position is
+    // known from the keys stream.
+    kFormatFlagPackedCoords = 1 << 3,
+    // The index is followed by the copy of its keys in Eytzinger order, see
+    // 'EytzingerIndex', aligned to kEytzingerIndexAlignment bytes.
+    kFormatFlagEytzingerIndex = 1 << 4,
+    // The index is followed by u32 size + the membership filter of all keys, see
+    // 'MembershipFilter'. Comes after the Eytzinger index if both are present.
+    kFormatFlagMembershipFilter = 1 << 5,
+    // The numbers of entries and blocks in the header and the block offsets in the
+    // index are u64 instead of u32, so that the file can exceed 4 GB.
+    kFormatFlagWideOffsets = 1 << 6,
+    // The index is stored as 'CompressedBlockIndex' instead of the array of the
+    // first keys and offsets of all blocks. Can't be combined with kFormatFlagEytzingerIndex.
+    kFormatFlagCompressedIndex = 1 << 7,
+    // The membership filter, or the index if there is none, is followed by u32 size +
+    // 'SpatialBlockIndex' over the bounding boxes of all blocks.
+    kFormatFlagSpatialIndex = 1 << 8,
+    // The keys stream of every block starts with the byte of the shift at which the keys
+    // are split into the high and low parts. With zero shift the rest of the stream is
+    // the same as without this flag, otherwise it's varint number of the keys except the
+    // first one, their varint codes and then the varint low parts of the keys with the
+    // changed high part, see 'DwarfIdeaBuilder::encodeSplitKeys'.
+    kFormatFlagSplitKeys = 1 << 9,
+    // The OUI (the first 3 bytes) of BSSIDs keys is replaced with its index in the table of
+    // OUIs, which follows the number of MCC / MNC pairs in the header as u32 number of OUIs
+    // + varint deltas of OUIs in ascending order, starting from 0. The index takes 2 bytes
+    // if there are at most kMaxShortOuiIndexSize OUIs and 3 bytes otherwise.
+    kFormatFlagOuiIndex = 1 << 10,
+    // Each entropy coding table is replaced with u8 number of tables (of the same codec)
+    // followed by u32 size + data of every table. The entropy coded blocks streams of the
+    // streams with more than one table start with the byte of the table index.
+    kFormatFlagEntropyTables = 1 << 11,
+};
+
+constexpr size_t kMaxShortOuiIndexSize = 1 << 16;
+
+// Alignment of the Eytzinger index section w.r.t. the start of the file, so that
+// the top levels of the tree occupy the minimal number of cache lines.
+constexpr size_t kEytzingerIndexAlignment = 64;
+
+// Each block stream is prefixed with varint of (size << 2) | flags.
+enum StreamFlags: uint8_t
+{
+    // ZRLT was not applied because it would expand the data.
+    kStreamFlagNoZrlt = 0x01,
+    // Entropy coding was not applied because it would expand the data.
+    kStreamFlagNoEntropyCoding = 0x02,
+};
+
+// Number of bits used to store the number of lat / lon bits in each block.
+constexpr int kCoordsBitsBits = 5;
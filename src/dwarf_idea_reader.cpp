@@ -0,0 +1,932 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "dwarf_idea_reader.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+#include <glog/logging.h>
+
+#include "batch_lookup.h"
+#include "coords.h"
+#include "dwarf_idea_format.h"
+#include "entropy_codecs.h"
+
+namespace {
+
+// Max size of the varint-encoded 64 bits value.
+const size_t kMaxVarIntSize = 10;
+
+const uint32_t kKnownFormatFlags =
+    kFormatFlagCoordsSteps | kFormatFlagEntropyCodecs | kFormatFlagTransformChain | kFormatFlagPackedCoords |
+    kFormatFlagEytzingerIndex | kFormatFlagMembershipFilter | kFormatFlagWideOffsets |
+    kFormatFlagCompressedIndex | kFormatFlagSpatialIndex | kFormatFlagSplitKeys | kFormatFlagOuiIndex |
+    kFormatFlagEntropyTables;
+
+// Reads u64 if 'wide' is set or u32 otherwise, see kFormatFlagWideOffsets.
+bool getCount(BytesReader& reader, bool wide, uint64_t& value)
+{
+    if (wide)
+    {
+        return reader.get(value);
+    }
+    uint32_t narrow_value = 0;
+    if (!reader.get(narrow_value))
+    {
+        return false;
+    }
+    value = narrow_value;
+    return true;
+}
+
+uint64_t getBigEndian(const uint8_t* data, size_t size)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+        value = (value << 8) | data[i];
+    }
+    return value;
+}
+
+bool readCodecs(
+    BytesReader& reader, bool has_codec_type, bool has_num_tables,
+    std::vector<std::unique_ptr<IEntropyCodec>>& codecs, std::vector<EntropyTable>& tables)
+{
+    uint8_t codec_type = uint8_t(EntropyCodecType::kFse);
+    uint8_t num_tables = 1;
+    if ((has_codec_type && !reader.get(codec_type)) || (has_num_tables && !reader.get(num_tables)) || !num_tables)
+    {
+        return false;
+    }
+    tables.resize(num_tables);
+    for (EntropyTable& table: tables)
+    {
+        table.codec_type = EntropyCodecType(codec_type);
+        codecs.push_back(createEntropyCodec(table.codec_type));
+        uint32_t table_size = 0;
+        if (!codecs.back() || !reader.get(table_size) || !reader.getBytes(table_size, table.data))
+        {
+            return false;
+        }
+        table.size = table_size;
+        if (!codecs.back()->loadTable(table.data, table.size))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+bool DecodedBlock::findEntry(uint64_t mapped_key, size_t& index) const
+{
+    auto key_it = std::lower_bound(keys.begin(), keys.end(), mapped_key);
+    if (key_it == keys.end() || *key_it != mapped_key)
+    {
+        return false;
+    }
+    index = key_it - keys.begin();
+    return true;
+}
+
+size_t DecodedBlock::getMemoryUsage() const
+{
+    return sizeof(*this) + keys.capacity() * sizeof(uint64_t) +
+        (lats.capacity() + lons.capacity()) * sizeof(float) + extra_data.capacity();
+}
+
+DwarfIdeaReader::DwarfIdeaReader():
+    data_(nullptr),
+    size_(0),
+    blocks_offset_(0)
+{
+}
+
+DwarfIdeaReader::~DwarfIdeaReader()
+{
+    close();
+}
+
+bool DwarfIdeaReader::open(const std::string& path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        LOG(ERROR) << "Failed to open " << path << ": " << strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            data_ = (const uint8_t*)data;
+            size_ = st.st_size;
+        }
+    }
+    ::close(fd);
+
+    if (!data_)
+    {
+        LOG(ERROR) << "Failed to map " << path;
+        return false;
+    }
+    if (!parse())
+    {
+        LOG(ERROR) << "Malformed or unsupported DwarfIdea file " << path;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void DwarfIdeaReader::close()
+{
+    if (data_)
+    {
+        munmap((void*)data_, size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    mccs_mncs_.clear();
+    mccs_mncs_map_.clear();
+    ouis_.clear();
+    keys_codecs_.clear();
+    coords_codecs_.clear();
+    extra_data_codecs_.clear();
+    keys_tables_.clear();
+    coords_tables_.clear();
+    extra_data_tables_.clear();
+    index_keys_.clear();
+    index_offsets_.clear();
+    compressed_index_ = CompressedBlockIndex();
+    blocks_offset_ = 0;
+    eytzinger_index_ = EytzingerIndex();
+    membership_filter_ = MembershipFilter();
+    spatial_index_ = SpatialBlockIndex();
+}
+
+bool DwarfIdeaReader::parse()
+{
+    BytesReader reader(data_, data_ + size_);
+
+    const uint8_t* signature = nullptr;
+    const size_t signature_size = strlen(kFileSignature);
+    if (!reader.getBytes(signature_size, signature) || memcmp(signature, kFileSignature, signature_size) ||
+        !reader.get(header_.version))
+    {
+        return false;
+    }
+    header_.format_flags = 0;
+    header_.transform_chain = TransformChain::kBwts;
+    if (header_.version == kExtendedFileFormatVersion)
+    {
+        if (!reader.get(header_.format_flags) || (header_.format_flags & ~kKnownFormatFlags))
+        {
+            return false;
+        }
+        uint8_t chain = 0;
+        if (header_.format_flags & kFormatFlagTransformChain)
+        {
+            if (!reader.get(chain) || chain > uint8_t(TransformChain::kZrlt))
+            {
+                return false;
+            }
+        }
+        header_.transform_chain = TransformChain(chain);
+    }
+    else if (header_.version != kFileFormatVersion)
+    {
+        return false;
+    }
+
+    const bool wide_offsets = header_.format_flags & kFormatFlagWideOffsets;
+    if (!reader.get(header_.key_size) || !reader.get(header_.extra_data_size) ||
+        !getCount(reader, wide_offsets, header_.num_entries) || !getCount(reader, wide_offsets, header_.num_blocks) ||
+        !reader.get(header_.min_entries_per_block) || !reader.get(header_.max_entries_per_block) ||
+        !reader.get(header_.bounding_box_bits) || !reader.get(header_.max_dist_error))
+    {
+        return false;
+    }
+
+    // Cells keys have MCC + MNC replaced with the index in MCC / MNC table,
+    // other keys are stored as is.
+    mapped_key_size_ = header_.key_size == kCellKeySize ? 8 : header_.key_size;
+    if (mapped_key_size_ > int(sizeof(uint64_t)) || !header_.num_blocks || header_.num_blocks > size_ ||
+        !header_.max_entries_per_block || header_.bounding_box_bits >= 32)
+    {
+        return false;
+    }
+
+    uint16_t num_mccs_mncs = 0;
+    if (!reader.get(num_mccs_mncs))
+    {
+        return false;
+    }
+    for (uint16_t i = 0; i < num_mccs_mncs; ++i)
+    {
+        uint32_t mcc_mnc = 0;
+        if (!reader.get(mcc_mnc))
+        {
+            return false;
+        }
+        mccs_mncs_map_.insert(std::make_pair(mcc_mnc, uint16_t(mccs_mncs_.size())));
+        mccs_mncs_.push_back(mcc_mnc);
+    }
+
+    if (header_.format_flags & kFormatFlagOuiIndex)
+    {
+        uint32_t num_ouis = 0;
+        if (header_.key_size != kBssidKeySize || !reader.get(num_ouis) || !num_ouis ||
+            num_ouis > size_t(data_ + size_ - reader.getPos()))
+        {
+            return false;
+        }
+        ouis_.resize(num_ouis);
+        for (uint32_t i = 0; i < num_ouis; ++i)
+        {
+            const uint32_t prev_oui = i ? ouis_[i - 1] : 0;
+            uint32_t delta = 0;
+            if (!reader.getVarInt(delta) || (i && !delta) || delta >= (uint32_t(1) << (8 * kOuiSize)) - prev_oui)
+            {
+                return false;
+            }
+            ouis_[i] = prev_oui + delta;
+        }
+        mapped_key_size_ = num_ouis <= kMaxShortOuiIndexSize ? kBssidKeySize - 1 : kBssidKeySize;
+    }
+
+    const uint8_t* key = nullptr;
+    if (!reader.getBytes(mapped_key_size_, key))
+    {
+        return false;
+    }
+    last_key_ = getBigEndian(key, mapped_key_size_);
+
+    const bool has_codec_type = header_.format_flags & kFormatFlagEntropyCodecs;
+    const bool has_num_tables = header_.format_flags & kFormatFlagEntropyTables;
+    if (!readCodecs(reader, has_codec_type, has_num_tables, keys_codecs_, keys_tables_))
+    {
+        return false;
+    }
+    if (!isPacked())
+    {
+        if (!readCodecs(reader, has_codec_type, has_num_tables, coords_codecs_, coords_tables_) ||
+            (header_.extra_data_size &&
+             !readCodecs(reader, has_codec_type, has_num_tables, extra_data_codecs_, extra_data_tables_)))
+        {
+            return false;
+        }
+    }
+
+    const bool compressed_index = header_.format_flags & kFormatFlagCompressedIndex;
+    if (compressed_index)
+    {
+        size_t index_size = 0;
+        const uint8_t* index = nullptr;
+        if ((header_.format_flags & kFormatFlagEytzingerIndex) ||
+            !compressed_index_.reset(reader.getPos(), data_ + size_ - reader.getPos(), header_.num_blocks, index_size) ||
+            !reader.getBytes(index_size, index))
+        {
+            return false;
+        }
+    }
+    index_keys_.resize(compressed_index ? 0 : header_.num_blocks);
+    index_offsets_.resize(compressed_index ? 0 : header_.num_blocks);
+    for (size_t i = 0; i < index_keys_.size(); ++i)
+    {
+        if (!reader.getBytes(mapped_key_size_, key) || !getCount(reader, wide_offsets, index_offsets_[i]))
+        {
+            return false;
+        }
+        index_keys_[i] = getBigEndian(key, mapped_key_size_);
+        if (i && (index_keys_[i] <= index_keys_[i - 1] || index_offsets_[i] < index_offsets_[i - 1]))
+        {
+            return false;
+        }
+    }
+
+    if (header_.format_flags & kFormatFlagEytzingerIndex)
+    {
+        const size_t padding = (kEytzingerIndexAlignment - (reader.getPos() - data_) % kEytzingerIndexAlignment) %
+            kEytzingerIndexAlignment;
+        const size_t size = getEytzingerIndexSize(header_.num_blocks);
+        const uint8_t* index = nullptr;
+        if (!reader.getBytes(padding, index) || !reader.getBytes(size, index))
+        {
+            return false;
+        }
+        // If the index cannot be used in place, the flat index is used instead.
+        if (eytzinger_index_.reset(index, size, header_.num_blocks))
+        {
+            for (size_t position = 1; position <= header_.num_blocks; ++position)
+            {
+                if (eytzinger_index_.getKey(position) != index_keys_[eytzinger_index_.getSortedIndex(position)])
+                {
+                    return false;
+                }
+            }
+        }
+    }
+
+    if (header_.format_flags & kFormatFlagMembershipFilter)
+    {
+        uint32_t size = 0;
+        const uint8_t* filter = nullptr;
+        if (!reader.get(size) || !reader.getBytes(size, filter) || !membership_filter_.load(filter, size))
+        {
+            return false;
+        }
+    }
+
+    if (header_.format_flags & kFormatFlagSpatialIndex)
+    {
+        uint32_t size = 0;
+        size_t index_size = 0;
+        const uint8_t* index = nullptr;
+        if (!reader.get(size) || !reader.getBytes(size, index) ||
+            !spatial_index_.reset(index, size, header_.num_blocks, index_size) || index_size != size)
+        {
+            return false;
+        }
+    }
+
+    blocks_offset_ = reader.getPos() - data_;
+    if (compressed_index)
+    {
+        if (compressed_index_.getLastGroupOffset() >= size_ - blocks_offset_ ||
+            last_key_ < compressed_index_.getLastGroupKey())
+        {
+            return false;
+        }
+    }
+    else if (index_offsets_.front() < blocks_offset_ || index_offsets_.back() >= size_ || last_key_ < index_keys_.back())
+    {
+        return false;
+    }
+
+    // Upper bounds of the decoded streams sizes, used to size the buffers and
+    // to reject malformed blocks.
+    const size_t max_entries = header_.max_entries_per_block;
+    max_keys_size_ = (max_entries - 1) * kMaxVarIntSize;
+    max_coords_size_ = (4 * header_.bounding_box_bits + 4 * kCoordsBitsBits + 64 * max_entries + 7) / 8;
+    max_extra_data_size_ = max_entries * header_.extra_data_size;
+    return true;
+}
+
+bool DwarfIdeaReader::isPacked() const
+{
+    return header_.format_flags & kFormatFlagPackedCoords;
+}
+
+bool DwarfIdeaReader::mapKey(const std::string& key, uint64_t& mapped_key) const
+{
+    if (key.size() != header_.key_size)
+    {
+        return false;
+    }
+    const uint8_t* key_data = (const uint8_t*)key.data();
+    if (header_.key_size == kCellKeySize)
+    {
+        const uint32_t mcc_mnc = getBigEndian(key_data, 4);
+        auto mcc_mnc_it = mccs_mncs_map_.find(mcc_mnc);
+        if (mcc_mnc_it == mccs_mncs_map_.end())
+        {
+            return false;
+        }
+        mapped_key = (uint64_t(mcc_mnc_it->second) << 48) | getBigEndian(key_data + 4, kCellKeySize - 4);
+    }
+    else if (!ouis_.empty())
+    {
+        auto oui_it = std::lower_bound(ouis_.begin(), ouis_.end(), getBigEndian(key_data, kOuiSize));
+        if (oui_it == ouis_.end() || *oui_it != getBigEndian(key_data, kOuiSize))
+        {
+            return false;
+        }
+        mapped_key = (uint64_t(oui_it - ouis_.begin()) << (8 * kOuiSize)) |
+            getBigEndian(key_data + kOuiSize, kBssidKeySize - kOuiSize);
+    }
+    else
+    {
+        mapped_key = getBigEndian(key_data, key.size());
+    }
+    return true;
+}
+
+bool DwarfIdeaReader::unmapKey(uint64_t mapped_key, std::string& key) const
+{
+    auto put_big_endian = [&key](uint64_t value, size_t begin, size_t end)
+    {
+        while (end > begin)
+        {
+            key[--end] = char(value & 0xFF);
+            value >>= 8;
+        }
+    };
+    key.resize(header_.key_size);
+    if (header_.key_size == kCellKeySize)
+    {
+        const uint64_t mcc_mnc_index = mapped_key >> 48;
+        if (mcc_mnc_index >= mccs_mncs_.size())
+        {
+            return false;
+        }
+        put_big_endian(mccs_mncs_[mcc_mnc_index], 0, 4);
+        put_big_endian(mapped_key, 4, kCellKeySize);
+    }
+    else if (!ouis_.empty())
+    {
+        const uint64_t oui_index = mapped_key >> (8 * kOuiSize);
+        if (oui_index >= ouis_.size())
+        {
+            return false;
+        }
+        put_big_endian(ouis_[oui_index], 0, kOuiSize);
+        put_big_endian(mapped_key, kOuiSize, kBssidKeySize);
+    }
+    else
+    {
+        if (key.size() < sizeof(uint64_t) && mapped_key >> (8 * key.size()))
+        {
+            return false;
+        }
+        put_big_endian(mapped_key, 0, key.size());
+    }
+    return true;
+}
+
+bool DwarfIdeaReader::mayContain(uint64_t mapped_key) const
+{
+    return membership_filter_.empty() || membership_filter_.mayContain(mapped_key);
+}
+
+bool DwarfIdeaReader::findBlock(uint64_t mapped_key, size_t& block_index) const
+{
+    if (!compressed_index_.empty())
+    {
+        return mapped_key <= last_key_ && compressed_index_.find(mapped_key, block_index);
+    }
+    if (index_keys_.empty() || mapped_key < index_keys_.front() || mapped_key > last_key_)
+    {
+        return false;
+    }
+    if (!eytzinger_index_.empty())
+    {
+        block_index = eytzinger_index_.findLastNotGreater(mapped_key);
+    }
+    else
+    {
+        block_index = std::upper_bound(index_keys_.begin(), index_keys_.end(), mapped_key) - index_keys_.begin() - 1;
+    }
+    return true;
+}
+
+bool DwarfIdeaReader::getBlockData(
+    size_t block_index, uint64_t& first_key, const uint8_t*& data, size_t& size) const
+{
+    size_t begin = 0, end = 0;
+    if (!getBlockRange(block_index, first_key, begin, end))
+    {
+        return false;
+    }
+    data = data_ + begin;
+    size = end - begin;
+    return true;
+}
+
+bool DwarfIdeaReader::getBlockRange(size_t block_index, uint64_t& first_key, size_t& begin, size_t& end) const
+{
+    if (!compressed_index_.empty())
+    {
+        uint64_t relative_begin = 0, relative_end = 0;
+        if (!compressed_index_.getBlock(block_index, first_key, relative_begin, relative_end) ||
+            relative_begin >= size_ - blocks_offset_)
+        {
+            return false;
+        }
+        begin = blocks_offset_ + relative_begin;
+        end = relative_end < size_ - blocks_offset_ ? blocks_offset_ + relative_end : size_;
+    }
+    else if (block_index < index_offsets_.size())
+    {
+        first_key = index_keys_[block_index];
+        begin = index_offsets_[block_index];
+        end = block_index + 1 < index_offsets_.size() ? index_offsets_[block_index + 1] : size_;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+bool DwarfIdeaReader::readBlockStreams(size_t block_index, BlockStreams& streams) const
+{
+    size_t begin = 0, end = 0;
+    if (!getBlockRange(block_index, streams.first_key, begin, end))
+    {
+        return false;
+    }
+    BytesReader reader(data_ + begin, data_ + end);
+    auto read_stream = [&reader](Stream& stream)
+    {
+        uint64_t size_flags = 0;
+        if (!reader.getVarInt(size_flags) || !reader.getBytes(size_flags >> 2, stream.data))
+        {
+            return false;
+        }
+        stream.size = size_flags >> 2;
+        stream.flags = size_flags & 0x3;
+        return true;
+    };
+    streams.extra_data = Stream{nullptr, 0, 0};
+    return read_stream(streams.keys) && read_stream(streams.coords) &&
+        (!header_.extra_data_size || read_stream(streams.extra_data));
+}
+
+bool DwarfIdeaReader::decodeStream(
+    const Stream& stream, const Codecs& codecs, size_t max_size, Bytes& output) const
+{
+    const uint8_t* data = stream.data;
+    size_t size = stream.size;
+    Bytes entropy_decoded;
+    if (!(stream.flags & kStreamFlagNoEntropyCoding))
+    {
+        size_t table_index = 0;
+        if (codecs.size() > 1)
+        {
+            if (!size || *data >= codecs.size())
+            {
+                return false;
+            }
+            table_index = *data++;
+            --size;
+        }
+        if (!codecs[table_index]->decompress(data, size, max_size, entropy_decoded))
+        {
+            return false;
+        }
+        data = entropy_decoded.data();
+        size = entropy_decoded.size();
+    }
+    return inverseTransform(header_.transform_chain, data, size, stream.flags, max_size, output);
+}
+
+bool DwarfIdeaReader::decodeKeys(uint64_t first_key, const Stream& stream, std::vector<uint64_t>& keys) const
+{
+    Bytes decoded;
+    if (!decodeStream(stream, keys_codecs_, max_keys_size_, decoded))
+    {
+        return false;
+    }
+    // The first key is stored in the index, the rest are varint deltas.
+    keys.assign(1, first_key);
+    const uint8_t* data = decoded.data();
+    const uint8_t* end = data + decoded.size();
+    if (header_.format_flags & kFormatFlagSplitKeys)
+    {
+        if (data == end)
+        {
+            return false;
+        }
+        const int shift = *data++;
+        if (shift)
+        {
+            return decodeSplitKeys(shift, data, end, keys);
+        }
+    }
+    while (data != end)
+    {
+        uint64_t key_diff = 0;
+        if (!readVarInt(data, end, key_diff) || keys.size() == header_.max_entries_per_block)
+        {
+            return false;
+        }
+        keys.push_back(keys.back() + key_diff);
+    }
+    return true;
+}
+
+bool DwarfIdeaReader::decodeSplitKeys(
+    int shift, const uint8_t* data, const uint8_t* end, std::vector<uint64_t>& keys) const
+{
+    uint64_t num_keys = 0;
+    if (shift >= 64 || !readVarInt(data, end, num_keys) || num_keys >= header_.max_entries_per_block)
+    {
+        return false;
+    }
+    // The low parts follow all the codes, so the codes have to be read first.
+    std::vector<uint64_t> codes(num_keys);
+    for (uint64_t& code: codes)
+    {
+        if (!readVarInt(data, end, code))
+        {
+            return false;
+        }
+    }
+
+    const uint64_t low_mask = (uint64_t(1) << shift) - 1;
+    const uint64_t max_high = ~uint64_t(0) >> shift;
+    uint64_t high = keys.back() >> shift, low = keys.back() & low_mask;
+    for (uint64_t code: codes)
+    {
+        const uint64_t delta = code >> 1;
+        if (code & 1)
+        {
+            if (delta >= max_high - high || !readVarInt(data, end, low) || low > low_mask)
+            {
+                return false;
+            }
+            high += delta + 1;
+        }
+        else
+        {
+            if (delta >= low_mask - low)
+            {
+                return false;
+            }
+            low += delta + 1;
+        }
+        keys.push_back((high << shift) | low);
+    }
+    return data == end;
+}
+
+bool DwarfIdeaReader::decodeBlock(size_t block_index, DecodedBlock& block) const
+{
+    BlockStreams streams;
+    Bytes coords, extra_data;
+    CoordsReader coords_reader(header_.bounding_box_bits, header_.format_flags & kFormatFlagCoordsSteps);
+    bool ok = readBlockStreams(block_index, streams) && decodeKeys(streams.first_key, streams.keys, block.keys);
+    if (ok && isPacked())
+    {
+        coords.assign(streams.coords.data, streams.coords.data + streams.coords.size);
+        extra_data.assign(streams.extra_data.data, streams.extra_data.data + streams.extra_data.size);
+    }
+    else if (ok)
+    {
+        ok = decodeStream(streams.coords, coords_codecs_, max_coords_size_, coords) &&
+            (!header_.extra_data_size ||
+             decodeStream(streams.extra_data, extra_data_codecs_, max_extra_data_size_, extra_data));
+    }
+    const size_t num_entries = block.keys.size();
+    ok = ok && extra_data.size() == num_entries * header_.extra_data_size &&
+        coords_reader.reset(coords.data(), coords.size(), num_entries);
+    if (!ok)
+    {
+        LOG(ERROR) << "Malformed block " << block_index;
+        return false;
+    }
+
+    block.lats.resize(num_entries);
+    block.lons.resize(num_entries);
+    for (size_t i = 0; i < num_entries; ++i)
+    {
+        const Point point = coords_reader.getPoint(i);
+        block.lats[i] = point.lat;
+        block.lons[i] = point.lon;
+    }
+    block.extra_data.swap(extra_data);
+    return true;
+}
+
+bool DwarfIdeaReader::lookup(const std::string& key, Point& point, std::string* extra_data) const
+{
+    uint64_t mapped_key = 0;
+    return mapKey(key, mapped_key) && lookupMappedKey(mapped_key, point, extra_data);
+}
+
+bool DwarfIdeaReader::lookupMappedKey(uint64_t mapped_key, Point& point, std::string* extra_data) const
+{
+    size_t block_index = 0;
+    if (!mayContain(mapped_key) || !findBlock(mapped_key, block_index))
+    {
+        return false;
+    }
+
+    BlockStreams streams;
+    std::vector<uint64_t> keys;
+    if (!readBlockStreams(block_index, streams) || !decodeKeys(streams.first_key, streams.keys, keys))
+    {
+        LOG(ERROR) << "Malformed block " << block_index;
+        return false;
+    }
+    auto key_it = std::lower_bound(keys.begin(), keys.end(), mapped_key);
+    if (key_it == keys.end() || *key_it != mapped_key)
+    {
+        return false;
+    }
+    const size_t entry_index = key_it - keys.begin();
+
+    // Packed streams are used in place, otherwise decode just the streams needed.
+    CoordsReader coords_reader(header_.bounding_box_bits, header_.format_flags & kFormatFlagCoordsSteps);
+    Bytes coords;
+    bool ok = isPacked() ?
+        coords_reader.reset(streams.coords.data, streams.coords.size, keys.size()) :
+        decodeStream(streams.coords, coords_codecs_, max_coords_size_, coords) &&
+        coords_reader.reset(coords.data(), coords.size(), keys.size());
+    if (ok && extra_data)
+    {
+        Bytes decoded_extra_data;
+        const uint8_t* extra_data_ptr = streams.extra_data.data;
+        size_t extra_data_size = streams.extra_data.size;
+        if (header_.extra_data_size && !isPacked())
+        {
+            ok = decodeStream(
+                streams.extra_data, extra_data_codecs_, max_extra_data_size_, decoded_extra_data);
+            extra_data_ptr = decoded_extra_data.data();
+            extra_data_size = decoded_extra_data.size();
+        }
+        ok = ok && extra_data_size == keys.size() * header_.extra_data_size;
+        if (ok)
+        {
+            const uint8_t* entry_extra_data = extra_data_ptr + entry_index * header_.extra_data_size;
+            extra_data->assign(entry_extra_data, entry_extra_data + header_.extra_data_size);
+        }
+    }
+    if (!ok)
+    {
+        LOG(ERROR) << "Malformed block " << block_index;
+        return false;
+    }
+    point = coords_reader.getPoint(entry_index);
+    return true;
+}
+
+void DwarfIdeaReader::lookupBatch(
+    const std::string* keys, size_t num_keys, LookupResult* results, int num_threads) const
+{
+    auto get_block = [this](size_t block_index)
+    {
+        std::shared_ptr<DecodedBlock> block = std::make_shared<DecodedBlock>();
+        return decodeBlock(block_index, *block) ? block : nullptr;
+    };
+    ::lookupBatch(*this, get_block, keys, num_keys, results, num_threads);
+}
+
+void DwarfIdeaReader::findBlocksInArea(
+    double lat_min, double lon_min, double lat_max, double lon_max, std::vector<size_t>& blocks) const
+{
+    // Same grid as used by the builder for the blocks bounding boxes, the area is
+    // extended to the grid lines so that the blocks touching it are found too.
+    const uint32_t max_index = (uint32_t(1) << header_.bounding_box_bits) - 1;
+    const double lat_step = (kMaxLat - kMinLat) / max_index;
+    const double lon_step = (kMaxLon - kMinLon) / max_index;
+    auto to_index = [max_index](double index)
+    {
+        return uint32_t(std::max(0.0, std::min(index, double(max_index))));
+    };
+    std::vector<std::pair<double, double>> lon_ranges;
+    if (lon_max - lon_min >= kMaxLon - kMinLon)
+    {
+        lon_ranges.emplace_back(kMinLon, kMaxLon);
+    }
+    else if (lon_min < kMinLon)
+    {
+        lon_ranges.emplace_back(lon_min + (kMaxLon - kMinLon), kMaxLon);
+        lon_ranges.emplace_back(kMinLon, lon_max);
+    }
+    else if (lon_max > kMaxLon)
+    {
+        lon_ranges.emplace_back(lon_min, kMaxLon);
+        lon_ranges.emplace_back(kMinLon, lon_max - (kMaxLon - kMinLon));
+    }
+    else
+    {
+        lon_ranges.emplace_back(lon_min, lon_max);
+    }
+
+    blocks.clear();
+    for (const auto& lon_range: lon_ranges)
+    {
+        const GridBox box{
+            to_index(std::floor((lat_min - kMinLat) / lat_step)),
+            to_index(std::floor((lon_range.first - kMinLon) / lon_step)),
+            to_index(std::ceil((lat_max - kMinLat) / lat_step)),
+            to_index(std::ceil((lon_range.second - kMinLon) / lon_step))};
+        spatial_index_.find(box, blocks);
+    }
+    if (lon_ranges.size() > 1)
+    {
+        std::sort(blocks.begin(), blocks.end());
+        blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+    }
+}
+
+bool DwarfIdeaReader::findBlocksInBox(
+    const Point& min_corner, const Point& max_corner, std::vector<size_t>& blocks) const
+{
+    if (spatial_index_.empty())
+    {
+        return false;
+    }
+    // The box crosses the antimeridian if its western corner is east of the eastern one.
+    double lon_max = max_corner.lon;
+    if (min_corner.lon > max_corner.lon)
+    {
+        lon_max += kMaxLon - kMinLon;
+    }
+    findBlocksInArea(min_corner.lat, min_corner.lon, max_corner.lat, lon_max, blocks);
+    return true;
+}
+
+bool DwarfIdeaReader::findBlocksInRadius(const Point& center, double radius, std::vector<size_t>& blocks) const
+{
+    if (spatial_index_.empty())
+    {
+        return false;
+    }
+    // The bounding box of the circle: the longitude span grows towards the poles and
+    // covers all longitudes if the circle contains the pole.
+    const double dlat = radius / kEarthRadius * 180.0 / M_PI;
+    const double lat_min = center.lat - dlat, lat_max = center.lat + dlat;
+    double dlon = kMaxLon - kMinLon;
+    if (lat_min > kMinLat && lat_max < kMaxLat)
+    {
+        const double max_abs_lat = std::max(std::abs(lat_min), std::abs(lat_max));
+        dlon = std::min(dlon, dlat / std::cos(max_abs_lat * M_PI / 180.0));
+    }
+    findBlocksInArea(lat_min, center.lon - dlon, lat_max, center.lon + dlon, blocks);
+    return true;
+}
+
+bool DwarfIdeaReader::decodeEntries(
+    const std::vector<size_t>& blocks, const std::function<bool(const Point&)>& contains,
+    std::vector<AreaEntry>& entries) const
+{
+    entries.clear();
+    DecodedBlock block;
+    for (size_t block_index: blocks)
+    {
+        if (!decodeBlock(block_index, block))
+        {
+            return false;
+        }
+        for (size_t i = 0; i < block.size(); ++i)
+        {
+            const Point point = block.getPoint(i);
+            if (contains(point))
+            {
+                const uint8_t* extra_data = block.extra_data.data() + i * header_.extra_data_size;
+                entries.push_back(AreaEntry{
+                    block.keys[i], point, std::string(extra_data, extra_data + header_.extra_data_size)});
+            }
+        }
+    }
+    return true;
+}
+
+bool DwarfIdeaReader::findEntriesInBox(
+    const Point& min_corner, const Point& max_corner, std::vector<AreaEntry>& entries) const
+{
+    const bool crosses_antimeridian = min_corner.lon > max_corner.lon;
+    std::vector<size_t> blocks;
+    return findBlocksInBox(min_corner, max_corner, blocks) && decodeEntries(blocks, [&](const Point& point)
+    {
+        if (point.lat < min_corner.lat || point.lat > max_corner.lat)
+        {
+            return false;
+        }
+        return crosses_antimeridian ?
+            point.lon >= min_corner.lon || point.lon <= max_corner.lon :
+            point.lon >= min_corner.lon && point.lon <= max_corner.lon;
+    }, entries);
+}
+
+bool DwarfIdeaReader::findEntriesInRadius(const Point& center, double radius, std::vector<AreaEntry>& entries) const
+{
+    std::vector<size_t> blocks;
+    return findBlocksInRadius(center, radius, blocks) && decodeEntries(blocks, [&](const Point& point)
+    {
+        return getDist(center, point) <= radius;
+    }, entries);
+}
@@ -0,0 +1,253 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "compressed_block_index.h"
+#include "entropy_codecs.h"
+#include "eytzinger_index.h"
+#include "membership_filter.h"
+#include "spatial_block_index.h"
+#include "transforms.h"
+#include "utils.h"
+
+// Reader of the location DBs produced by 'DwarfIdeaBuilder'.
+//
+// The file is memory-mapped: only the header, the entropy coding tables and the
+// index are parsed by 'open', the blocks are decoded on demand. After 'open'
+// all const methods are safe to call concurrently.
+//
+// Keys passed to the lookup methods are the same as passed to the builder.
+// Internally they are mapped the same way the builder does it, e.g. for cells
+// MCC + MNC are replaced with the index in the MCC / MNC table, and are
+// represented as big-endian integers.
+
+struct DwarfIdeaHeader
+{
+    uint16_t version;
+    uint32_t format_flags;
+    TransformChain transform_chain;
+    uint16_t key_size, extra_data_size;
+    uint64_t num_entries, num_blocks;
+    uint16_t min_entries_per_block, max_entries_per_block;
+    uint16_t bounding_box_bits;
+    float max_dist_error;
+};
+
+// All entries of the single block ordered by key, stored column-wise.
+struct DecodedBlock
+{
+    std::vector<uint64_t> keys;
+    std::vector<float> lats, lons;
+    // 'extra_data_size' bytes per entry.
+    Bytes extra_data;
+
+    size_t size() const { return keys.size(); }
+
+    Point getPoint(size_t index) const { return Point(lats[index], lons[index]); }
+
+    // Finds the entry with the given mapped key, returns false if there's none.
+    bool findEntry(uint64_t mapped_key, size_t& index) const;
+
+    // Approximate memory used by the block, in bytes.
+    size_t getMemoryUsage() const;
+};
+
+// Entropy coding table of the stream as stored in the file.
+struct EntropyTable
+{
+    EntropyCodecType codec_type = EntropyCodecType::kFse;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+};
+
+// Entry found by the area queries.
+struct AreaEntry
+{
+    uint64_t mapped_key;
+    Point point;
+    std::string extra_data;
+};
+
+struct LookupResult
+{
+    bool found = false;
+    Point point;
+    std::string extra_data;
+};
+
+class DwarfIdeaReader
+{
+  public:
+    DwarfIdeaReader();
+
+    ~DwarfIdeaReader();
+
+    DwarfIdeaReader(const DwarfIdeaReader&) = delete;
+    DwarfIdeaReader& operator=(const DwarfIdeaReader&) = delete;
+
+    // Maps the file and parses its header, returns false if the file cannot be
+    // read or is not a supported DwarfIdea file.
+    bool open(const std::string& path);
+
+    void close();
+
+    const DwarfIdeaHeader& getHeader() const { return header_; }
+
+    // MCC / MNC pairs as (mcc << 16) | mnc, empty for DBs other than cells.
+    const std::vector<uint32_t>& getMccsMncs() const { return mccs_mncs_; }
+
+    // OUIs of BSSIDs in ascending order, empty unless the DB uses kFormatFlagOuiIndex.
+    const std::vector<uint32_t>& getOuis() const { return ouis_; }
+
+    size_t getNumBlocks() const { return header_.num_blocks; }
+
+    // The whole file as mapped by 'open'.
+    const uint8_t* getFileData() const { return data_; }
+    size_t getFileSize() const { return size_; }
+
+    // Offset of the first block, everything before it is the header, the entropy
+    // coding tables, the index and the membership filter.
+    size_t getBlocksOffset() const { return blocks_offset_; }
+
+    // Entropy coding tables of the streams, more than one only with kFormatFlagEntropyTables,
+    // empty if the stream has no tables, e.g. for kFormatFlagPackedCoords.
+    const std::vector<EntropyTable>& getKeysTables() const { return keys_tables_; }
+    const std::vector<EntropyTable>& getCoordsTables() const { return coords_tables_; }
+    const std::vector<EntropyTable>& getExtraDataTables() const { return extra_data_tables_; }
+
+    // Maps the key the same way the builder does, returns false if the key
+    // cannot be present in the DB, e.g. if its MCC / MNC is unknown.
+    bool mapKey(const std::string& key, uint64_t& mapped_key) const;
+
+    // The inverse of 'mapKey', returns false if the mapped key is not valid for the DB.
+    bool unmapKey(uint64_t mapped_key, std::string& key) const;
+
+    // Returns false if the mapped key is definitely not in the DB, which is
+    // determined without decoding any blocks if the DB has the membership filter.
+    bool mayContain(uint64_t mapped_key) const;
+
+    // Finds the only block that can contain the mapped key, returns false if
+    // the key is outside of the keys range of the DB.
+    bool findBlock(uint64_t mapped_key, size_t& block_index) const;
+
+    // Returns the first mapped key and the encoded bytes of the block as stored in
+    // the file, returns false if the block index is out of range or malformed.
+    bool getBlockData(size_t block_index, uint64_t& first_key, const uint8_t*& data, size_t& size) const;
+
+    // Decodes all entries of the block, returns false if the block is malformed.
+    bool decodeBlock(size_t block_index, DecodedBlock& block) const;
+
+    // Returns false if the key is not found. Only the parts of the block that
+    // are needed for the lookup are decoded.
+    bool lookup(const std::string& key, Point& point, std::string* extra_data = nullptr) const;
+
+    bool lookupMappedKey(uint64_t mapped_key, Point& point, std::string* extra_data = nullptr) const;
+
+    // Looks up 'num_keys' keys at once and stores the results in 'results', in the
+    // same order. Every block is decoded at most once, the blocks are processed
+    // using up to 'num_threads' threads.
+    void lookupBatch(const std::string* keys, size_t num_keys, LookupResult* results, int num_threads = 1) const;
+
+    bool hasSpatialIndex() const { return !spatial_index_.empty(); }
+
+    // Finds the blocks whose bounding boxes intersect the area between the corners or
+    // within 'radius' meters of 'center', the spatially close blocks come together.
+    // The box crosses the antimeridian if min_corner.lon is greater than max_corner.lon.
+    // Returns false if the DB has no spatial index, see kFormatFlagSpatialIndex.
+    bool findBlocksInBox(const Point& min_corner, const Point& max_corner, std::vector<size_t>& blocks) const;
+
+    bool findBlocksInRadius(const Point& center, double radius, std::vector<size_t>& blocks) const;
+
+    // Same as above, but decodes the found blocks and returns their entries within the area.
+    bool findEntriesInBox(const Point& min_corner, const Point& max_corner, std::vector<AreaEntry>& entries) const;
+
+    bool findEntriesInRadius(const Point& center, double radius, std::vector<AreaEntry>& entries) const;
+
+  private:
+    // One per entropy coding table of the stream.
+    typedef std::vector<std::unique_ptr<IEntropyCodec>> Codecs;
+
+    // The stream of the block as stored in the file, see 'StreamFlags'.
+    struct Stream
+    {
+        const uint8_t* data;
+        size_t size;
+        uint8_t flags;
+    };
+
+    struct BlockStreams
+    {
+        // The first key of the block is stored in the index.
+        uint64_t first_key;
+        Stream keys, coords, extra_data;
+    };
+
+    const uint8_t* data_;
+    size_t size_;
+    DwarfIdeaHeader header_;
+    int mapped_key_size_;
+    uint64_t last_key_;
+    std::vector<uint32_t> mccs_mncs_;
+    std::unordered_map<uint32_t, uint16_t> mccs_mncs_map_;
+    std::vector<uint32_t> ouis_;
+    Codecs keys_codecs_, coords_codecs_, extra_data_codecs_;
+    std::vector<EntropyTable> keys_tables_, coords_tables_, extra_data_tables_;
+    std::vector<uint64_t> index_keys_;
+    std::vector<uint64_t> index_offsets_;
+    // Used instead of 'index_keys_' and 'index_offsets_' if the index is compressed,
+    // its offsets are relative to 'blocks_offset_'.
+    CompressedBlockIndex compressed_index_;
+    size_t blocks_offset_;
+    EytzingerIndex eytzinger_index_;
+    MembershipFilter membership_filter_;
+    SpatialBlockIndex spatial_index_;
+    size_t max_keys_size_, max_coords_size_, max_extra_data_size_;
+
+    bool parse();
+
+    // Returns the first key and the [begin, end) byte range of the block.
+    bool getBlockRange(size_t block_index, uint64_t& first_key, size_t& begin, size_t& end) const;
+
+    bool readBlockStreams(size_t block_index, BlockStreams& streams) const;
+
+    bool decodeStream(const Stream& stream, const Codecs& codecs, size_t max_size, Bytes& output) const;
+
+    bool decodeKeys(uint64_t first_key, const Stream& stream, std::vector<uint64_t>& keys) const;
+
+    // Decodes the keys split at 'shift', see kFormatFlagSplitKeys.
+    bool decodeSplitKeys(int shift, const uint8_t* data, const uint8_t* end, std::vector<uint64_t>& keys) const;
+
+    bool isPacked() const;
+
+    // Finds the blocks intersecting the area, 'lon_min' and 'lon_max' may be outside of
+    // [-180, 180] if the area crosses the antimeridian.
+    void findBlocksInArea(double lat_min, double lon_min, double lat_max, double lon_max,
+                          std::vector<size_t>& blocks) const;
+
+    bool decodeEntries(const std::vector<size_t>& blocks, const std::function<bool(const Point&)>& contains,
+                       std::vector<AreaEntry>& entries) const;
+};
@@ -0,0 +1,67 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "entropy_codecs.h"
+
+#include <glog/logging.h>
+
+#include "fse_codec.h"
+#include "huffman_codec.h"
+#include "rans_codec.h"
+
+std::unique_ptr<IEntropyCodec> createEntropyCodec(EntropyCodecType type)
+{
+    switch (type)
+    {
+        case EntropyCodecType::kFse:
+            return std::unique_ptr<IEntropyCodec>(new FseCodec());
+        case EntropyCodecType::kHuffman:
+            return std::unique_ptr<IEntropyCodec>(new HuffmanCodec());
+        case EntropyCodecType::kRans:
+            return std::unique_ptr<IEntropyCodec>(new RansCodec());
+    }
+    return nullptr;
+}
+
+EntropyCodecType parseEntropyCodecType(const std::string& name)
+{
+    for (EntropyCodecType type: kAllEntropyCodecTypes)
+    {
+        if (name == getEntropyCodecName(type))
+        {
+            return type;
+        }
+    }
+    LOG(FATAL) << "Unknown entropy codec " << name;
+    return EntropyCodecType::kFse;
+}
+
+const char* getEntropyCodecName(EntropyCodecType type)
+{
+    switch (type)
+    {
+        case EntropyCodecType::kFse:
+            return "fse";
+        case EntropyCodecType::kHuffman:
+            return "huffman";
+        case EntropyCodecType::kRans:
+            return "rans";
+    }
+    return "unknown";
+}
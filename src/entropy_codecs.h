@@ -0,0 +1,47 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "ientropy_codec.h"
+
+// Entropy codecs, the values are stored in the header of the files that use
+// kFormatFlagEntropyCodecs so must not be changed.
+enum class EntropyCodecType: uint8_t
+{
+    kFse = 0,
+    kHuffman = 1,
+    kRans = 2,
+};
+
+constexpr EntropyCodecType kAllEntropyCodecTypes[] =
+{
+    EntropyCodecType::kFse,
+    EntropyCodecType::kHuffman,
+    EntropyCodecType::kRans,
+};
+
+std::unique_ptr<IEntropyCodec> createEntropyCodec(EntropyCodecType type);
+
+EntropyCodecType parseEntropyCodecType(const std::string& name);
+
+const char* getEntropyCodecName(EntropyCodecType type);
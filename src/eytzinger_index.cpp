@@ -0,0 +1,114 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "eytzinger_index.h"
+
+namespace {
+
+// The serialized index can be used in place only on little-endian platforms.
+constexpr bool kLittleEndian = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+
+// Fills the tree positions in-order with the sorted keys.
+void fillEytzinger(
+    const std::vector<uint64_t>& sorted_keys, size_t position, size_t& sorted_index,
+    std::vector<uint64_t>& keys, std::vector<uint32_t>& indices)
+{
+    if (position < keys.size())
+    {
+        fillEytzinger(sorted_keys, 2 * position, sorted_index, keys, indices);
+        keys[position] = sorted_keys[sorted_index];
+        indices[position] = sorted_index++;
+        fillEytzinger(sorted_keys, 2 * position + 1, sorted_index, keys, indices);
+    }
+}
+
+}
+
+Bytes buildEytzingerIndex(const std::vector<uint64_t>& sorted_keys)
+{
+    std::vector<uint64_t> keys(sorted_keys.size() + 1, 0);
+    std::vector<uint32_t> indices(sorted_keys.size() + 1, 0);
+    size_t sorted_index = 0;
+    fillEytzinger(sorted_keys, 1, sorted_index, keys, indices);
+
+    Bytes output;
+    output.reserve(getEytzingerIndexSize(sorted_keys.size()));
+    for (uint64_t key: keys)
+    {
+        appendBytes(asBytes(key), output);
+    }
+    for (uint32_t index: indices)
+    {
+        appendBytes(asBytes(index), output);
+    }
+    return output;
+}
+
+size_t getEytzingerIndexSize(size_t num_keys)
+{
+    return (num_keys + 1) * (sizeof(uint64_t) + sizeof(uint32_t));
+}
+
+EytzingerIndex::EytzingerIndex():
+    keys_(nullptr),
+    indices_(nullptr),
+    num_keys_(0)
+{
+}
+
+bool EytzingerIndex::reset(const uint8_t* data, size_t size, size_t num_keys)
+{
+    num_keys_ = 0;
+    if (!kLittleEndian || size < getEytzingerIndexSize(num_keys) || uintptr_t(data) % alignof(uint64_t))
+    {
+        return false;
+    }
+    keys_ = (const uint64_t*)data;
+    indices_ = (const uint32_t*)(data + (num_keys + 1) * sizeof(uint64_t));
+    for (size_t position = 1; position <= num_keys; ++position)
+    {
+        if (indices_[position] >= num_keys)
+        {
+            return false;
+        }
+    }
+    num_keys_ = num_keys;
+    return true;
+}
+
+size_t EytzingerIndex::findLastNotGreater(uint64_t key) const
+{
+    // Descend to the leaf, going right whenever the key at the current position
+    // is not greater than the searched one. Four levels below the current position
+    // are 16 consecutive keys, i.e. two cache lines, prefetch them in advance.
+    size_t position = 1;
+    while (position <= num_keys_)
+    {
+        __builtin_prefetch(keys_ + 16 * position);
+        position = 2 * position + (keys_[position] <= key);
+    }
+    // Undo the trailing right turns + the last left turn, which leaves the position
+    // of the first key greater than the searched one, or 0 if there's none.
+    position >>= __builtin_ffsll(~position);
+    if (!position)
+    {
+        return num_keys_ ? num_keys_ - 1 : kNotFound;
+    }
+    return indices_[position] ? indices_[position] - 1 : kNotFound;
+}
@@ -0,0 +1,70 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "utils.h"
+
+// Block index laid out in Eytzinger (breadth-first) order: the root of the implicit
+// binary search tree is at position 1 and the children of position k are at 2k and
+// 2k + 1. The top levels of the tree share a few cache lines and the search touches
+// the memory in a predictable pattern that can be prefetched, so unlike the binary
+// search over the sorted array it doesn't miss the cache at nearly every step.
+//
+// Serialized layout: (num_keys + 1) little-endian u64 keys followed by (num_keys + 1)
+// little-endian u32 indices of the keys in the sorted order, position 0 is unused.
+
+// Returns the serialized index for the sorted keys.
+Bytes buildEytzingerIndex(const std::vector<uint64_t>& sorted_keys);
+
+// Returns the size of the serialized index for the given number of keys.
+size_t getEytzingerIndexSize(size_t num_keys);
+
+class EytzingerIndex
+{
+  public:
+    static constexpr size_t kNotFound = size_t(-1);
+
+    EytzingerIndex();
+
+    // Uses the serialized index in place, 'data' must be 8-bytes aligned and must
+    // outlive the index. Returns false if the data is malformed or cannot be used
+    // in place on this platform.
+    bool reset(const uint8_t* data, size_t size, size_t num_keys);
+
+    bool empty() const { return !num_keys_; }
+
+    // Returns the key at the given position of the tree, 1 <= position <= num_keys.
+    uint64_t getKey(size_t position) const { return keys_[position]; }
+
+    // Returns the sorted index of the key at the given position of the tree.
+    size_t getSortedIndex(size_t position) const { return indices_[position]; }
+
+    // Returns the sorted index of the last key <= 'key' or kNotFound if there's none.
+    size_t findLastNotGreater(uint64_t key) const;
+
+  private:
+    const uint64_t* keys_;
+    const uint32_t* indices_;
+    size_t num_keys_;
+};
@@ -0,0 +1,204 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "freqs_clustering.h"
+
+#include <cmath>
+#include <limits>
+
+namespace {
+
+const size_t kNumSymbols = 256;
+// Max number of k-means iterations after adding every seed, usually it converges much earlier.
+const size_t kMaxIterations = 20;
+
+// Returns the code length of every symbol in bits, infinity for the absent ones.
+std::vector<double> getCodeLengths(const std::vector<unsigned>& freqs, size_t total_size)
+{
+    std::vector<double> lengths(kNumSymbols, std::numeric_limits<double>::infinity());
+    for (size_t i = 0; i < kNumSymbols; ++i)
+    {
+        if (freqs[i])
+        {
+            lengths[i] = -std::log2(double(freqs[i]) / total_size);
+        }
+    }
+    return lengths;
+}
+
+double getCodedBits(const SparseFreqs& freqs, size_t size, const std::vector<double>& lengths)
+{
+    double bits = 0.0;
+    for (const auto& freq: freqs)
+    {
+        bits += freq.second * lengths[freq.first];
+    }
+    // Blocks that can't be entropy coded are stored as is.
+    return std::min(bits, 8.0 * size);
+}
+
+}
+
+SparseFreqs getSparseFreqs(const uint8_t* data, size_t size)
+{
+    std::vector<unsigned> freqs(kNumSymbols, 0);
+    for (size_t i = 0; i < size; ++i)
+    {
+        ++freqs[data[i]];
+    }
+    SparseFreqs sparse_freqs;
+    for (size_t i = 0; i < kNumSymbols; ++i)
+    {
+        if (freqs[i])
+        {
+            sparse_freqs.emplace_back(uint8_t(i), freqs[i]);
+        }
+    }
+    return sparse_freqs;
+}
+
+FreqsClusters clusterFreqs(
+    const std::vector<SparseFreqs>& block_freqs, size_t max_clusters, const GetClustersSize& get_size)
+{
+    const size_t num_blocks = block_freqs.size();
+    std::vector<size_t> block_sizes(num_blocks, 0);
+    std::vector<double> own_bits(num_blocks, 0.0);
+    for (size_t i = 0; i < num_blocks; ++i)
+    {
+        for (const auto& freq: block_freqs[i])
+        {
+            block_sizes[i] += freq.second;
+        }
+        for (const auto& freq: block_freqs[i])
+        {
+            own_bits[i] -= freq.second * std::log2(double(freq.second) / block_sizes[i]);
+        }
+    }
+
+    FreqsClusters clusters;
+    std::vector<size_t>& assignment = clusters.assignment;
+    assignment.assign(num_blocks, 0);
+    std::vector<double> block_bits(num_blocks, 0.0);
+
+    // Sums the frequencies of the blocks of every cluster and drops the empty ones.
+    auto update_clusters = [&](size_t num_clusters)
+    {
+        std::vector<std::vector<unsigned>> freqs(num_clusters, std::vector<unsigned>(kNumSymbols, 0));
+        std::vector<size_t> total_sizes(num_clusters, 0);
+        for (size_t i = 0; i < num_blocks; ++i)
+        {
+            for (const auto& freq: block_freqs[i])
+            {
+                freqs[assignment[i]][freq.first] += freq.second;
+            }
+            total_sizes[assignment[i]] += block_sizes[i];
+        }
+        std::vector<size_t> new_indices(num_clusters, 0);
+        clusters.freqs.clear();
+        clusters.total_sizes.clear();
+        for (size_t i = 0; i < num_clusters; ++i)
+        {
+            if (total_sizes[i])
+            {
+                new_indices[i] = clusters.freqs.size();
+                clusters.freqs.push_back(std::move(freqs[i]));
+                clusters.total_sizes.push_back(total_sizes[i]);
+            }
+        }
+        for (size_t& cluster: assignment)
+        {
+            cluster = new_indices[cluster];
+        }
+    };
+
+    // Moves every block to the cluster that codes it best, returns true if any block moved.
+    auto assign_blocks = [&]()
+    {
+        std::vector<std::vector<double>> lengths;
+        for (size_t i = 0; i < clusters.freqs.size(); ++i)
+        {
+            lengths.push_back(getCodeLengths(clusters.freqs[i], clusters.total_sizes[i]));
+        }
+        bool changed = false;
+#pragma omp parallel for schedule(static) reduction(||: changed)
+        for (size_t i = 0; i < num_blocks; ++i)
+        {
+            size_t best_cluster = assignment[i];
+            double best_bits = getCodedBits(block_freqs[i], block_sizes[i], lengths[best_cluster]);
+            for (size_t j = 0; j < lengths.size(); ++j)
+            {
+                const double bits = getCodedBits(block_freqs[i], block_sizes[i], lengths[j]);
+                if (bits < best_bits)
+                {
+                    best_cluster = j;
+                    best_bits = bits;
+                }
+            }
+            changed = changed || best_cluster != assignment[i];
+            assignment[i] = best_cluster;
+            block_bits[i] = best_bits;
+        }
+        return changed;
+    };
+
+    update_clusters(1);
+    assign_blocks();
+    FreqsClusters best_clusters = clusters;
+    double best_size = get_size(clusters);
+
+    while (clusters.freqs.size() < max_clusters)
+    {
+        size_t seed = 0;
+        double max_gain = 0.0;
+        for (size_t i = 0; i < num_blocks; ++i)
+        {
+            if (block_bits[i] - own_bits[i] > max_gain)
+            {
+                max_gain = block_bits[i] - own_bits[i];
+                seed = i;
+            }
+        }
+        if (max_gain <= 0.0)
+        {
+            break;
+        }
+
+        const size_t num_clusters = clusters.freqs.size();
+        assignment[seed] = num_clusters;
+        update_clusters(num_clusters + 1);
+        for (size_t iteration = 0; assign_blocks() && iteration < kMaxIterations; ++iteration)
+        {
+            update_clusters(clusters.freqs.size());
+        }
+        // The tables are built from the final assignment.
+        update_clusters(clusters.freqs.size());
+        if (clusters.freqs.size() <= num_clusters)
+        {
+            break;
+        }
+
+        const double size = get_size(clusters);
+        if (size < best_size)
+        {
+            best_clusters = clusters;
+            best_size = size;
+        }
+    }
+    return best_clusters;
+}
@@ -0,0 +1,61 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+// Clustering of the blocks by their symbols statistics, so that every stream can
+// use several entropy coding tables, see kFormatFlagEntropyTables.
+//
+// The distance between the block and the cluster is the estimated order 0 coded
+// size of the block with the symbols probabilities of the cluster, or its raw size
+// if the cluster lacks some of the block symbols, as such blocks are stored without
+// entropy coding. The clusters are seeded one by one with the block that gains the
+// most from its own table, and refined with k-means after adding every seed. The
+// estimate ignores the per block overhead of the entropy codecs, which dominates
+// for small blocks, so the number of clusters is selected by the caller-provided
+// size of the whole stream instead.
+
+// Frequencies of the symbols present in the block.
+typedef std::vector<std::pair<uint8_t, unsigned>> SparseFreqs;
+
+SparseFreqs getSparseFreqs(const uint8_t* data, size_t size);
+
+struct FreqsClusters
+{
+    // Summed frequencies of the blocks of every cluster, 256 per cluster.
+    std::vector<std::vector<unsigned>> freqs;
+    // The total number of symbols in every cluster.
+    std::vector<size_t> total_sizes;
+    // The cluster of every block.
+    std::vector<size_t> assignment;
+};
+
+// Returns the size of the stream coded with the tables built from the clusters.
+typedef std::function<double(const FreqsClusters&)> GetClustersSize;
+
+// Returns the clusters with the smallest size out of the ones found for every number of
+// clusters up to 'max_clusters'.
+FreqsClusters clusterFreqs(
+    const std::vector<SparseFreqs>& block_freqs, size_t max_clusters, const GetClustersSize& get_size);
@@ -0,0 +1,127 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "fse_codec.h"
+
+#include <algorithm>
+
+#include <glog/logging.h>
+
+namespace {
+
+const unsigned kMaxSymbolValue = 255;
+
+}
+
+Bytes FseCodec::buildTable(const std::vector<unsigned>& freqs, size_t total_size)
+{
+    // FSE cannot build the table for less than two symbols, e.g. for a blocks
+    // cluster with constant data, make sure there are at least two of them.
+    std::vector<unsigned> counts(freqs);
+    size_t num_symbols = std::count_if(counts.begin(), counts.end(), [](unsigned count) { return count > 0; });
+    for (size_t i = 0; num_symbols < 2; ++i)
+    {
+        if (!counts[i])
+        {
+            counts[i] = 1;
+            ++num_symbols;
+            ++total_size;
+        }
+    }
+
+    freqs_normalized_.assign(kMaxSymbolValue + 1, 0);
+    unsigned table_log = FSE_optimalTableLog(0, total_size, kMaxSymbolValue);
+    FSE_normalizeCount(
+        &freqs_normalized_[0], table_log, &counts[0], total_size, kMaxSymbolValue);
+    ctable_.reset(FSE_createCTable(kMaxSymbolValue, table_log));
+    FSE_buildCTable(ctable_.get(), &freqs_normalized_[0], kMaxSymbolValue, table_log);
+    Bytes buffer(FSE_NCountWriteBound(kMaxSymbolValue, table_log), 0);
+    size_t header_size = FSE_writeNCount(
+        (void*)buffer.data(), buffer.size(), &freqs_normalized_[0],
+	kMaxSymbolValue, table_log);
+    CHECK(!FSE_isError(header_size)) << "Failed to write FSE table: " << FSE_getErrorName(header_size);
+    buffer.resize(header_size);
+    return buffer;
+}
+
+bool FseCodec::loadTable(const uint8_t* data, size_t size)
+{
+    std::vector<short> freqs_normalized(kMaxSymbolValue + 1, 0);
+    unsigned max_symbol_value = kMaxSymbolValue, table_log = 0;
+    size_t header_size = FSE_readNCount(
+        &freqs_normalized[0], &max_symbol_value, &table_log, data, size);
+    if (FSE_isError(header_size))
+    {
+        return false;
+    }
+    dtable_.reset(FSE_createDTable(table_log));
+    return !FSE_isError(FSE_buildDTable(dtable_.get(), &freqs_normalized[0], max_symbol_value, table_log));
+}
+
+bool FseCodec::loadCompressionTable(const uint8_t* data, size_t size)
+{
+    std::vector<short> freqs_normalized(kMaxSymbolValue + 1, 0);
+    unsigned max_symbol_value = kMaxSymbolValue, table_log = 0;
+    size_t header_size = FSE_readNCount(
+        &freqs_normalized[0], &max_symbol_value, &table_log, data, size);
+    if (FSE_isError(header_size))
+    {
+        return false;
+    }
+    ctable_.reset(FSE_createCTable(max_symbol_value, table_log));
+    if (FSE_isError(FSE_buildCTable(ctable_.get(), &freqs_normalized[0], max_symbol_value, table_log)))
+    {
+        return false;
+    }
+    freqs_normalized_.swap(freqs_normalized);
+    return true;
+}
+
+Bytes FseCodec::compress(const uint8_t* data, size_t size) const
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        if (!freqs_normalized_[data[i]])
+        {
+            return Bytes();
+        }
+    }
+    Bytes output(FSE_compressBound(size), 0);
+    size_t dst_size = FSE_compress_usingCTable(
+        (void*)output.data(), output.size(), data, size, ctable_.get());
+    if (!dst_size || FSE_isError(dst_size))
+    {
+        return Bytes();
+    }
+    output.resize(dst_size);
+    return output;
+}
+
+bool FseCodec::decompress(const uint8_t* data, size_t size, size_t max_size, Bytes& output) const
+{
+    output.resize(max_size);
+    size_t dst_size = FSE_decompress_usingDTable(
+        (void*)output.data(), output.size(), data, size, dtable_.get());
+    if (FSE_isError(dst_size))
+    {
+        return false;
+    }
+    output.resize(dst_size);
+    return true;
+}
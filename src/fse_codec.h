@@ -0,0 +1,62 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <fse.h>
+
+#include "ientropy_codec.h"
+
+// FSE (tANS) entropy codec, see https://github.com/Cyan4973/FiniteStateEntropy.
+//
+// This is the codec used by the original format, so the serialized table
+// is just the FSE normalized counts.
+class FseCodec: public IEntropyCodec
+{
+  public:
+    Bytes buildTable(const std::vector<unsigned>& freqs, size_t total_size) override;
+
+    bool loadTable(const uint8_t* data, size_t size) override;
+
+    bool loadCompressionTable(const uint8_t* data, size_t size) override;
+
+    Bytes compress(const uint8_t* data, size_t size) const override;
+
+    bool decompress(const uint8_t* data, size_t size, size_t max_size, Bytes& output) const override;
+
+  private:
+    struct CTableDeleter
+    {
+        void operator() (FSE_CTable* table) { FSE_freeCTable(table); }
+    };
+
+    struct DTableDeleter
+    {
+        void operator() (FSE_DTable* table) { FSE_freeDTable(table); }
+    };
+
+    std::unique_ptr<FSE_CTable, CTableDeleter> ctable_;
+    std::unique_ptr<FSE_DTable, DTableDeleter> dtable_;
+    // The counts of the compression table: FSE doesn't detect the symbols absent
+    // from the table, so the data is checked against it before compressing.
+    std::vector<short> freqs_normalized_;
+};
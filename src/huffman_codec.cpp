@@ -0,0 +1,175 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "huffman_codec.h"
+
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#define HUF_STATIC_LINKING_ONLY
+#include <huf.h>
+
+namespace {
+
+const unsigned kMaxSymbolValue = 255;
+// Big enough for any table with kMaxSymbolValue symbols.
+const size_t kMaxTableSize = 512;
+// Enough to shorten the code of the most frequent symbol, see 'buildTable'.
+const int kMaxWriteAttempts = 8;
+
+}
+
+Bytes HuffmanCodec::buildTable(const std::vector<unsigned>& freqs, size_t total_size)
+{
+    // HUF cannot build the tree for less than two symbols, make sure there are at least two of them.
+    std::vector<unsigned> counts(freqs);
+    size_t num_symbols = std::count_if(counts.begin(), counts.end(), [](unsigned count) { return count > 0; });
+    for (size_t i = 0; num_symbols < 2; ++i)
+    {
+        if (!counts[i])
+        {
+            counts[i] = 1;
+            ++num_symbols;
+        }
+    }
+
+    unsigned max_symbol_value = kMaxSymbolValue;
+    while (max_symbol_value > 0 && !counts[max_symbol_value])
+    {
+        --max_symbol_value;
+    }
+
+    encodable_.assign(kMaxSymbolValue + 1, false);
+    for (size_t i = 0; i < counts.size(); ++i)
+    {
+        encodable_[i] = counts[i] > 0;
+    }
+
+    // HUF can store the weights of more than 128 symbols only if they are compressible,
+    // which fails when all symbols get the same code length, e.g. for the almost uniform
+    // distributions. Favor the most frequent symbol then, this costs next to nothing.
+    const size_t max_count_index = std::max_element(counts.begin(), counts.end()) - counts.begin();
+    for (int attempt = 0; ; ++attempt)
+    {
+        ctable_.assign(HUF_CTABLE_SIZE_U32(kMaxSymbolValue), 0);
+        size_t huff_log = HUF_buildCTable(
+            (HUF_CElt*)ctable_.data(), &counts[0], max_symbol_value, HUF_TABLELOG_DEFAULT);
+        CHECK(!HUF_isError(huff_log)) << "Failed to build Huffman table: " << HUF_getErrorName(huff_log);
+
+        Bytes buffer(kMaxTableSize, 0);
+        size_t header_size = HUF_writeCTable(
+            (void*)buffer.data(), buffer.size(), (const HUF_CElt*)ctable_.data(), max_symbol_value, huff_log);
+        if (!HUF_isError(header_size))
+        {
+            buffer.resize(header_size);
+            return buffer;
+        }
+        CHECK(attempt < kMaxWriteAttempts) << "Failed to write Huffman table: " << HUF_getErrorName(header_size);
+        counts[max_count_index] *= 2;
+    }
+}
+
+bool HuffmanCodec::loadTable(const uint8_t* data, size_t size)
+{
+    dtable_.assign(HUF_DTABLE_SIZE(HUF_TABLELOG_MAX), 0);
+    // Same initialization as performed by HUF_CREATE_STATIC_DTABLEX1.
+    dtable_[0] = (uint32_t)(HUF_TABLELOG_MAX - 1) * 0x01000001;
+    return !HUF_isError(HUF_readDTableX1((HUF_DTable*)dtable_.data(), data, size));
+}
+
+bool HuffmanCodec::loadCompressionTable(const uint8_t* data, size_t size)
+{
+    // HUF API only allows reading the decompression table, so rebuild the compression
+    // one from the stored weights: the symbol with weight W has the code of
+    // table log + 1 - W bits, which is exactly what the Huffman coding gives for the
+    // counts proportional to 2 ^ (W - 1).
+    std::vector<uint8_t> weights(HUF_SYMBOLVALUE_MAX + 1, 0);
+    std::vector<uint32_t> rank_stats(HUF_TABLELOG_MAX + 1, 0);
+    uint32_t num_symbols = 0, table_log = 0;
+    size_t header_size = HUF_readStats(
+        &weights[0], weights.size(), &rank_stats[0], &num_symbols, &table_log, data, size);
+    if (HUF_isError(header_size) || header_size != size ||
+        num_symbols < 2 || num_symbols > kMaxSymbolValue + 1)
+    {
+        return false;
+    }
+    std::vector<unsigned> counts(num_symbols, 0);
+    for (size_t i = 0; i < num_symbols; ++i)
+    {
+        counts[i] = weights[i] ? 1u << (weights[i] - 1) : 0;
+    }
+
+    ctable_.assign(HUF_CTABLE_SIZE_U32(kMaxSymbolValue), 0);
+    size_t huff_log = HUF_buildCTable((HUF_CElt*)ctable_.data(), &counts[0], num_symbols - 1, table_log);
+    if (HUF_isError(huff_log))
+    {
+        return false;
+    }
+    // Make sure the code lengths are indeed the same as in the stored table.
+    Bytes buffer(kMaxTableSize, 0);
+    size_t table_size = HUF_writeCTable(
+        (void*)buffer.data(), buffer.size(), (const HUF_CElt*)ctable_.data(), num_symbols - 1, huff_log);
+    if (HUF_isError(table_size) || table_size != size || !std::equal(data, data + size, buffer.begin()))
+    {
+        return false;
+    }
+    encodable_.assign(kMaxSymbolValue + 1, false);
+    for (size_t i = 0; i < num_symbols; ++i)
+    {
+        encodable_[i] = weights[i] > 0;
+    }
+    return true;
+}
+
+Bytes HuffmanCodec::compress(const uint8_t* data, size_t size) const
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        if (!encodable_[data[i]])
+        {
+            return Bytes();
+        }
+    }
+    // Huffman bitstream doesn't mark its end, so store the original size first.
+    Bytes output = asVarInt(size);
+    size_t size_bytes = output.size();
+    output.resize(size_bytes + HUF_compressBound(size));
+    size_t dst_size = HUF_compress1X_usingCTable(
+        (void*)&output[size_bytes], output.size() - size_bytes, data, size, (const HUF_CElt*)ctable_.data());
+    if (!dst_size || HUF_isError(dst_size))
+    {
+        return Bytes();
+    }
+    output.resize(size_bytes + dst_size);
+    return output;
+}
+
+bool HuffmanCodec::decompress(const uint8_t* data, size_t size, size_t max_size, Bytes& output) const
+{
+    const uint8_t* end = data + size;
+    size_t dst_size = 0;
+    if (!readVarInt(data, end, dst_size) || dst_size > max_size)
+    {
+        return false;
+    }
+    output.resize(dst_size);
+    return !HUF_isError(HUF_decompress1X1_usingDTable(
+        (void*)output.data(), output.size(), data, end - data, (const HUF_DTable*)dtable_.data()));
+}
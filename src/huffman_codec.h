@@ -0,0 +1,48 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <vector>
+
+#include "ientropy_codec.h"
+
+// Static Huffman entropy codec, uses HUF implementation from FSE library.
+//
+// Slightly worse compression than FSE, but faster decoding.
+class HuffmanCodec: public IEntropyCodec
+{
+  public:
+    Bytes buildTable(const std::vector<unsigned>& freqs, size_t total_size) override;
+
+    bool loadTable(const uint8_t* data, size_t size) override;
+
+    bool loadCompressionTable(const uint8_t* data, size_t size) override;
+
+    Bytes compress(const uint8_t* data, size_t size) const override;
+
+    bool decompress(const uint8_t* data, size_t size, size_t max_size, Bytes& output) const override;
+
+  private:
+    // The symbols of the compression table: HUF encodes the absent symbols with
+    // zero bits, so the data is checked against them before compressing.
+    std::vector<bool> encodable_;
+    std::vector<uint32_t> ctable_;
+    std::vector<uint32_t> dtable_;
+};
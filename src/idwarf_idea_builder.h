@@ -24,7 +24,8 @@
 // The interface for actual location DB construction.
 //
 // 'addLocation' will be called exactly once per each key and once
-// all entries are added - 'build' method will be called.
+// all entries are added - 'build' method will be called, optionally
+// followed by 'verify'.
 class IDwarfIdeaBuilder
 {
   public:
@@ -35,4 +36,8 @@ class IDwarfIdeaBuilder
 
     // Constructs the actual DB.
     virtual void build(std::ostream& os) = 0;
+
+    // Reads the DB written by 'build' back from 'path' and checks it matches
+    // the added entries.
+    virtual void verify(const std::string& path) const = 0;
 };
@@ -0,0 +1,56 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <vector>
+
+#include "utils.h"
+
+// The interface for entropy coding of the transformed block streams.
+//
+// On the builder side 'buildTable' is called once with the symbols statistics
+// gathered over the whole dataset and then 'compress' is called for every block,
+// potentially concurrently. On the reader side 'loadTable' is called with the data
+// produced by 'buildTable' and then 'decompress' is called for every block.
+class IEntropyCodec
+{
+  public:
+    virtual ~IEntropyCodec() {}
+
+    // Builds the coding table from the symbols frequencies and returns its serialized form.
+    virtual Bytes buildTable(const std::vector<unsigned>& freqs, size_t total_size) = 0;
+
+    // Loads the coding table serialized by 'buildTable', returns false on failure.
+    virtual bool loadTable(const uint8_t* data, size_t size) = 0;
+
+    // Same as 'loadTable', but prepares the table for 'compress' instead of
+    // 'decompress', so that the blocks are compressed exactly as with the table
+    // of the previous build. Returns false on failure or if not supported.
+    virtual bool loadCompressionTable(const uint8_t* data, size_t size) = 0;
+
+    // Returns compressed data or empty bytes if the data cannot be compressed,
+    // including the data with the symbols absent from the table, e.g. when the
+    // table was built for other blocks.
+    virtual Bytes compress(const uint8_t* data, size_t size) const = 0;
+
+    // Decompresses the data into 'output', 'max_size' is the upper bound of the
+    // decompressed size. Returns false on failure.
+    virtual bool decompress(const uint8_t* data, size_t size, size_t max_size, Bytes& output) const = 0;
+};
@@ -20,6 +20,8 @@
 
 #include <cstddef>
 
+#include "parser_stats.h"
+
 class ILocationAggregator;
 
 // The interface for parsing the location data source.
@@ -38,4 +40,10 @@ class ILocationParser
     // 'addLocation' member function of 'aggregator' will be used to add all entries
     // that were successfully parsed.
     virtual void parse(const char* connection_spec, ILocationAggregator& aggregator) = 0;
+
+    // Accumulated over all parsed sources.
+    const ParserStats& getStats() const { return stats_; }
+
+  protected:
+    ParserStats stats_;
 };
@@ -24,14 +24,18 @@
 
 namespace {
 
-const int kMinRadius = 500;
-const int kRadiusStep = 100;
-const int kMaxRadius = 500 + kRadiusStep * 15;
-const int kMaxSamples = 15;
 const float kDistanceThreshold = 500.0f;
+// Number of keys per aggregation trace event.
+const size_t kTraceRangeSize = 65536;
 
 }
 
+template <int KeySize, int ExtraDataSize>
+LocationAggregator<KeySize, ExtraDataSize>::LocationAggregator(TraceRecorder* trace):
+    trace_(trace)
+{
+}
+
 template <int KeySize, int ExtraDataSize>
 void LocationAggregator<KeySize, ExtraDataSize>::addLocation(const Bytes& key_bytes, float lat, float lon, int radius, int samples)
 {
@@ -148,20 +152,31 @@ void LocationAggregator<KeySize, ExtraDataSize>::aggregate(IDwarfIdeaBuilder& bu
     // We assume either 0 or 1 byte extra data size below - check that's the case indeed.
     static_assert(ExtraDataSize == 0 || ExtraDataSize == 1, "Unsupported extra data size requested!");
 
+    size_t num_keys = 0;
+    int64_t range_start_time = trace_ ? trace_->now() : 0;
     for (auto it = entries_.begin(); it != entries_.end(); it = entries_.upper_bound(it->first))
     {
+        if (trace_ && num_keys && num_keys % kTraceRangeSize == 0)
+        {
+            const int64_t time = trace_->now();
+            trace_->addEvent("aggregate_range", "aggregate", range_start_time, time);
+            range_start_time = time;
+        }
+        ++num_keys;
+
         EntryDetails entry = averageData(it->first);
         std::string extra_data;
         if (ExtraDataSize)
         {
-            entry.radius = std::min(kMaxRadius, std::max(kMinRadius, entry.radius));
-            entry.samples = std::max(0, std::min(kMaxSamples, entry.samples));
-            uint8_t value = (entry.samples << 4) | ((entry.radius - kMinRadius) / kRadiusStep);
-            extra_data.append(1, static_cast<char>(value));
+            extra_data.append(1, static_cast<char>(packExtraData(entry.radius, entry.samples)));
         }
         std::string key(&it->first.data()[0], &it->first.data()[it->first.size()]);
         builder.addLocation(key, entry.point.lat, entry.point.lon, extra_data);
     }
+    if (trace_ && num_keys % kTraceRangeSize)
+    {
+        trace_->addEvent("aggregate_range", "aggregate", range_start_time, trace_->now());
+    }
 }
 
 template class LocationAggregator<kCellKeySize, kCellExtraDataSize>;
@@ -19,6 +19,7 @@
 #pragma once
 
 #include "ilocation_aggregator.h"
+#include "trace_recorder.h"
 #include "utils.h"
 
 #include <array>
@@ -28,6 +29,9 @@ template <int KeySize, int ExtraDataSize>
 class LocationAggregator: public ILocationAggregator
 {
   public:
+    // If 'trace' is set, the aggregation of every range of keys is recorded there.
+    explicit LocationAggregator(TraceRecorder* trace = nullptr);
+
     void addLocation(const Bytes& key, float lat, float lon, int radius, int samples) override;
 
     void aggregate(IDwarfIdeaBuilder& builder) override;
@@ -45,6 +49,7 @@ class LocationAggregator: public ILocationAggregator
     typedef std::array<uint8_t, KeySize> Key;
     typedef std::multimap<Key, EntryDetails> Entries;
     Entries entries_;
+    TraceRecorder* trace_;
 
     EntryDetails averageData(const typename Entries::key_type& key) const;
 };
@@ -18,6 +18,7 @@
 
 #include <archive.h>
 #include <fstream>
+#include <memory>
 
 #include <archive.h>
 #include <archive_entry.h>
@@ -28,9 +29,12 @@
 #include "cells_sqlite_parser.h"
 #include "bssids_csv_parser.h"
 #include "bssids_sqlite_parser.h"
+#include "bssids_dwarf_idea_builder.h"
 #include "cells_dwarf_idea_builder.h"
 #include "simple_dwarf_idea_builder.h"
 #include "location_aggregator.h"
+#include "stats_report.h"
+#include "trace_recorder.h"
 
 DEFINE_string(cells_files, "", "Comma-separated list of files used to extract cells IDs. Archived files are supported.");
 DEFINE_string(bssids_files, "", "Comma-separated list of files used to extract BSSIDs. Archived files are supported.");
@@ -39,14 +43,101 @@ DEFINE_double(max_dist_error, 50.0f, "Maximum distance error, in meters.");
 DEFINE_int32(min_entries_per_block, 64, "Min number of entries per block.");
 DEFINE_int32(max_entries_per_block, 256, "Max number of entries per block.");
 DEFINE_int32(bounding_box_bits, 16, "Number of bits per coordinate in bounding box.");
+DEFINE_string(coords_quantization, "joint", "Coordinates quantization: 'conservative' (original scheme), "
+    "'joint' (uses the whole error budget, compatible with the original format) or 'exact' (also "
+    "uses arbitrary number of steps, requires format version 2).");
+DEFINE_bool(check_coords_error, true, "Decode the coordinates of every entry and verify the max error.");
+DEFINE_string(keys_codec, "fse", "Entropy codec for keys: 'fse', 'huffman' or 'rans'. "
+    "Anything other than 'fse' requires format version 2.");
+DEFINE_string(coords_codec, "fse", "Entropy codec for coordinates, same values as for --keys_codec.");
+DEFINE_string(extra_data_codec, "fse", "Entropy codec for extra data, same values as for --keys_codec.");
+DEFINE_int32(entropy_tables, 1, "Max number of entropy coding tables per stream, up to 255. With more than one "
+    "the blocks are clustered by their symbols statistics and every block uses the table of its cluster. "
+    "Requires format version 2.");
+DEFINE_double(stats_sample_ratio, 1.0, "Fraction of the blocks, evenly spread over the keys, used to gather the "
+    "entropy coding statistics in the first encoding pass. Smaller values make the first pass proportionally "
+    "faster at the cost of slightly worse compression.");
+DEFINE_string(transform_chain, "bwts", "Transform chain applied before entropy coding: 'bwts' (BWTS + SBRT + ZRLT, "
+    "the best compression), 'delta' (delta + zigzag + ZRLT) or 'zrlt' (ZRLT only). "
+    "Anything other than 'bwts' requires format version 2.");
+DEFINE_bool(packed_coords, false, "Store coordinates and extra data without compression, so that the reader "
+    "can extract single entry without decoding the whole block. Requires format version 2.");
+DEFINE_bool(eytzinger_index, false, "Add the copy of the index in cache-friendly Eytzinger order for faster "
+    "block search. Requires format version 2.");
+DEFINE_bool(membership_filter, false, "Add the membership filter of all keys so that the lookups of absent keys "
+    "don't need to decode the blocks, at the cost of ~9 bits per key. Requires format version 2.");
+DEFINE_bool(wide_offsets, false, "Store 64 bits block offsets and numbers of entries / blocks, "
+    "needed for DBs larger than 4 GB. Requires format version 2.");
+DEFINE_bool(compressed_index, false, "Store the index as the sparse top level + delta-coded groups of blocks, "
+    "which is smaller and is used by the reader in place instead of being loaded. Can't be combined with "
+    "--eytzinger_index, requires format version 2.");
+DEFINE_bool(spatial_index, false, "Add the R-tree over the bounding boxes of all blocks, so that the reader can "
+    "find all blocks and entries within the area, requires format version 2.");
+DEFINE_bool(split_keys, false, "Code the parts of cell IDs (LTE eNB ID and sector, UMTS RNC ID and CID) as "
+    "separate deltas, which improves the compression of LTE cells. Doesn't affect BSSIDs DB, requires "
+    "format version 2.");
+DEFINE_bool(oui_index, false, "Replace the OUIs of BSSIDs with the index in the table of OUIs present in the "
+    "data, which saves 1 byte per block in the index and makes the keys deltas smaller. Requires format "
+    "version 2.");
+DEFINE_bool(entropy_codecs_report, false, "Compare compressed size and decoding time of all entropy codecs.");
+DEFINE_bool(transform_chains_report, false, "Compare compressed size and decoding time of all transform chains.");
+DEFINE_bool(verify_output, false, "Read the generated DB back and verify it matches the input.");
+DEFINE_string(stats_json, "", "If set, write wall / CPU time and peak RSS of the build phases, per input file "
+    "throughput and the counts of rejected rows to the given path as JSON.");
+DEFINE_string(trace_json, "", "If set, write the timeline of parsing, aggregation and per block encoding "
+    "work of every thread to the given path in Chrome trace event format.");
 DEFINE_string(cells_output_path, "", "If set, generate cells DB and output to the given path.");
 DEFINE_string(bssids_output_path, "", "If set, generate BSSIDs DB and output to the given path.");
 DEFINE_string(debug_cells_output_path, "", "If set, generate cells CSV output file.");
 DEFINE_string(debug_bssids_output_path, "", "If set, generate BSSIDs CSV output file.");
+DEFINE_string(cells_block_stats_path, "", "If set, write per block compression statistics of cells DB to the given "
+    "path and their summary histograms to '<path>.histograms'.");
+DEFINE_string(bssids_block_stats_path, "", "If set, write per block compression statistics of BSSIDs DB to the given "
+    "path and their summary histograms to '<path>.histograms'.");
+DEFINE_string(previous_cells_path, "", "If set, anchor the blocks boundaries and entropy coding tables of cells DB "
+    "to this previous build, so that the blocks with unchanged entries are identical, see dwarf-idea-diff.");
+DEFINE_string(previous_bssids_path, "", "Same as --previous_cells_path, but for BSSIDs DB.");
 
 namespace {
 
-bool readArchive(const std::string& path, CsvParser& csv_parser, ILocationAggregator& aggregator, bool raw)
+DwarfIdeaBuilderOptions getBuilderOptions(
+    StatsReport* stats_report, const std::string& block_stats_path, const std::string& previous_path,
+    TraceRecorder* trace)
+{
+    DwarfIdeaBuilderOptions options;
+    options.max_dist_error = FLAGS_max_dist_error;
+    options.min_entries_per_block = FLAGS_min_entries_per_block;
+    options.max_entries_per_block = FLAGS_max_entries_per_block;
+    options.bounding_box_bits = FLAGS_bounding_box_bits;
+    options.coords_quantization = parseCoordsQuantization(FLAGS_coords_quantization);
+    options.check_coords_error = FLAGS_check_coords_error;
+    options.keys_codec = parseEntropyCodecType(FLAGS_keys_codec);
+    options.coords_codec = parseEntropyCodecType(FLAGS_coords_codec);
+    options.extra_data_codec = parseEntropyCodecType(FLAGS_extra_data_codec);
+    CHECK(FLAGS_entropy_tables >= 1 && FLAGS_entropy_tables <= 255) << "Invalid number of entropy coding tables";
+    options.entropy_tables = FLAGS_entropy_tables;
+    options.stats_sample_ratio = FLAGS_stats_sample_ratio;
+    options.transform_chain = parseTransformChain(FLAGS_transform_chain);
+    options.packed_coords = FLAGS_packed_coords;
+    options.eytzinger_index = FLAGS_eytzinger_index;
+    options.membership_filter = FLAGS_membership_filter;
+    options.wide_offsets = FLAGS_wide_offsets;
+    options.compressed_index = FLAGS_compressed_index;
+    options.spatial_index = FLAGS_spatial_index;
+    options.split_keys = FLAGS_split_keys;
+    options.oui_index = FLAGS_oui_index;
+    options.entropy_codecs_report = FLAGS_entropy_codecs_report;
+    options.transform_chains_report = FLAGS_transform_chains_report;
+    options.stats_report = stats_report;
+    options.block_stats_path = block_stats_path;
+    options.previous_path = previous_path;
+    options.trace = trace;
+    return options;
+}
+
+bool readArchive(
+    const std::string& path, CsvParser& csv_parser, ILocationAggregator& aggregator, bool raw,
+    StatsReport::Timer& read_timer, StatsReport::Timer& parse_timer, TraceRecorder* trace)
 {
     struct archive *a = archive_read_new();
     archive_read_support_filter_all(a);
@@ -69,9 +160,24 @@ bool readArchive(const std::string& path, CsvParser& csv_parser, ILocationAggreg
             size_t size = 0;
             off_t offset = 0;
             const char* buffer = nullptr;
-            while (archive_read_data_block(a, (const void**)&buffer, &size, &offset) == ARCHIVE_OK)
+            while (true)
             {
+                bool has_data = false;
+                {
+                    TraceRecorder::Scope scope(trace, "read_chunk", "parse");
+                    read_timer.start();
+                    has_data = archive_read_data_block(a, (const void**)&buffer, &size, &offset) == ARCHIVE_OK;
+                    read_timer.stop();
+                }
+                if (!has_data)
+                {
+                    break;
+                }
+                TraceRecorder::Scope scope(trace, "parse_chunk", "parse");
+                scope.addArg("bytes", size);
+                parse_timer.start();
                 csv_parser.parse(buffer, size, aggregator);
+                parse_timer.stop();
             }
             csv_parser.parse(nullptr, 0, aggregator);
         }
@@ -92,28 +198,73 @@ void process(
     CsvParser& csv_parser,
     SqliteParser& sqlite_parser,
     ILocationAggregator& aggregator,
-    IDwarfIdeaBuilder& builder)
+    IDwarfIdeaBuilder& builder,
+    StatsReport* stats_report,
+    TraceRecorder* trace)
 {
     std::vector<std::string> paths;
     split(files_list, ',', paths);
+    PhaseStats read_phase{"read", 0.0, 0.0, 0}, parse_phase{"parse", 0.0, 0.0, 0};
+    StatsReport::resetPeakRss();
     for (const auto& path: paths)
     {
-        if (path.find(".sqlite") != std::string::npos)
+        StatsReport::Timer read_timer, parse_timer;
+        const bool is_sqlite = path.find(".sqlite") != std::string::npos;
+        const ParserStats& parser_stats = is_sqlite ? sqlite_parser.getStats() : csv_parser.getStats();
+        const uint64_t prev_num_rows = parser_stats.getNumRows();
+        const uint64_t prev_num_rejected_rows = parser_stats.getNumRejectedRows();
+        if (is_sqlite)
         {
             sqlite_parser.reset();
+            TraceRecorder::Scope scope(trace, "parse_sqlite", "parse");
+            parse_timer.start();
             sqlite_parser.parse(path.c_str(), aggregator);
+            parse_timer.stop();
         }
         else
         {
             csv_parser.reset();
-            if (!readArchive(path, csv_parser, aggregator, false))
+            if (!readArchive(path, csv_parser, aggregator, false, read_timer, parse_timer, trace))
             {
-                if (!readArchive(path, csv_parser, aggregator, true))
+                if (!readArchive(path, csv_parser, aggregator, true, read_timer, parse_timer, trace))
                 {
+                    TraceRecorder::Scope scope(trace, "parse_file", "parse");
+                    parse_timer.start();
                     csv_parser.parse(path.c_str(), aggregator);
+                    parse_timer.stop();
                 }
             }
         }
+
+        const uint64_t num_rows = parser_stats.getNumRows() - prev_num_rows;
+        const uint64_t num_rejected_rows = parser_stats.getNumRejectedRows() - prev_num_rejected_rows;
+        const double time = read_timer.getWallTime() + parse_timer.getWallTime();
+        LOG(INFO) << "Parsed " << num_rows << " rows (" << num_rejected_rows << " rejected) from " << path <<
+            " in " << time << " s, " << (time > 0.0 ? num_rows / time : 0.0) << " rows / s";
+        read_phase.wall_time += read_timer.getWallTime();
+        read_phase.cpu_time += read_timer.getCpuTime();
+        parse_phase.wall_time += parse_timer.getWallTime();
+        parse_phase.cpu_time += parse_timer.getCpuTime();
+        if (stats_report)
+        {
+            stats_report->addInputFile(InputFileStats{
+                path, num_rows, num_rows - num_rejected_rows, read_timer.getWallTime(), parse_timer.getWallTime()});
+        }
+    }
+
+    ParserStats parser_stats = csv_parser.getStats();
+    parser_stats.merge(sqlite_parser.getStats());
+    for (const auto& rejection: parser_stats.getRejections())
+    {
+        LOG(INFO) << "Rejected rows (" << rejection.first << "): " << rejection.second;
+    }
+    if (stats_report)
+    {
+        // Reading and parsing are interleaved, so both get the peak RSS of the whole input processing.
+        read_phase.peak_rss = parse_phase.peak_rss = StatsReport::getPeakRss();
+        stats_report->addPhase(read_phase);
+        stats_report->addPhase(parse_phase);
+        stats_report->setParserStats(parser_stats);
     }
 
     if (!debug_output_path.empty())
@@ -126,23 +277,33 @@ void process(
     
     if (!output_path.empty())
     {
-        std::ofstream ofs(output_path.c_str());
-        aggregator.aggregate(builder);
-        builder.build(ofs);
+        {
+            std::ofstream ofs(output_path.c_str());
+            {
+                StatsReport::Phase phase(stats_report, "aggregate");
+                aggregator.aggregate(builder);
+            }
+            builder.build(ofs);
+        }
+        if (FLAGS_verify_output)
+        {
+            StatsReport::Phase phase(stats_report, "verify");
+            builder.verify(output_path);
+        }
     }
 }
 
-void processCells()
+void processCells(StatsReport* stats_report, TraceRecorder* trace)
 {
+    if (stats_report)
+    {
+        stats_report->setDataset("cells");
+    }
     CellsCsvParser csv_parser(FLAGS_blacklisted_standards);
     CellsSqliteParser sqlite_parser(FLAGS_blacklisted_standards);
-    LocationAggregator<kCellKeySize, kCellExtraDataSize> aggregator;
+    LocationAggregator<kCellKeySize, kCellExtraDataSize> aggregator(trace);
     CellsDwarfIdeaBuilder builder(
-        FLAGS_max_dist_error,
-        FLAGS_min_entries_per_block,
-        FLAGS_max_entries_per_block,
-        FLAGS_bounding_box_bits
-    );
+        getBuilderOptions(stats_report, FLAGS_cells_block_stats_path, FLAGS_previous_cells_path, trace));
     process(
         FLAGS_cells_files,
         FLAGS_debug_cells_output_path,
@@ -150,21 +311,23 @@ void processCells()
         csv_parser,
         sqlite_parser,
         aggregator,
-        builder
+        builder,
+        stats_report,
+        trace
     );
 }
 
-void processBssids()
+void processBssids(StatsReport* stats_report, TraceRecorder* trace)
 {
+    if (stats_report)
+    {
+        stats_report->setDataset("bssids");
+    }
     BssidsCsvParser csv_parser;
     BssidsSqliteParser sqlite_parser;
-    LocationAggregator<kBssidKeySize, kBssidExtraDataSize> aggregator;
-    DwarfIdeaBuilder<kBssidKeySize, kBssidExtraDataSize> builder(
-        FLAGS_max_dist_error,
-        FLAGS_min_entries_per_block,
-        FLAGS_max_entries_per_block,
-        FLAGS_bounding_box_bits
-    );
+    LocationAggregator<kBssidKeySize, kBssidExtraDataSize> aggregator(trace);
+    BssidsDwarfIdeaBuilder builder(
+        getBuilderOptions(stats_report, FLAGS_bssids_block_stats_path, FLAGS_previous_bssids_path, trace));
     process(
         FLAGS_bssids_files,
         FLAGS_debug_bssids_output_path,
@@ -172,7 +335,9 @@ void processBssids()
         csv_parser,
         sqlite_parser,
         aggregator,
-        builder
+        builder,
+        stats_report,
+        trace
     );
 }
 
@@ -181,13 +346,23 @@ void processBssids()
 int main(int argc, char* argv[])
 {
     gflags::ParseCommandLineFlags(&argc, &argv, true);
+    std::unique_ptr<StatsReport> stats_report(FLAGS_stats_json.empty() ? nullptr : new StatsReport());
+    std::unique_ptr<TraceRecorder> trace(FLAGS_trace_json.empty() ? nullptr : new TraceRecorder());
     if (!FLAGS_debug_cells_output_path.empty() || !FLAGS_cells_output_path.empty())
     {
-        processCells();
+        processCells(stats_report.get(), trace.get());
     }
     if (!FLAGS_debug_bssids_output_path.empty() || !FLAGS_bssids_output_path.empty())
     {
-        processBssids();
+        processBssids(stats_report.get(), trace.get());
+    }
+    if (stats_report)
+    {
+        CHECK(stats_report->write(FLAGS_stats_json)) << "Failed to write " << FLAGS_stats_json;
+    }
+    if (trace)
+    {
+        CHECK(trace->write(FLAGS_trace_json)) << "Failed to write " << FLAGS_trace_json;
     }
     return 0;
 }
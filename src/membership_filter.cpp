@@ -0,0 +1,256 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "membership_filter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace {
+
+const int kArity = 3;
+const uint32_t kMaxSegmentLength = 1 << 18;
+const int kMaxBuildIterations = 100;
+// seed + segment length + segments count + fingerprints count.
+const size_t kHeaderSize = sizeof(uint64_t) + 3 * sizeof(uint32_t);
+
+uint64_t mixHash(uint64_t key, uint64_t seed)
+{
+    uint64_t h = key + seed;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+uint8_t getFingerprint(uint64_t hash)
+{
+    return uint8_t(hash ^ (hash >> 32));
+}
+
+uint64_t mulHi(uint64_t a, uint64_t b)
+{
+    return uint64_t(((unsigned __int128)a * b) >> 64);
+}
+
+}
+
+MembershipFilter::MembershipFilter():
+    seed_(0),
+    segment_length_(0),
+    segment_length_mask_(0),
+    segment_count_(0),
+    segment_count_length_(0),
+    array_length_(0),
+    fingerprints_(nullptr)
+{
+}
+
+void MembershipFilter::setSize(size_t num_keys)
+{
+    // The parameters recommended by the paper for 3-wise filters.
+    segment_length_ = num_keys ? 1u << int(std::floor(std::log(num_keys) / std::log(3.33) + 2.25)) : 4;
+    segment_length_ = std::min(segment_length_, kMaxSegmentLength);
+    const double size_factor = num_keys > 1 ?
+        std::max(1.125, 0.875 + 0.25 * std::log(1000000.0) / std::log(num_keys)) : 0.0;
+    const uint64_t capacity = uint64_t(std::round(num_keys * size_factor));
+    const uint64_t segments = (capacity + segment_length_ - 1) / segment_length_;
+    segment_count_ = segments > kArity ? segments - (kArity - 1) : 1;
+    segment_length_mask_ = segment_length_ - 1;
+    segment_count_length_ = segment_count_ * segment_length_;
+    array_length_ = (segment_count_ + kArity - 1) * segment_length_;
+}
+
+void MembershipFilter::getPositions(uint64_t hash, uint32_t positions[3]) const
+{
+    positions[0] = uint32_t(mulHi(hash, segment_count_length_));
+    positions[1] = (positions[0] + segment_length_) ^ (uint32_t(hash >> 18) & segment_length_mask_);
+    positions[2] = (positions[0] + 2 * segment_length_) ^ (uint32_t(hash) & segment_length_mask_);
+}
+
+bool MembershipFilter::build(const std::vector<uint64_t>& keys)
+{
+    setSize(keys.size());
+    storage_.assign(array_length_, 0);
+    fingerprints_ = storage_.data();
+
+    // Keys are "peeled" from the positions that are covered by the single key
+    // only, 't2count' stores the number of keys covering the position * 4 +
+    // xor of the indices (0..2) of the position for these keys, 't2hash' stores
+    // xor of their hashes.
+    const size_t num_keys = keys.size();
+    std::vector<uint64_t> reverse_order(num_keys + 1);
+    std::vector<uint8_t> reverse_index(num_keys);
+    std::vector<uint8_t> t2count(array_length_);
+    std::vector<uint64_t> t2hash(array_length_);
+    std::vector<uint32_t> alone(array_length_);
+    int block_bits = 1;
+    while ((size_t(1) << block_bits) < segment_count_)
+    {
+        ++block_bits;
+    }
+    std::vector<size_t> start_pos(size_t(1) << block_bits);
+    std::mt19937_64 rng(num_keys);
+
+    for (int iteration = 0; ; ++iteration)
+    {
+        if (iteration == kMaxBuildIterations)
+        {
+            storage_.clear();
+            array_length_ = 0;
+            return false;
+        }
+        seed_ = rng();
+        std::fill(reverse_order.begin(), reverse_order.end(), 0);
+        // Sentinel, so that the search for the free slot below never runs past the end.
+        reverse_order[num_keys] = 1;
+        std::fill(t2count.begin(), t2count.end(), 0);
+        std::fill(t2hash.begin(), t2hash.end(), 0);
+
+        // Sort the hashes roughly by their first position for better memory locality.
+        for (size_t i = 0; i < start_pos.size(); ++i)
+        {
+            start_pos[i] = (i * num_keys) >> block_bits;
+        }
+        for (uint64_t key: keys)
+        {
+            const uint64_t hash = mixHash(key, seed_);
+            size_t segment_index = hash >> (64 - block_bits);
+            while (reverse_order[start_pos[segment_index]] != 0)
+            {
+                segment_index = (segment_index + 1) & (start_pos.size() - 1);
+            }
+            reverse_order[start_pos[segment_index]++] = hash;
+        }
+
+        bool overflow = false;
+        for (size_t i = 0; i < num_keys; ++i)
+        {
+            uint32_t positions[3];
+            getPositions(reverse_order[i], positions);
+            for (int j = 0; j < kArity; ++j)
+            {
+                t2count[positions[j]] += 4;
+                t2count[positions[j]] ^= j;
+                t2hash[positions[j]] ^= reverse_order[i];
+                overflow |= t2count[positions[j]] < 4;
+            }
+        }
+        if (overflow)
+        {
+            continue;
+        }
+
+        size_t queue_size = 0;
+        for (uint32_t i = 0; i < array_length_; ++i)
+        {
+            alone[queue_size] = i;
+            queue_size += (t2count[i] >> 2) == 1;
+        }
+        size_t stack_size = 0;
+        while (queue_size > 0)
+        {
+            const uint32_t position = alone[--queue_size];
+            if ((t2count[position] >> 2) != 1)
+            {
+                continue;
+            }
+            const uint64_t hash = t2hash[position];
+            const uint8_t found = t2count[position] & 3;
+            reverse_index[stack_size] = found;
+            reverse_order[stack_size++] = hash;
+            uint32_t positions[3];
+            getPositions(hash, positions);
+            for (int j = 1; j < kArity; ++j)
+            {
+                const int other = (found + j) % kArity;
+                const uint32_t other_position = positions[other];
+                alone[queue_size] = other_position;
+                queue_size += (t2count[other_position] >> 2) == 2;
+                t2count[other_position] -= 4;
+                t2count[other_position] ^= other;
+                t2hash[other_position] ^= hash;
+            }
+        }
+        if (stack_size == num_keys)
+        {
+            break;
+        }
+    }
+
+    // Assign the fingerprints in the reverse peeling order, so that the position
+    // assigned for each key is not used by any of the keys processed later.
+    for (size_t i = num_keys; i-- > 0; )
+    {
+        uint32_t positions[3];
+        getPositions(reverse_order[i], positions);
+        const int found = reverse_index[i];
+        storage_[positions[found]] = getFingerprint(reverse_order[i]) ^
+            storage_[positions[(found + 1) % kArity]] ^ storage_[positions[(found + 2) % kArity]];
+    }
+    return true;
+}
+
+Bytes MembershipFilter::serialize() const
+{
+    Bytes output;
+    appendBytes(asBytes(seed_), output);
+    appendBytes(asBytes(segment_length_), output);
+    appendBytes(asBytes(segment_count_), output);
+    appendBytes(asBytes(array_length_), output);
+    output.insert(output.end(), fingerprints_, fingerprints_ + array_length_);
+    return output;
+}
+
+bool MembershipFilter::load(const uint8_t* data, size_t size)
+{
+    array_length_ = 0;
+    if (size < kHeaderSize)
+    {
+        return false;
+    }
+    seed_ = asInt<uint64_t>(Bytes(data, data + 8));
+    segment_length_ = asInt<uint32_t>(Bytes(data + 8, data + 12));
+    segment_count_ = asInt<uint32_t>(Bytes(data + 12, data + 16));
+    const uint32_t array_length = asInt<uint32_t>(Bytes(data + 16, data + 20));
+    if (!segment_length_ || (segment_length_ & (segment_length_ - 1)) || segment_length_ > kMaxSegmentLength ||
+        !segment_count_ || uint64_t(segment_count_ + kArity - 1) * segment_length_ != array_length ||
+        size - kHeaderSize != array_length)
+    {
+        return false;
+    }
+    segment_length_mask_ = segment_length_ - 1;
+    segment_count_length_ = segment_count_ * segment_length_;
+    array_length_ = array_length;
+    storage_.clear();
+    fingerprints_ = data + kHeaderSize;
+    return true;
+}
+
+bool MembershipFilter::mayContain(uint64_t key) const
+{
+    const uint64_t hash = mixHash(key, seed_);
+    uint32_t positions[3];
+    getPositions(hash, positions);
+    return (getFingerprint(hash) ^ fingerprints_[positions[0]] ^ fingerprints_[positions[1]] ^
+            fingerprints_[positions[2]]) == 0;
+}
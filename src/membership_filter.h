@@ -0,0 +1,70 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "utils.h"
+
+// Binary fuse filter with 8 bits fingerprints (Graf & Lemire, "Binary Fuse Filters:
+// Fast and Smaller Than Xor Filters"): answers whether the key may be present in
+// the set using 3 memory accesses, with ~9 bits per key and false positive rate
+// of ~1 / 256.
+//
+// Serialized layout: u64 seed, u32 segment length, u32 segments count, u32
+// fingerprints count, all little-endian, followed by the fingerprints.
+class MembershipFilter
+{
+  public:
+    MembershipFilter();
+
+    // The fingerprints may point into the own storage, so only moves are allowed.
+    MembershipFilter(const MembershipFilter&) = delete;
+    MembershipFilter& operator=(const MembershipFilter&) = delete;
+    MembershipFilter(MembershipFilter&&) = default;
+    MembershipFilter& operator=(MembershipFilter&&) = default;
+
+    // Builds the filter for the set of unique keys. Returns false if the
+    // construction fails, which in practice happens only for duplicate keys.
+    bool build(const std::vector<uint64_t>& keys);
+
+    Bytes serialize() const;
+
+    // Uses the serialized filter in place, 'data' must outlive the filter.
+    // Returns false if the data is malformed.
+    bool load(const uint8_t* data, size_t size);
+
+    bool empty() const { return !array_length_; }
+
+    // Returns false if the key is definitely not in the set.
+    bool mayContain(uint64_t key) const;
+
+  private:
+    uint64_t seed_;
+    uint32_t segment_length_, segment_length_mask_, segment_count_, segment_count_length_, array_length_;
+    Bytes storage_;
+    const uint8_t* fingerprints_;
+
+    void setSize(size_t num_keys);
+
+    void getPositions(uint64_t hash, uint32_t positions[3]) const;
+};
@@ -0,0 +1,68 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+// Counts the data rows seen by the parser and the rejected ones per reason,
+// so that malformed inputs don't need to be logged row by row.
+class ParserStats
+{
+  public:
+    ParserStats(): num_rows_(0) {}
+
+    void addRow() { ++num_rows_; }
+
+    // Adds the row rejected for the given reason, e.g. "zero_coords".
+    void addRejectedRow(const char* reason)
+    {
+        ++num_rows_;
+        ++rejections_[reason];
+    }
+
+    void merge(const ParserStats& other)
+    {
+        num_rows_ += other.num_rows_;
+        for (const auto& rejection: other.rejections_)
+        {
+            rejections_[rejection.first] += rejection.second;
+        }
+    }
+
+    uint64_t getNumRows() const { return num_rows_; }
+
+    uint64_t getNumRejectedRows() const
+    {
+        uint64_t num_rejected_rows = 0;
+        for (const auto& rejection: rejections_)
+        {
+            num_rejected_rows += rejection.second;
+        }
+        return num_rejected_rows;
+    }
+
+    const std::map<std::string, uint64_t>& getRejections() const { return rejections_; }
+
+  private:
+    uint64_t num_rows_;
+    std::map<std::string, uint64_t> rejections_;
+};
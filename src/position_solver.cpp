@@ -0,0 +1,229 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "position_solver.h"
+
+#include <algorithm>
+
+#include <glog/logging.h>
+
+namespace {
+
+const double kMetersPerDegree = kEarthRadius * M_PI / 180.0;
+// Signal strength range, in dBm, the values outside of it are clamped.
+const float kMinSignalStrength = -120.0f;
+const float kMaxSignalStrength = -20.0f;
+
+// The anchor projected onto the local plane around the reference point, in meters.
+// Small distortions far from the reference point don't matter here, while the
+// projection makes all distance computations cheap.
+struct PlanarAnchor
+{
+    double x, y, radius, weight;
+};
+
+double getPlanarDist2(double x0, double y0, double x1, double y1)
+{
+    return sqr(x0 - x1) + sqr(y0 - y1);
+}
+
+double getWeight(const Anchor& anchor, const PositionSolverOptions& options)
+{
+    // The position uncertainty is proportional to the coverage area and
+    // decreases with the number of samples the entry is aggregated from.
+    double weight = (1.0 + anchor.samples) / sqr(double(anchor.radius));
+    if (!std::isnan(anchor.signal_strength))
+    {
+        // Stronger signal means smaller distance to the anchor, the weight is
+        // inversely proportional to the distance relative to kMinSignalStrength.
+        const float signal_strength = std::min(kMaxSignalStrength, std::max(kMinSignalStrength, anchor.signal_strength));
+        weight *= std::pow(10.0, (signal_strength - kMinSignalStrength) / (10.0 * options.path_loss_exponent));
+    }
+    return weight;
+}
+
+}
+
+bool solvePosition(
+    const std::vector<Anchor>& anchors, const PositionSolverOptions& options, PositionEstimate& estimate)
+{
+    estimate = PositionEstimate();
+    if (anchors.empty())
+    {
+        return false;
+    }
+
+    const Point& origin = anchors[0].point;
+    const double lon_scale = kMetersPerDegree * std::cos(origin.lat * M_PI / 180.0);
+    std::vector<PlanarAnchor> planar(anchors.size());
+    for (size_t i = 0; i < anchors.size(); ++i)
+    {
+        const Anchor& anchor = anchors[i];
+        double lon_diff = anchor.point.lon - origin.lon;
+        // Handle the anchors on the other side of the antimeridian.
+        lon_diff -= 360.0 * std::round(lon_diff / 360.0);
+        planar[i] = PlanarAnchor{
+            lon_diff * lon_scale, (anchor.point.lat - origin.lat) * kMetersPerDegree,
+            anchor.radius, getWeight(anchor, options)};
+    }
+
+    // Seed the consensus set with the anchor overlapping with the most other anchors.
+    size_t seed = 0;
+    double best_support = -1.0;
+    for (size_t i = 0; i < planar.size(); ++i)
+    {
+        double support = 0.0;
+        for (const PlanarAnchor& other: planar)
+        {
+            if (getPlanarDist2(planar[i].x, planar[i].y, other.x, other.y) <= sqr(planar[i].radius + other.radius))
+            {
+                support += other.weight;
+            }
+        }
+        if (support > best_support)
+        {
+            best_support = support;
+            seed = i;
+        }
+    }
+    std::vector<bool> inliers(planar.size());
+    for (size_t i = 0; i < planar.size(); ++i)
+    {
+        inliers[i] = getPlanarDist2(planar[seed].x, planar[seed].y, planar[i].x, planar[i].y) <=
+            sqr(planar[seed].radius + planar[i].radius);
+    }
+
+    double x = 0.0, y = 0.0;
+    for (int iteration = 0; iteration < options.max_iterations; ++iteration)
+    {
+        double sum_weight = 0.0, sum_x = 0.0, sum_y = 0.0;
+        for (size_t i = 0; i < planar.size(); ++i)
+        {
+            if (inliers[i])
+            {
+                sum_weight += planar[i].weight;
+                sum_x += planar[i].weight * planar[i].x;
+                sum_y += planar[i].weight * planar[i].y;
+            }
+        }
+        x = sum_x / sum_weight;
+        y = sum_y / sum_weight;
+
+        // Refine the inliers w.r.t. the current estimate, but never reject all of them.
+        std::vector<bool> new_inliers(planar.size());
+        bool changed = false, any = false;
+        for (size_t i = 0; i < planar.size(); ++i)
+        {
+            new_inliers[i] = getPlanarDist2(x, y, planar[i].x, planar[i].y) <=
+                sqr(options.outlier_radius_factor * planar[i].radius);
+            changed |= new_inliers[i] != inliers[i];
+            any |= new_inliers[i];
+        }
+        if (!changed || !any)
+        {
+            break;
+        }
+        inliers.swap(new_inliers);
+    }
+
+    // Accuracy combines the spread of the inliers around the estimate with their
+    // coverage radius, the latter decreases with the number of inliers.
+    double sum_weight = 0.0, sum_dist2 = 0.0, sum_radius2 = 0.0;
+    for (size_t i = 0; i < planar.size(); ++i)
+    {
+        if (inliers[i])
+        {
+            sum_weight += planar[i].weight;
+            sum_dist2 += planar[i].weight * getPlanarDist2(x, y, planar[i].x, planar[i].y);
+            sum_radius2 += planar[i].weight * sqr(planar[i].radius);
+            ++estimate.num_used;
+        }
+    }
+    estimate.num_rejected = planar.size() - estimate.num_used;
+    estimate.accuracy = std::sqrt((sum_dist2 + sum_radius2 / estimate.num_used) / sum_weight);
+    double lon = origin.lon + x / lon_scale;
+    lon -= 360.0 * std::round(lon / 360.0);
+    estimate.point = Point(origin.lat + y / kMetersPerDegree, lon);
+    estimate.found = true;
+    return true;
+}
+
+PositionSolver::PositionSolver(const PositionSolverOptions& options):
+    options_(options)
+{
+}
+
+size_t PositionSolver::addSource(const DwarfIdeaReader& reader, DecodedBlocksCache* cache)
+{
+    sources_.push_back(Source{&reader, cache});
+    return sources_.size() - 1;
+}
+
+bool PositionSolver::solve(const std::vector<Observation>& scan, PositionEstimate& estimate) const
+{
+    std::vector<Anchor> anchors;
+    std::vector<std::string> keys;
+    std::vector<const Observation*> observations;
+    std::vector<LookupResult> results;
+    for (size_t source_index = 0; source_index < sources_.size(); ++source_index)
+    {
+        keys.clear();
+        observations.clear();
+        for (const Observation& observation: scan)
+        {
+            if (observation.source == source_index)
+            {
+                keys.push_back(observation.key);
+                observations.push_back(&observation);
+            }
+        }
+        if (keys.empty())
+        {
+            continue;
+        }
+
+        const Source& source = sources_[source_index];
+        results.assign(keys.size(), LookupResult());
+        if (source.cache)
+        {
+            source.cache->lookupBatch(keys.data(), keys.size(), results.data());
+        }
+        else
+        {
+            source.reader->lookupBatch(keys.data(), keys.size(), results.data());
+        }
+
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            if (!results[i].found)
+            {
+                continue;
+            }
+            Anchor anchor{results[i].point, options_.default_radius, 0, observations[i]->signal_strength};
+            if (results[i].extra_data.size() == 1)
+            {
+                int radius = 0;
+                unpackExtraData(uint8_t(results[i].extra_data[0]), radius, anchor.samples);
+                anchor.radius = radius;
+            }
+            anchors.push_back(anchor);
+        }
+    }
+    return solvePosition(anchors, options_, estimate);
+}
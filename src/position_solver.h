@@ -0,0 +1,110 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "decoded_blocks_cache.h"
+#include "dwarf_idea_reader.h"
+#include "utils.h"
+
+// Estimates the position from the set of observed cells / WiFi access points.
+//
+// Each found entry becomes the anchor with the weight inversely proportional to
+// its coverage area, increased for the entries aggregated from many samples and
+// for the stronger signals. The anchors are then clustered: the anchor whose
+// coverage overlaps with the most (by weight) other anchors seeds the consensus
+// set, the anchors not overlapping with it are rejected as outliers (e.g. moved
+// access points), and the weighted centroid of the remaining anchors is refined
+// by rejecting the anchors whose coverage doesn't reach it.
+
+struct PositionSolverOptions
+{
+    // Coverage radius, in meters, for the entries without extra data (BSSIDs).
+    float default_radius = 100.0f;
+    // The anchor is an outlier if it's farther from the estimate than this
+    // number of its coverage radii.
+    float outlier_radius_factor = 2.0f;
+    int max_iterations = 3;
+    // Used to convert signal strength into relative distance, 2 for free space.
+    float path_loss_exponent = 3.0f;
+};
+
+struct Anchor
+{
+    Point point;
+    // Coverage radius, in meters.
+    float radius;
+    int samples;
+    // Signal strength in dBm or NaN if unknown.
+    float signal_strength;
+};
+
+struct PositionEstimate
+{
+    bool found = false;
+    Point point;
+    // Estimated accuracy, in meters.
+    float accuracy = 0.0f;
+    size_t num_used = 0, num_rejected = 0;
+};
+
+// Observed key, 'source' is the index returned by 'PositionSolver::addSource'.
+struct Observation
+{
+    size_t source = 0;
+    std::string key;
+    // Signal strength in dBm or NaN if unknown.
+    float signal_strength = std::numeric_limits<float>::quiet_NaN();
+};
+
+// Computes the position from the resolved anchors, returns false if there are none.
+bool solvePosition(
+    const std::vector<Anchor>& anchors, const PositionSolverOptions& options, PositionEstimate& estimate);
+
+class PositionSolver
+{
+  public:
+    explicit PositionSolver(const PositionSolverOptions& options = PositionSolverOptions());
+
+    // Adds the DB used to resolve the observations, e.g. one for cells and one for
+    // BSSIDs. If 'cache' is set, the lookups go through it. Both must outlive the
+    // solver. Returns the index to use as 'Observation::source'.
+    size_t addSource(const DwarfIdeaReader& reader, DecodedBlocksCache* cache = nullptr);
+
+    // Resolves all observations of the scan using batched lookups and computes
+    // the position. Returns false if none of the observations is found.
+    // Safe to call concurrently.
+    bool solve(const std::vector<Observation>& scan, PositionEstimate& estimate) const;
+
+  private:
+    struct Source
+    {
+        const DwarfIdeaReader* reader;
+        DecodedBlocksCache* cache;
+    };
+
+    PositionSolverOptions options_;
+    std::vector<Source> sources_;
+};
@@ -0,0 +1,188 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "rans_codec.h"
+
+#include <algorithm>
+#include <numeric>
+
+#include <glog/logging.h>
+
+namespace {
+
+const int kNumSymbols = 256;
+const int kScaleBits = 12;
+const uint32_t kScale = 1u << kScaleBits;
+// Lower bound of the normalized state interval [kLowerBound, kLowerBound * 256).
+const uint32_t kLowerBound = 1u << 23;
+
+}
+
+Bytes RansCodec::buildTable(const std::vector<unsigned>& freqs, size_t total_size)
+{
+    // Scale the frequencies so that they sum up to kScale, keeping every
+    // symbol that was seen in the data encodable.
+    freqs_.assign(kNumSymbols, 0);
+    uint64_t total = std::accumulate(freqs.begin(), freqs.end(), uint64_t(0));
+    if (!total)
+    {
+        freqs_[0] = kScale;
+    }
+    else
+    {
+        for (int i = 0; i < kNumSymbols; ++i)
+        {
+            if (freqs[i])
+            {
+                freqs_[i] = std::max<uint32_t>(1, uint64_t(freqs[i]) * kScale / total);
+            }
+        }
+    }
+
+    // Fix the rounding errors by adjusting the most frequent symbols, which
+    // has the least impact on the compression ratio.
+    std::vector<int> symbols(kNumSymbols);
+    std::iota(symbols.begin(), symbols.end(), 0);
+    std::sort(symbols.begin(), symbols.end(), [this](int a, int b) { return freqs_[a] > freqs_[b]; });
+    int64_t diff = int64_t(kScale) - std::accumulate(freqs_.begin(), freqs_.end(), int64_t(0));
+    for (size_t i = 0; diff != 0; i = (i + 1) % symbols.size())
+    {
+        uint32_t& freq = freqs_[symbols[i]];
+        if (diff > 0)
+        {
+            freq += diff;
+            diff = 0;
+        }
+        else if (freq > 1)
+        {
+            uint32_t delta = std::min<int64_t>(freq - 1, -diff);
+            freq -= delta;
+            diff += delta;
+        }
+    }
+
+    initTables();
+
+    Bytes table;
+    for (uint32_t freq: freqs_)
+    {
+        appendBytes(asVarInt(freq), table);
+    }
+    return table;
+}
+
+bool RansCodec::loadTable(const uint8_t* data, size_t size)
+{
+    const uint8_t* end = data + size;
+    freqs_.assign(kNumSymbols, 0);
+    for (uint32_t& freq: freqs_)
+    {
+        if (!readVarInt(data, end, freq))
+        {
+            return false;
+        }
+    }
+    if (std::accumulate(freqs_.begin(), freqs_.end(), uint64_t(0)) != kScale)
+    {
+        return false;
+    }
+    initTables();
+    return true;
+}
+
+bool RansCodec::loadCompressionTable(const uint8_t* data, size_t size)
+{
+    // The same tables are used for compression and decompression.
+    return loadTable(data, size);
+}
+
+void RansCodec::initTables()
+{
+    cum_freqs_.assign(kNumSymbols + 1, 0);
+    std::partial_sum(freqs_.begin(), freqs_.end(), cum_freqs_.begin() + 1);
+    slots_.assign(kScale, 0);
+    for (int i = 0; i < kNumSymbols; ++i)
+    {
+        std::fill(&slots_[cum_freqs_[i]], &slots_[cum_freqs_[i + 1]], uint8_t(i));
+    }
+}
+
+Bytes RansCodec::compress(const uint8_t* data, size_t size) const
+{
+    // rANS works as a stack, so encode the data backwards and then reverse
+    // the output so that the decoder can read it forwards.
+    Bytes reversed;
+    reversed.reserve(size + 4);
+    uint32_t state = kLowerBound;
+    for (size_t i = size; i-- > 0; )
+    {
+        uint32_t freq = freqs_[data[i]];
+        if (!freq)
+        {
+            return Bytes();
+        }
+        uint32_t max_state = ((kLowerBound >> kScaleBits) << 8) * freq;
+        while (state >= max_state)
+        {
+            reversed.push_back(state & 0xFF);
+            state >>= 8;
+        }
+        state = ((state / freq) << kScaleBits) + (state % freq) + cum_freqs_[data[i]];
+    }
+    for (int i = 0; i < 4; ++i)
+    {
+        reversed.push_back(state & 0xFF);
+        state >>= 8;
+    }
+
+    // rANS stream doesn't mark its end, so store the original size first.
+    Bytes output = asVarInt(size);
+    output.insert(output.end(), reversed.rbegin(), reversed.rend());
+    return output;
+}
+
+bool RansCodec::decompress(const uint8_t* data, size_t size, size_t max_size, Bytes& output) const
+{
+    const uint8_t* end = data + size;
+    size_t dst_size = 0;
+    if (!readVarInt(data, end, dst_size) || dst_size > max_size || end - data < 4)
+    {
+        return false;
+    }
+
+    uint32_t state = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        state = (state << 8) | *data++;
+    }
+
+    output.resize(dst_size);
+    for (size_t i = 0; i < dst_size; ++i)
+    {
+        uint32_t slot = state & (kScale - 1);
+        uint8_t symbol = slots_[slot];
+        output[i] = symbol;
+        state = freqs_[symbol] * (state >> kScaleBits) + slot - cum_freqs_[symbol];
+        while (state < kLowerBound && data != end)
+        {
+            state = (state << 8) | *data++;
+        }
+    }
+    return state == kLowerBound && data == end;
+}
@@ -45,3 +45,7 @@ void SimpleDwarfIdeaBuilder::build(std::ostream& os) {
     os << str << std::endl;
   }
 }
+
+void SimpleDwarfIdeaBuilder::verify(const std::string& path) const {
+  // Nothing to verify for the debugging output.
+}
@@ -31,6 +31,8 @@ class SimpleDwarfIdeaBuilder: public IDwarfIdeaBuilder
 
     void build(std::ostream& os) override;
 
+    void verify(const std::string& path) const override;
+
   private:
     std::vector<std::string> entries_;
 };
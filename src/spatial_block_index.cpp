@@ -0,0 +1,252 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "spatial_block_index.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Node size + coordinates size + number of levels.
+const size_t kHeaderSize = sizeof(uint16_t) + 2 * sizeof(uint8_t);
+// Keeps the traversal stack bounded even for malformed data.
+const size_t kMaxLevels = 32;
+
+struct Node
+{
+    GridBox box;
+    // Index of the first child on the level below or of the block for the leaves.
+    uint32_t child;
+};
+
+// Orders the nodes so that every 'node_size' consecutive ones are spatially close.
+void sortTileRecursive(std::vector<Node>& nodes, size_t node_size)
+{
+    if (nodes.empty())
+    {
+        return;
+    }
+    // Centers are compared as the sums of the bounds, ties are broken by the child
+    // so that the order doesn't depend on the sort implementation.
+    auto lon_less = [](const Node& a, const Node& b)
+    {
+        const uint64_t a_center = uint64_t(a.box.lon_min) + a.box.lon_max;
+        const uint64_t b_center = uint64_t(b.box.lon_min) + b.box.lon_max;
+        return a_center < b_center || (a_center == b_center && a.child < b.child);
+    };
+    auto lat_less = [](const Node& a, const Node& b)
+    {
+        const uint64_t a_center = uint64_t(a.box.lat_min) + a.box.lat_max;
+        const uint64_t b_center = uint64_t(b.box.lat_min) + b.box.lat_max;
+        return a_center < b_center || (a_center == b_center && a.child < b.child);
+    };
+
+    const size_t num_parents = (nodes.size() + node_size - 1) / node_size;
+    const size_t num_slices = size_t(std::ceil(std::sqrt(double(num_parents))));
+    const size_t slice_size = (num_parents + num_slices - 1) / num_slices * node_size;
+    std::sort(nodes.begin(), nodes.end(), lon_less);
+    for (size_t begin = 0; begin < nodes.size(); begin += slice_size)
+    {
+        const size_t end = std::min(begin + slice_size, nodes.size());
+        std::sort(nodes.begin() + begin, nodes.begin() + end, lat_less);
+    }
+}
+
+}
+
+Bytes buildSpatialBlockIndex(const std::vector<GridBox>& block_boxes, int bounding_box_bits, size_t node_size)
+{
+    // Levels from the leaves up to the root.
+    std::vector<std::vector<Node>> levels(1);
+    for (size_t i = 0; i < block_boxes.size(); ++i)
+    {
+        levels.back().push_back(Node{block_boxes[i], uint32_t(i)});
+    }
+    while (true)
+    {
+        std::vector<Node>& level = levels.back();
+        sortTileRecursive(level, node_size);
+        if (level.size() <= node_size)
+        {
+            break;
+        }
+        std::vector<Node> parents;
+        for (size_t begin = 0; begin < level.size(); begin += node_size)
+        {
+            Node parent{level[begin].box, uint32_t(begin)};
+            for (size_t i = begin + 1; i < std::min(begin + node_size, level.size()); ++i)
+            {
+                const GridBox& box = level[i].box;
+                parent.box.lat_min = std::min(parent.box.lat_min, box.lat_min);
+                parent.box.lon_min = std::min(parent.box.lon_min, box.lon_min);
+                parent.box.lat_max = std::max(parent.box.lat_max, box.lat_max);
+                parent.box.lon_max = std::max(parent.box.lon_max, box.lon_max);
+            }
+            parents.push_back(parent);
+        }
+        levels.push_back(std::move(parents));
+    }
+
+    const size_t coord_size = bounding_box_bits <= 16 ? sizeof(uint16_t) : sizeof(uint32_t);
+    Bytes output = asBytes(uint16_t(node_size));
+    output.push_back(uint8_t(coord_size));
+    output.push_back(uint8_t(levels.size()));
+    for (auto level = levels.rbegin(); level != levels.rend(); ++level)
+    {
+        appendBytes(asBytes(uint32_t(level->size())), output);
+    }
+    for (auto level = levels.rbegin(); level != levels.rend(); ++level)
+    {
+        for (const Node& node: *level)
+        {
+            appendLittleEndian(node.box.lat_min, coord_size, output);
+            appendLittleEndian(node.box.lon_min, coord_size, output);
+            appendLittleEndian(node.box.lat_max, coord_size, output);
+            appendLittleEndian(node.box.lon_max, coord_size, output);
+            appendBytes(asBytes(node.child), output);
+        }
+    }
+    return output;
+}
+
+SpatialBlockIndex::SpatialBlockIndex():
+    node_size_(0),
+    coord_size_(0),
+    entry_size_(0)
+{
+}
+
+bool SpatialBlockIndex::reset(const uint8_t* data, size_t size, size_t num_blocks, size_t& index_size)
+{
+    levels_.clear();
+    if (size < kHeaderSize || !num_blocks)
+    {
+        return false;
+    }
+    node_size_ = getLittleEndian(data, sizeof(uint16_t));
+    coord_size_ = data[sizeof(uint16_t)];
+    const size_t num_levels = data[sizeof(uint16_t) + 1];
+    if (node_size_ < 2 || (coord_size_ != sizeof(uint16_t) && coord_size_ != sizeof(uint32_t)) ||
+        !num_levels || num_levels > kMaxLevels || (size - kHeaderSize) / sizeof(uint32_t) < num_levels)
+    {
+        return false;
+    }
+    entry_size_ = 4 * coord_size_ + sizeof(uint32_t);
+
+    std::vector<Level> levels(num_levels);
+    const uint8_t* entries = data + kHeaderSize + num_levels * sizeof(uint32_t);
+    size_t remaining_size = size - (entries - data);
+    for (size_t i = 0; i < num_levels; ++i)
+    {
+        levels[i].num_entries = getLittleEndian(data + kHeaderSize + i * sizeof(uint32_t), sizeof(uint32_t));
+        levels[i].entries = entries;
+        if (remaining_size / entry_size_ < levels[i].num_entries)
+        {
+            return false;
+        }
+        entries += levels[i].num_entries * entry_size_;
+        remaining_size -= levels[i].num_entries * entry_size_;
+    }
+
+    // Every node except the last one on the level is full and the root fits into one node.
+    if (levels.back().num_entries != num_blocks || levels.front().num_entries > node_size_)
+    {
+        return false;
+    }
+    for (size_t i = 0; i + 1 < num_levels; ++i)
+    {
+        const size_t num_children = levels[i + 1].num_entries;
+        if (levels[i].num_entries != (num_children + node_size_ - 1) / node_size_)
+        {
+            return false;
+        }
+        for (size_t j = 0; j < levels[i].num_entries; ++j)
+        {
+            const uint32_t child = getChild(levels[i].entries + j * entry_size_);
+            if (child % node_size_ || child >= num_children)
+            {
+                return false;
+            }
+        }
+    }
+    for (size_t j = 0; j < num_blocks; ++j)
+    {
+        if (getChild(levels.back().entries + j * entry_size_) >= num_blocks)
+        {
+            return false;
+        }
+    }
+
+    levels_.swap(levels);
+    index_size = entries - data;
+    return true;
+}
+
+GridBox SpatialBlockIndex::getBox(const uint8_t* entry) const
+{
+    return GridBox{
+        uint32_t(getLittleEndian(entry, coord_size_)),
+        uint32_t(getLittleEndian(entry + coord_size_, coord_size_)),
+        uint32_t(getLittleEndian(entry + 2 * coord_size_, coord_size_)),
+        uint32_t(getLittleEndian(entry + 3 * coord_size_, coord_size_))};
+}
+
+uint32_t SpatialBlockIndex::getChild(const uint8_t* entry) const
+{
+    return getLittleEndian(entry + 4 * coord_size_, sizeof(uint32_t));
+}
+
+void SpatialBlockIndex::find(const GridBox& box, std::vector<size_t>& blocks) const
+{
+    if (levels_.empty())
+    {
+        return;
+    }
+    // Depth-first, so that the leaves are visited in order.
+    struct Range
+    {
+        size_t level, begin, end;
+    };
+    std::vector<Range> stack(1, Range{0, 0, levels_.front().num_entries});
+    while (!stack.empty())
+    {
+        Range& range = stack.back();
+        if (range.begin == range.end)
+        {
+            stack.pop_back();
+            continue;
+        }
+        const size_t level = range.level;
+        const uint8_t* entry = levels_[level].entries + range.begin++ * entry_size_;
+        if (!getBox(entry).intersects(box))
+        {
+            continue;
+        }
+        const uint32_t child = getChild(entry);
+        if (level + 1 == levels_.size())
+        {
+            blocks.push_back(child);
+        }
+        else
+        {
+            stack.push_back(Range{level + 1, child, std::min(child + node_size_, levels_[level + 1].num_entries)});
+        }
+    }
+}
@@ -0,0 +1,91 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "utils.h"
+
+// Bounding box of the block in the bounding box grid coordinates, see 'BlockInfo',
+// all bounds are inclusive.
+struct GridBox
+{
+    uint32_t lat_min, lon_min, lat_max, lon_max;
+
+    bool intersects(const GridBox& other) const
+    {
+        return lat_min <= other.lat_max && other.lat_min <= lat_max &&
+            lon_min <= other.lon_max && other.lon_min <= lon_max;
+    }
+};
+
+// Packed R-tree over the bounding boxes of all blocks, built with Sort-Tile-Recursive
+// algorithm: on every level the boxes are sorted by the longitude of their center,
+// cut into vertical slices and sorted by the latitude within each slice, then
+// grouped into the nodes of 'node_size' consecutive boxes. All nodes except the last
+// one on every level are full, so the children of the node are identified by the
+// index of the first one.
+//
+// Serialized layout, all values are little-endian:
+// - u16 node size, u8 size of the coordinates (2 or 4 bytes), u8 number of levels.
+// - u32 number of entries on every level, from the root down to the leaves.
+// - Entries of all levels in the same order, each with the coordinates of the box
+//   (lat min, lon min, lat max, lon max) and u32 index of the first child entry
+//   on the next level or, for the leaves, the index of the block.
+
+// Larger nodes make the index slightly smaller, but more boxes are checked per query.
+constexpr size_t kDefaultSpatialBlockIndexNodeSize = 16;
+
+// Returns the serialized index for the boxes of all blocks.
+Bytes buildSpatialBlockIndex(const std::vector<GridBox>& block_boxes, int bounding_box_bits, size_t node_size);
+
+class SpatialBlockIndex
+{
+  public:
+    SpatialBlockIndex();
+
+    // Uses the serialized index at 'data' in place, 'data' must outlive the index.
+    // Returns false if the index is malformed, otherwise sets 'index_size' to its size.
+    bool reset(const uint8_t* data, size_t size, size_t num_blocks, size_t& index_size);
+
+    bool empty() const { return levels_.empty(); }
+
+    // Appends the indices of all blocks whose boxes intersect 'box' to 'blocks', in the
+    // order of the leaves, which keeps the spatially close blocks together.
+    void find(const GridBox& box, std::vector<size_t>& blocks) const;
+
+  private:
+    struct Level
+    {
+        const uint8_t* entries;
+        size_t num_entries;
+    };
+
+    size_t node_size_;
+    size_t coord_size_;
+    size_t entry_size_;
+    std::vector<Level> levels_;
+
+    GridBox getBox(const uint8_t* entry) const;
+
+    uint32_t getChild(const uint8_t* entry) const;
+};
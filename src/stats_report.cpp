@@ -0,0 +1,205 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "stats_report.h"
+
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include <sys/resource.h>
+
+#include <glog/logging.h>
+
+namespace {
+
+double getProcessCpuTime()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + 1e-6 * (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+double getThreadCpuTime()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return time.tv_sec + 1e-9 * time.tv_nsec;
+}
+
+double getSeconds(std::chrono::steady_clock::duration duration)
+{
+    return std::chrono::duration<double>(duration).count();
+}
+
+std::string quote(const std::string& str)
+{
+    std::ostringstream os;
+    os << '"';
+    for (char c: str)
+    {
+        if (c == '"' || c == '\\')
+        {
+            os << '\\' << c;
+        }
+        else if (uint8_t(c) < 0x20)
+        {
+            os << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec;
+        }
+        else
+        {
+            os << c;
+        }
+    }
+    os << '"';
+    return os.str();
+}
+
+}  // namespace
+
+StatsReport::Phase::Phase(StatsReport* report, const std::string& name):
+    report_(report),
+    name_(name)
+{
+    if (report_)
+    {
+        resetPeakRss();
+        start_time_ = std::chrono::steady_clock::now();
+        start_cpu_time_ = getProcessCpuTime();
+    }
+}
+
+StatsReport::Phase::~Phase()
+{
+    if (report_)
+    {
+        report_->addPhase(PhaseStats{
+            name_,
+            getSeconds(std::chrono::steady_clock::now() - start_time_),
+            getProcessCpuTime() - start_cpu_time_,
+            getPeakRss()});
+    }
+}
+
+void StatsReport::Timer::start()
+{
+    start_time_ = std::chrono::steady_clock::now();
+    start_cpu_time_ = getThreadCpuTime();
+}
+
+void StatsReport::Timer::stop()
+{
+    wall_time_ += getSeconds(std::chrono::steady_clock::now() - start_time_);
+    cpu_time_ += getThreadCpuTime() - start_cpu_time_;
+}
+
+void StatsReport::setDataset(const std::string& name)
+{
+    datasets_.emplace_back();
+    datasets_.back().name = name;
+}
+
+StatsReport::Dataset& StatsReport::getDataset()
+{
+    CHECK(!datasets_.empty()) << "'setDataset' must be called first";
+    return datasets_.back();
+}
+
+void StatsReport::addPhase(const PhaseStats& phase)
+{
+    getDataset().phases.push_back(phase);
+}
+
+void StatsReport::addInputFile(const InputFileStats& input_file)
+{
+    getDataset().input_files.push_back(input_file);
+}
+
+void StatsReport::setParserStats(const ParserStats& parser_stats)
+{
+    getDataset().parser_stats = parser_stats;
+}
+
+void StatsReport::resetPeakRss()
+{
+    // Supported since Linux 4.0.
+    std::ofstream ofs("/proc/self/clear_refs");
+    ofs << "5";
+}
+
+uint64_t StatsReport::getPeakRss()
+{
+    std::ifstream ifs("/proc/self/status");
+    std::string line;
+    while (std::getline(ifs, line))
+    {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+        {
+            return 1024 * std::stoull(line.substr(6));
+        }
+    }
+    return 0;
+}
+
+bool StatsReport::write(const std::string& path) const
+{
+    std::ofstream os(path.c_str());
+    os << std::setprecision(6) << "{\n";
+    for (size_t i = 0; i < datasets_.size(); ++i)
+    {
+        const Dataset& dataset = datasets_[i];
+        const ParserStats& parser_stats = dataset.parser_stats;
+        os << "  " << quote(dataset.name) << ": {\n";
+
+        os << "    \"phases\": [";
+        for (size_t j = 0; j < dataset.phases.size(); ++j)
+        {
+            const PhaseStats& phase = dataset.phases[j];
+            os << (j ? ",\n" : "\n") << "      {\"name\": " << quote(phase.name) <<
+                ", \"wall_time_s\": " << phase.wall_time << ", \"cpu_time_s\": " << phase.cpu_time <<
+                ", \"peak_rss_bytes\": " << phase.peak_rss << "}";
+        }
+        os << "\n    ],\n";
+
+        os << "    \"input_files\": [";
+        for (size_t j = 0; j < dataset.input_files.size(); ++j)
+        {
+            const InputFileStats& input_file = dataset.input_files[j];
+            const double time = input_file.read_time + input_file.parse_time;
+            os << (j ? ",\n" : "\n") << "      {\"path\": " << quote(input_file.path) <<
+                ", \"rows\": " << input_file.rows << ", \"accepted_rows\": " << input_file.accepted_rows <<
+                ", \"read_time_s\": " << input_file.read_time << ", \"parse_time_s\": " << input_file.parse_time <<
+                ", \"rows_per_s\": " << (time > 0.0 ? input_file.rows / time : 0.0) << "}";
+        }
+        os << "\n    ],\n";
+
+        os << "    \"rows\": " << parser_stats.getNumRows() << ",\n";
+        os << "    \"rejected_rows\": {";
+        size_t j = 0;
+        for (const auto& rejection: parser_stats.getRejections())
+        {
+            os << (j++ ? ", " : "") << quote(rejection.first) << ": " << rejection.second;
+        }
+        os << "}\n";
+        os << "  }" << (i + 1 < datasets_.size() ? ",\n" : "\n");
+    }
+    os << "}\n";
+    return bool(os);
+}
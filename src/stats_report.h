@@ -0,0 +1,120 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "parser_stats.h"
+
+struct PhaseStats
+{
+    std::string name;
+    // In seconds, CPU time is of all threads of the process.
+    double wall_time, cpu_time;
+    // In bytes, 0 if not available.
+    uint64_t peak_rss;
+};
+
+struct InputFileStats
+{
+    std::string path;
+    uint64_t rows, accepted_rows;
+    // In seconds, the time spent in reading and decompression vs parsing.
+    double read_time, parse_time;
+};
+
+// Collects the timings, memory usage and input statistics of the build and
+// writes them as JSON. The statistics are grouped into datasets, e.g. "cells".
+class StatsReport
+{
+  public:
+    // Measures the phase from construction to destruction, no-op if 'report' is null.
+    class Phase
+    {
+      public:
+        Phase(StatsReport* report, const std::string& name);
+
+        ~Phase();
+
+        Phase(const Phase&) = delete;
+        Phase& operator=(const Phase&) = delete;
+
+      private:
+        StatsReport* report_;
+        std::string name_;
+        std::chrono::steady_clock::time_point start_time_;
+        double start_cpu_time_;
+    };
+
+    // Accumulates wall and CPU time of the calling thread over multiple intervals,
+    // for the phases that are interleaved with each other.
+    class Timer
+    {
+      public:
+        Timer(): wall_time_(0.0), cpu_time_(0.0) {}
+
+        void start();
+
+        void stop();
+
+        double getWallTime() const { return wall_time_; }
+
+        double getCpuTime() const { return cpu_time_; }
+
+      private:
+        std::chrono::steady_clock::time_point start_time_;
+        double start_cpu_time_;
+        double wall_time_, cpu_time_;
+    };
+
+    // All subsequent statistics are added to the dataset with this name.
+    void setDataset(const std::string& name);
+
+    void addPhase(const PhaseStats& phase);
+
+    void addInputFile(const InputFileStats& input_file);
+
+    void setParserStats(const ParserStats& parser_stats);
+
+    bool write(const std::string& path) const;
+
+    // Resets the peak RSS of the process, so that the next 'getPeakRss' only
+    // covers what follows. Not all kernels support it, in which case the peak
+    // is since the process start.
+    static void resetPeakRss();
+
+    static uint64_t getPeakRss();
+
+  private:
+    struct Dataset
+    {
+        std::string name;
+        std::vector<PhaseStats> phases;
+        std::vector<InputFileStats> input_files;
+        ParserStats parser_stats;
+    };
+
+    std::vector<Dataset> datasets_;
+
+    Dataset& getDataset();
+};
@@ -0,0 +1,125 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "trace_recorder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <limits>
+
+namespace {
+
+std::atomic<uint64_t> next_recorder_id(0);
+
+} // namespace
+
+TraceRecorder::Scope::Scope(TraceRecorder* recorder, const char* name, const char* category):
+    recorder_(recorder),
+    name_(name),
+    category_(category),
+    start_time_(recorder ? recorder->now() : 0),
+    num_args_(0)
+{
+}
+
+TraceRecorder::Scope::~Scope()
+{
+    if (recorder_)
+    {
+        Event event{name_, category_, start_time_, recorder_->now(), {}, {}, num_args_};
+        std::copy(arg_names_, arg_names_ + num_args_, event.arg_names);
+        std::copy(arg_values_, arg_values_ + num_args_, event.arg_values);
+        recorder_->getThreadEvents().events.push_back(event);
+    }
+}
+
+void TraceRecorder::Scope::addArg(const char* name, int64_t value)
+{
+    if (recorder_ && num_args_ < kMaxArgs)
+    {
+        arg_names_[num_args_] = name;
+        arg_values_[num_args_] = value;
+        ++num_args_;
+    }
+}
+
+TraceRecorder::TraceRecorder():
+    id_(next_recorder_id++),
+    start_time_(std::chrono::steady_clock::now())
+{
+}
+
+int64_t TraceRecorder::now() const
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start_time_).count();
+}
+
+void TraceRecorder::addEvent(const char* name, const char* category, int64_t start_time, int64_t end_time)
+{
+    getThreadEvents().events.push_back(Event{name, category, start_time, end_time, {}, {}, 0});
+}
+
+TraceRecorder::ThreadEvents& TraceRecorder::getThreadEvents()
+{
+    // Recorder IDs are never reused, so the cache can't point to the events of the destroyed recorder.
+    thread_local uint64_t cached_id = std::numeric_limits<uint64_t>::max();
+    thread_local ThreadEvents* cached_events = nullptr;
+    if (cached_id != id_)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        threads_.emplace_back(new ThreadEvents{int(threads_.size()), {}});
+        cached_id = id_;
+        cached_events = threads_.back().get();
+    }
+    return *cached_events;
+}
+
+bool TraceRecorder::write(const std::string& path) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::ofstream os(path.c_str());
+    os << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    bool first = true;
+    for (const auto& thread: threads_)
+    {
+        os << (first ? "\n" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " <<
+            thread->tid << ", \"args\": {\"name\": \"thread " << thread->tid << "\"}}";
+        first = false;
+        for (const Event& event: thread->events)
+        {
+            os << ",\n{\"name\": \"" << event.name << "\", \"cat\": \"" << event.category <<
+                "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << thread->tid << ", \"ts\": " << event.start_time <<
+                ", \"dur\": " << event.end_time - event.start_time;
+            if (event.num_args)
+            {
+                os << ", \"args\": {";
+                for (int i = 0; i < event.num_args; ++i)
+                {
+                    os << (i ? ", \"" : "\"") << event.arg_names[i] << "\": " << event.arg_values[i];
+                }
+                os << "}";
+            }
+            os << "}";
+        }
+    }
+    os << "\n]}\n";
+    return bool(os);
+}
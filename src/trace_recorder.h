@@ -0,0 +1,99 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Records the timeline of the build work per thread and writes it in Chrome
+// trace event format, which can be inspected in Perfetto or chrome://tracing.
+//
+// The events are buffered per thread, so recording from parallel loops needs
+// no synchronization except for the first event of every thread.
+class TraceRecorder
+{
+  public:
+    static constexpr int kMaxArgs = 2;
+
+    // Records the event from construction to destruction, no-op if 'recorder' is null.
+    // 'name', 'category' and the argument names must be string literals.
+    class Scope
+    {
+      public:
+        Scope(TraceRecorder* recorder, const char* name, const char* category);
+
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        // Adds the argument shown with the event, at most kMaxArgs are kept.
+        void addArg(const char* name, int64_t value);
+
+      private:
+        TraceRecorder* recorder_;
+        const char* name_;
+        const char* category_;
+        int64_t start_time_;
+        const char* arg_names_[kMaxArgs];
+        int64_t arg_values_[kMaxArgs];
+        int num_args_;
+    };
+
+    TraceRecorder();
+
+    // Microseconds since the recorder creation.
+    int64_t now() const;
+
+    // Records the event of the calling thread, for the work that doesn't map to a single scope.
+    void addEvent(const char* name, const char* category, int64_t start_time, int64_t end_time);
+
+    bool write(const std::string& path) const;
+
+  private:
+    struct Event
+    {
+        const char* name;
+        const char* category;
+        int64_t start_time, end_time;
+        const char* arg_names[kMaxArgs];
+        int64_t arg_values[kMaxArgs];
+        int num_args;
+    };
+
+    struct ThreadEvents
+    {
+        int tid;
+        std::vector<Event> events;
+    };
+
+    // Distinguishes the recorders in the per thread cache, see 'getThreadEvents'. Only the
+    // last used recorder is cached, so a thread should record into a single recorder.
+    const uint64_t id_;
+    const std::chrono::steady_clock::time_point start_time_;
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<ThreadEvents>> threads_;
+
+    ThreadEvents& getThreadEvents();
+};
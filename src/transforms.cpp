@@ -0,0 +1,198 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "transforms.h"
+
+#include <glog/logging.h>
+
+#include <function/ZRLT.hpp>
+#include <transform/BWTS.hpp>
+#include <transform/SBRT.hpp>
+
+#include "dwarf_idea_format.h"
+
+namespace {
+
+Bytes bwtsForward(const Bytes& input)
+{
+    // Step 1: BWTS
+    kanzi::BWTS bwts;
+    Bytes bwts_output(input.size(), 0);
+    auto bwts_sliced_input = kanzi::SliceArray<byte>((byte*)input.data(), input.size(), 0);
+    auto bwts_sliced_output = kanzi::SliceArray<byte>((byte*)bwts_output.data(), bwts_output.size(), 0);
+    CHECK(bwts.forward(bwts_sliced_input, bwts_sliced_output, input.size())) << "BWTS failed";
+
+    // Step 2: SBRT
+    kanzi::SBRT sbrt(kanzi::SBRT::MODE_RANK);
+    Bytes sbrt_output(bwts_output.size(), 0);
+    auto sbrt_sliced_input = kanzi::SliceArray<byte>((byte*)bwts_output.data(), bwts_output.size(), 0);
+    auto sbrt_sliced_output = kanzi::SliceArray<byte>((byte*)sbrt_output.data(), sbrt_output.size(), 0);
+    CHECK(sbrt.forward(sbrt_sliced_input, sbrt_sliced_output, bwts_output.size())) << "SBRT failed";
+    return sbrt_output;
+}
+
+bool bwtsInverse(Bytes& data)
+{
+    kanzi::SBRT sbrt(kanzi::SBRT::MODE_RANK);
+    Bytes sbrt_output(data.size(), 0);
+    auto sbrt_sliced_input = kanzi::SliceArray<byte>((byte*)data.data(), data.size(), 0);
+    auto sbrt_sliced_output = kanzi::SliceArray<byte>((byte*)sbrt_output.data(), sbrt_output.size(), 0);
+    if (!sbrt.inverse(sbrt_sliced_input, sbrt_sliced_output, data.size()))
+    {
+        return false;
+    }
+
+    kanzi::BWTS bwts;
+    auto bwts_sliced_input = kanzi::SliceArray<byte>((byte*)sbrt_output.data(), sbrt_output.size(), 0);
+    auto bwts_sliced_output = kanzi::SliceArray<byte>((byte*)data.data(), data.size(), 0);
+    return bwts.inverse(bwts_sliced_input, bwts_sliced_output, sbrt_output.size());
+}
+
+// Byte-wise delta with zigzag encoding, so that small negative differences
+// become small positive values.
+Bytes deltaForward(const Bytes& input)
+{
+    Bytes output(input.size(), 0);
+    uint8_t prev = 0;
+    for (size_t i = 0; i < input.size(); ++i)
+    {
+        int8_t delta = int8_t(input[i] - prev);
+        output[i] = uint8_t((delta << 1) ^ (delta >> 7));
+        prev = input[i];
+    }
+    return output;
+}
+
+void deltaInverse(Bytes& data)
+{
+    uint8_t prev = 0;
+    for (uint8_t& value: data)
+    {
+        prev += uint8_t((value >> 1) ^ -(value & 1));
+        value = prev;
+    }
+}
+
+// Returns ZRLT output + stream flags, falls back to the input if ZRLT expands the data.
+Bytes zrltForward(Bytes input)
+{
+    kanzi::ZRLT zrlt;
+    Bytes zrlt_output(input.size(), 0);
+    auto zrlt_sliced_input = kanzi::SliceArray<byte>((byte*)input.data(), input.size(), 0);
+    auto zrlt_sliced_output = kanzi::SliceArray<byte>((byte*)zrlt_output.data(), zrlt_output.size(), 0);
+    if (zrlt.forward(zrlt_sliced_input, zrlt_sliced_output, input.size()))
+    {
+        zrlt_output.resize(zrlt_sliced_output._index + 1);
+        zrlt_output.back() = 0;
+        return zrlt_output;
+    }
+    else
+    {
+        input.push_back(kStreamFlagNoZrlt);
+        return input;
+    }
+}
+
+bool zrltInverse(const uint8_t* data, size_t size, size_t max_size, Bytes& output)
+{
+    kanzi::ZRLT zrlt;
+    output.resize(max_size);
+    auto zrlt_sliced_input = kanzi::SliceArray<byte>((byte*)data, size, 0);
+    auto zrlt_sliced_output = kanzi::SliceArray<byte>((byte*)output.data(), output.size(), 0);
+    if (!zrlt.inverse(zrlt_sliced_input, zrlt_sliced_output, size))
+    {
+        return false;
+    }
+    output.resize(zrlt_sliced_output._index);
+    return true;
+}
+
+}
+
+Bytes forwardTransform(TransformChain chain, const Bytes& input)
+{
+    switch (chain)
+    {
+        case TransformChain::kBwts:
+            return zrltForward(bwtsForward(input));
+        case TransformChain::kDelta:
+            return zrltForward(deltaForward(input));
+        case TransformChain::kZrlt:
+            return zrltForward(input);
+    }
+    LOG(FATAL) << "Unknown transform chain " << int(chain);
+    return Bytes();
+}
+
+bool inverseTransform(
+    TransformChain chain, const uint8_t* data, size_t size, uint8_t flags,
+    size_t max_size, Bytes& output)
+{
+    if (flags & kStreamFlagNoZrlt)
+    {
+        if (size > max_size)
+        {
+            return false;
+        }
+        output.assign(data, data + size);
+    }
+    else if (!zrltInverse(data, size, max_size, output))
+    {
+        return false;
+    }
+
+    switch (chain)
+    {
+        case TransformChain::kBwts:
+            return bwtsInverse(output);
+        case TransformChain::kDelta:
+            deltaInverse(output);
+            return true;
+        case TransformChain::kZrlt:
+            return true;
+    }
+    return false;
+}
+
+TransformChain parseTransformChain(const std::string& name)
+{
+    for (TransformChain chain: kAllTransformChains)
+    {
+        if (name == getTransformChainName(chain))
+        {
+            return chain;
+        }
+    }
+    LOG(FATAL) << "Unknown transform chain " << name;
+    return TransformChain::kBwts;
+}
+
+const char* getTransformChainName(TransformChain chain)
+{
+    switch (chain)
+    {
+        case TransformChain::kBwts:
+            return "bwts";
+        case TransformChain::kDelta:
+            return "delta";
+        case TransformChain::kZrlt:
+            return "zrlt";
+    }
+    return "unknown";
+}
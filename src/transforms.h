@@ -0,0 +1,60 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <string>
+
+#include "utils.h"
+
+// Transform chains applied to the block streams before entropy coding, the values
+// are stored in the header of the files that use kFormatFlagTransformChain so must
+// not be changed.
+enum class TransformChain: uint8_t
+{
+    // BWTS + SBRT + ZRLT: the best compression ratio, but inverse BWTS is
+    // the most expensive step of decoding the block.
+    kBwts = 0,
+    // Byte-wise delta + zigzag + ZRLT: much cheaper to decode.
+    kDelta = 1,
+    // ZRLT only: the cheapest to decode.
+    kZrlt = 2,
+};
+
+constexpr TransformChain kAllTransformChains[] =
+{
+    TransformChain::kBwts,
+    TransformChain::kDelta,
+    TransformChain::kZrlt,
+};
+
+// Applies the transform chain to the input, the last byte of the output
+// contains the stream flags, see 'StreamFlags'.
+Bytes forwardTransform(TransformChain chain, const Bytes& input);
+
+// Reverts 'forwardTransform' given its output without the last byte and the
+// stream flags. 'max_size' is the upper bound of the original data size.
+// Returns false if the data is malformed.
+bool inverseTransform(
+    TransformChain chain, const uint8_t* data, size_t size, uint8_t flags,
+    size_t max_size, Bytes& output);
+
+TransformChain parseTransformChain(const std::string& name);
+
+const char* getTransformChainName(TransformChain chain);
@@ -18,6 +18,7 @@
 
 #include "utils.h"
 
+#include <algorithm>
 #include <cmath>
 
 double getDist(const Point& pnt0, const Point& pnt1)
@@ -27,3 +28,34 @@ double getDist(const Point& pnt0, const Point& pnt1)
   return kEarthRadius * 2.0 * std::asin(std::sqrt(sin_lat_2 * sin_lat_2 +
       std::cos(pnt0.lat * M_PI / 180.0) * std::cos(pnt1.lat * M_PI / 180.0) * sin_lon_2 * sin_lon_2));
 }
+
+uint8_t packExtraData(int radius, int samples)
+{
+    radius = std::min(kMaxRadius, std::max(kMinRadius, radius));
+    samples = std::max(0, std::min(kMaxSamples, samples));
+    return (samples << 4) | ((radius - kMinRadius) / kRadiusStep);
+}
+
+void unpackExtraData(uint8_t value, int& radius, int& samples)
+{
+    radius = kMinRadius + (value & 0xF) * kRadiusStep;
+    samples = value >> 4;
+}
+
+uint64_t getLittleEndian(const uint8_t* data, size_t size)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+        value |= uint64_t(data[i]) << (8 * i);
+    }
+    return value;
+}
+
+void appendLittleEndian(uint64_t value, size_t size, Bytes& output)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        output.push_back(uint8_t(value >> (8 * i)));
+    }
+}
@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <cstring>
 #include <ostream>
 #include <string>
 #include <sstream>
@@ -26,6 +27,8 @@
 #include <glog/logging.h>
 
 constexpr int kBssidKeySize = 6;
+// The vendor part of BSSID.
+constexpr int kOuiSize = 3;
 constexpr int kCellKeySize = 10;
 constexpr int kCellExtraDataSize = 1;
 constexpr int kBssidExtraDataSize = 0;
@@ -35,6 +38,13 @@ constexpr float kMinLon = -180.0;
 constexpr float kMaxLon = 180.0;
 constexpr double kEarthRadius = 6371000.0;
 
+// Cells extra data packs the coverage radius, in meters, and the number of
+// samples into a single byte, see 'packExtraData'.
+constexpr int kMinRadius = 500;
+constexpr int kRadiusStep = 100;
+constexpr int kMaxRadius = kMinRadius + kRadiusStep * 15;
+constexpr int kMaxSamples = 15;
+
 typedef std::vector<uint8_t> Bytes;
 
 template <typename T>
@@ -73,6 +83,44 @@ Bytes asBytes(T value, bool big_endian=false)
     return output;
 }
 
+// Appends the value as LEB128 varint, avoids the temporary of 'asVarInt' in tight loops.
+template <typename T>
+void appendVarInt(T value, Bytes& output)
+{
+    while (value >= 0x80)
+    {
+        output.push_back((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    output.push_back(value);
+}
+
+template <typename T>
+Bytes asVarInt(T value)
+{
+    Bytes result;
+    appendVarInt(value, result);
+    return result;
+}
+
+// Reads the value encoded with 'asVarInt' and advances 'data' past it.
+// Returns false if the input is truncated or malformed.
+template <typename T>
+bool readVarInt(const uint8_t*& data, const uint8_t* end, T& value)
+{
+    value = 0;
+    for (unsigned shift = 0; data != end && shift < 8 * sizeof(T); shift += 7)
+    {
+        uint8_t c = *data++;
+        value |= T(c & 0x7F) << shift;
+        if (!(c & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 template <typename T>
 void putValue(T value, std::ostream& os, bool big_endian=false)
 {
@@ -86,6 +134,67 @@ void appendBytes(const T& src_bytes, Bytes& dst_bytes)
     dst_bytes.insert(dst_bytes.end(), src_bytes.begin(), src_bytes.end());
 }
 
+// Reads the 'size' bytes long little endian value, for the fields of the sections
+// read in place, which may be narrower than their type.
+uint64_t getLittleEndian(const uint8_t* data, size_t size);
+
+// Appends the lowest 'size' bytes of the value in little endian order, see 'getLittleEndian'.
+void appendLittleEndian(uint64_t value, size_t size, Bytes& output);
+
+// Sequential reader of the values written with 'putValue'.
+class BytesReader
+{
+  public:
+    BytesReader(const uint8_t* data, const uint8_t* end): data_(data), end_(end) {}
+
+    template <typename T>
+    bool get(T& value)
+    {
+        const uint8_t* bytes = nullptr;
+        if (!getBytes(sizeof(T), bytes))
+        {
+            return false;
+        }
+        value = asInt<T>(Bytes(bytes, bytes + sizeof(T)));
+        return true;
+    }
+
+    // Floats are written in the native representation.
+    bool get(float& value)
+    {
+        const uint8_t* bytes = nullptr;
+        if (!getBytes(sizeof(value), bytes))
+        {
+            return false;
+        }
+        memcpy(&value, bytes, sizeof(value));
+        return true;
+    }
+
+    bool getBytes(size_t size, const uint8_t*& bytes)
+    {
+        if (size_t(end_ - data_) < size)
+        {
+            return false;
+        }
+        bytes = data_;
+        data_ += size;
+        return true;
+    }
+
+    template <typename T>
+    bool getVarInt(T& value)
+    {
+        return readVarInt(data_, end_, value);
+    }
+
+    const uint8_t* getPos() const { return data_; }
+
+  private:
+    const uint8_t* data_;
+    const uint8_t* end_;
+};
+
 struct __attribute__((__packed__)) Point
 {
     float lat, lon;
@@ -95,3 +204,9 @@ struct __attribute__((__packed__)) Point
 };
 
 double getDist(const Point& pnt0, const Point& pnt1);
+
+// Packs the radius and the number of samples into the extra data byte, the values
+// outside of the supported ranges are clamped.
+uint8_t packExtraData(int radius, int samples);
+
+void unpackExtraData(uint8_t value, int& radius, int& samples);
@@ -0,0 +1,532 @@
+// DwarfIdea - offline network-based location format, tooling and libraries,
+// see https://endl.ch/projects/dwarf-idea
+//
+// Copyright (C) 2019 - 2020 Alexander Tsvyashchenko <android@endl.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Round trip of the small synthetic DBs through the builder and the reader for
+// the combinations of the format flags: every lookup path has to return exactly
+// the entries the full block decoding returns, and those have to match the
+// added entries within the requested error.
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "block_patch.h"
+#include "bssids_dwarf_idea_builder.h"
+#include "cells_dwarf_idea_builder.h"
+#include "dwarf_idea_format.h"
+#include "dwarf_idea_reader.h"
+#include "utils.h"
+
+namespace {
+
+struct Entry
+{
+    std::string key;
+    Point point;
+    std::string extra_data;
+};
+
+enum class DbType
+{
+    kCells,
+    kBssids,
+};
+
+struct RoundTripParams
+{
+    const char* name;
+    DbType db_type;
+    std::function<void(DwarfIdeaBuilderOptions&)> set_options;
+    // Format flags the DB must have, to make sure the tested paths are actually used.
+    uint32_t format_flags;
+};
+
+std::ostream& operator<<(std::ostream& os, const RoundTripParams& params)
+{
+    return os << params.name;
+}
+
+// Cities the entries are clustered around, including ones close to the antimeridian.
+const Point kCities[] =
+{
+    Point(47.37f, 8.54f),
+    Point(55.75f, 37.62f),
+    Point(40.71f, -74.01f),
+    Point(-33.87f, 151.21f),
+    Point(-17.80f, 179.95f),
+    Point(65.00f, -179.90f),
+};
+
+Point getCityPoint(std::mt19937_64& rng, double sigma)
+{
+    std::normal_distribution<double> dist(0.0, sigma);
+    const Point& city = kCities[rng() % std::size(kCities)];
+    double lon = city.lon + dist(rng);
+    lon = lon > 180.0 ? lon - 360.0 : (lon < -180.0 ? lon + 360.0 : lon);
+    return Point(float(city.lat + dist(rng)), float(lon));
+}
+
+// LTE-like cells: eNB ID * 256 + sector, with irregular eNB ID steps and sector sets, so
+// that the split keys pay off.
+std::vector<Entry> generateCells(size_t num_entries, uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+    const std::vector<std::vector<int>> kSectorSets = {{1, 2, 3}, {1, 2, 3, 11, 12, 13}, {21, 22, 23, 31, 32, 33}};
+    const int kEnbIdSteps[] = {1, 1, 1, 2, 3, 7, 20};
+    std::vector<Entry> entries;
+    for (uint16_t mcc: {228, 250, 310})
+    {
+        for (uint16_t mnc = 1; mnc <= 3; ++mnc)
+        {
+            uint32_t enb_id = rng() % 100000;
+            // Different per operator, so that the blocks of different operators use different
+            // entropy coding tables with kFormatFlagEntropyTables.
+            const int extra_data_base = rng() % 8 * 2;
+            for (uint16_t lac = 1; lac <= 4; ++lac)
+            {
+                for (size_t site = 0; site < num_entries / 36 / 3; ++site)
+                {
+                    enb_id += kEnbIdSteps[rng() % std::size(kEnbIdSteps)];
+                    const Point site_point = getCityPoint(rng, 0.1);
+                    std::normal_distribution<double> sector_dist(0.0, 0.001);
+                    for (int sector: kSectorSets[rng() % kSectorSets.size()])
+                    {
+                        if (rng() % 8 == 0)
+                        {
+                            continue;
+                        }
+                        Bytes key;
+                        appendBytes(asBytes(mcc, true), key);
+                        appendBytes(asBytes(mnc, true), key);
+                        appendBytes(asBytes(lac, true), key);
+                        appendBytes(asBytes(uint32_t(enb_id * 256 + sector), true), key);
+                        entries.push_back(Entry{std::string(key.begin(), key.end()),
+                            Point(float(site_point.lat + sector_dist(rng)), float(site_point.lon)),
+                            std::string(1, char(extra_data_base + rng() % 2))});
+                    }
+                }
+            }
+        }
+    }
+    return entries;
+}
+
+std::vector<Entry> generateBssids(size_t num_entries, uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+    std::vector<uint32_t> ouis(50);
+    for (uint32_t& oui: ouis)
+    {
+        oui = rng() & 0xFFFFFF;
+    }
+    std::set<uint64_t> bssids;
+    while (bssids.size() < num_entries)
+    {
+        bssids.insert((uint64_t(ouis[rng() % ouis.size()]) << 24) | (rng() & 0xFFFFFF));
+    }
+    std::vector<Entry> entries;
+    for (uint64_t bssid: bssids)
+    {
+        const Bytes key = asBytes(bssid, true);
+        entries.push_back(Entry{std::string(key.end() - kBssidKeySize, key.end()), getCityPoint(rng, 0.5), ""});
+    }
+    return entries;
+}
+
+std::vector<Entry> generateEntries(DbType db_type, uint64_t seed)
+{
+    return db_type == DbType::kCells ? generateCells(6000, seed) : generateBssids(6000, seed);
+}
+
+// Moves some of the entries, removes some and adds new ones.
+std::vector<Entry> updateEntries(DbType db_type, const std::vector<Entry>& entries)
+{
+    std::vector<Entry> updated_entries;
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        if (i % 997 == 5)
+        {
+            continue;
+        }
+        updated_entries.push_back(entries[i]);
+        if (i % 1499 == 7)
+        {
+            updated_entries.back().point.lat += 0.01f;
+        }
+    }
+    std::set<std::string> keys;
+    for (const Entry& entry: entries)
+    {
+        keys.insert(entry.key);
+    }
+    for (const Entry& entry: generateEntries(db_type, 12345))
+    {
+        if (!keys.count(entry.key) && updated_entries.size() < entries.size() + 20)
+        {
+            updated_entries.push_back(entry);
+        }
+    }
+    // The builder expects the keys in ascending order, as 'LocationAggregator' adds them.
+    std::sort(updated_entries.begin(), updated_entries.end(), [](const Entry& entry0, const Entry& entry1)
+    {
+        return entry0.key < entry1.key;
+    });
+    return updated_entries;
+}
+
+std::string readFile(const std::string& path)
+{
+    std::ifstream is(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+}
+
+bool isSameEntry(const AreaEntry& entry0, const AreaEntry& entry1)
+{
+    return entry0.mapped_key == entry1.mapped_key && entry0.point.lat == entry1.point.lat &&
+        entry0.point.lon == entry1.point.lon && entry0.extra_data == entry1.extra_data;
+}
+
+class RoundTripTest: public ::testing::TestWithParam<RoundTripParams>
+{
+  protected:
+    void TearDown() override
+    {
+        for (const std::string& path: paths_)
+        {
+            std::remove(path.c_str());
+        }
+    }
+
+    DwarfIdeaBuilderOptions getOptions() const
+    {
+        DwarfIdeaBuilderOptions options;
+        // Small blocks, so that even the small DBs have enough of them.
+        options.min_entries_per_block = 16;
+        options.max_entries_per_block = 64;
+        GetParam().set_options(options);
+        return options;
+    }
+
+    // Builds the DB of the entries and returns its path.
+    std::string build(const std::vector<Entry>& entries, const DwarfIdeaBuilderOptions& options)
+    {
+        std::unique_ptr<IDwarfIdeaBuilder> builder;
+        if (GetParam().db_type == DbType::kCells)
+        {
+            builder.reset(new CellsDwarfIdeaBuilder(options));
+        }
+        else
+        {
+            builder.reset(new BssidsDwarfIdeaBuilder(options));
+        }
+        for (const Entry& entry: entries)
+        {
+            builder->addLocation(entry.key, entry.point.lat, entry.point.lon, entry.extra_data);
+        }
+        const std::string path = ::testing::TempDir() + "dwarf_idea_roundtrip_" + GetParam().name + "_" +
+            std::to_string(paths_.size()) + ".dwarf";
+        paths_.push_back(path);
+        {
+            std::ofstream os(path, std::ios::binary);
+            builder->build(os);
+            EXPECT_TRUE(os.flush());
+        }
+        builder->verify(path);
+        return path;
+    }
+
+    // Decodes all blocks of the DB and returns their entries by mapped key.
+    std::map<uint64_t, AreaEntry> decodeAll(const DwarfIdeaReader& reader) const
+    {
+        std::map<uint64_t, AreaEntry> decoded_entries;
+        const size_t extra_data_size = reader.getHeader().extra_data_size;
+        for (size_t i = 0; i < reader.getNumBlocks(); ++i)
+        {
+            DecodedBlock block;
+            EXPECT_TRUE(reader.decodeBlock(i, block)) << "block " << i;
+            for (size_t j = 0; j < block.size(); ++j)
+            {
+                decoded_entries[block.keys[j]] = AreaEntry{block.keys[j], block.getPoint(j),
+                    std::string(block.extra_data.begin() + j * extra_data_size,
+                                block.extra_data.begin() + (j + 1) * extra_data_size)};
+            }
+        }
+        return decoded_entries;
+    }
+
+    std::vector<std::string> paths_;
+};
+
+TEST_P(RoundTripTest, Lookup)
+{
+    const std::vector<Entry> entries = generateEntries(GetParam().db_type, 1);
+    const DwarfIdeaBuilderOptions options = getOptions();
+    DwarfIdeaReader reader;
+    ASSERT_TRUE(reader.open(build(entries, options)));
+    EXPECT_EQ(reader.getHeader().format_flags & GetParam().format_flags, GetParam().format_flags);
+    EXPECT_EQ(reader.getHeader().num_entries, entries.size());
+
+    const std::map<uint64_t, AreaEntry> decoded_entries = decodeAll(reader);
+    ASSERT_EQ(decoded_entries.size(), entries.size());
+    std::vector<std::string> keys;
+    for (const Entry& entry: entries)
+    {
+        uint64_t mapped_key;
+        ASSERT_TRUE(reader.mapKey(entry.key, mapped_key));
+        std::string key;
+        ASSERT_TRUE(reader.unmapKey(mapped_key, key));
+        EXPECT_EQ(key, entry.key);
+        auto it = decoded_entries.find(mapped_key);
+        ASSERT_NE(it, decoded_entries.end());
+        EXPECT_LE(getDist(entry.point, it->second.point), options.max_dist_error);
+        EXPECT_EQ(it->second.extra_data, entry.extra_data);
+
+        Point point;
+        std::string extra_data;
+        ASSERT_TRUE(reader.lookup(entry.key, point, &extra_data));
+        EXPECT_TRUE(point.lat == it->second.point.lat && point.lon == it->second.point.lon);
+        EXPECT_EQ(extra_data, entry.extra_data);
+        EXPECT_TRUE(reader.mayContain(mapped_key));
+        keys.push_back(entry.key);
+
+        // The neighbouring keys are mostly absent, which checks the negative lookups
+        // within the blocks, before the first block and after the last one.
+        for (uint64_t absent_key: {mapped_key - 1, mapped_key + 1})
+        {
+            if (!decoded_entries.count(absent_key))
+            {
+                EXPECT_FALSE(reader.lookupMappedKey(absent_key, point)) << absent_key;
+                if (reader.unmapKey(absent_key, key))
+                {
+                    keys.push_back(key);
+                }
+            }
+        }
+    }
+
+    // The batch has the absent keys and the duplicates, not in the keys order.
+    std::mt19937_64 rng(2);
+    std::shuffle(keys.begin(), keys.end(), rng);
+    keys.insert(keys.end(), keys.begin(), keys.begin() + 100);
+    for (int num_threads: {1, 4})
+    {
+        std::vector<LookupResult> results(keys.size());
+        reader.lookupBatch(keys.data(), keys.size(), results.data(), num_threads);
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            Point point;
+            std::string extra_data;
+            const bool found = reader.lookup(keys[i], point, &extra_data);
+            ASSERT_EQ(results[i].found, found) << i;
+            if (found)
+            {
+                EXPECT_TRUE(results[i].point.lat == point.lat && results[i].point.lon == point.lon) << i;
+                EXPECT_EQ(results[i].extra_data, extra_data);
+            }
+        }
+    }
+}
+
+TEST_P(RoundTripTest, AreaQueries)
+{
+    const std::vector<Entry> entries = generateEntries(GetParam().db_type, 1);
+    DwarfIdeaReader reader;
+    ASSERT_TRUE(reader.open(build(entries, getOptions())));
+    std::vector<AreaEntry> found_entries;
+    if (!reader.hasSpatialIndex())
+    {
+        EXPECT_FALSE(reader.findEntriesInBox(Point(-90.0f, -180.0f), Point(90.0f, 180.0f), found_entries));
+        return;
+    }
+
+    const std::map<uint64_t, AreaEntry> decoded_entries = decodeAll(reader);
+    auto check = [&](const std::function<bool(const Point&)>& contains)
+    {
+        std::vector<AreaEntry> expected_entries;
+        for (const auto& key_entry: decoded_entries)
+        {
+            if (contains(key_entry.second.point))
+            {
+                expected_entries.push_back(key_entry.second);
+            }
+        }
+        std::sort(found_entries.begin(), found_entries.end(), [](const AreaEntry& entry0, const AreaEntry& entry1)
+        {
+            return entry0.mapped_key < entry1.mapped_key;
+        });
+        EXPECT_FALSE(expected_entries.empty());
+        EXPECT_TRUE(std::equal(found_entries.begin(), found_entries.end(),
+                               expected_entries.begin(), expected_entries.end(), isSameEntry));
+    };
+
+    for (const Point& city: kCities)
+    {
+        const Point min_corner(city.lat - 0.05f, city.lon - 0.1f), max_corner(city.lat + 0.1f, city.lon + 0.05f);
+        ASSERT_TRUE(reader.findEntriesInBox(min_corner, max_corner, found_entries));
+        check([&](const Point& point)
+        {
+            return point.lat >= min_corner.lat && point.lat <= max_corner.lat &&
+                point.lon >= min_corner.lon && point.lon <= max_corner.lon;
+        });
+
+        ASSERT_TRUE(reader.findEntriesInRadius(city, 10000.0, found_entries));
+        check([&](const Point& point) { return getDist(city, point) <= 10000.0; });
+    }
+
+    // The box crossing the antimeridian.
+    const Point min_corner(-18.0f, 179.9f), max_corner(66.0f, -179.8f);
+    ASSERT_TRUE(reader.findEntriesInBox(min_corner, max_corner, found_entries));
+    check([&](const Point& point)
+    {
+        return point.lat >= min_corner.lat && point.lat <= max_corner.lat &&
+            (point.lon >= min_corner.lon || point.lon <= max_corner.lon);
+    });
+}
+
+TEST_P(RoundTripTest, BlockPatch)
+{
+    const std::vector<Entry> entries = generateEntries(GetParam().db_type, 1);
+    DwarfIdeaBuilderOptions options = getOptions();
+    const std::string old_path = build(entries, options);
+    options.previous_path = old_path;
+    // Rebuilding the same entries anchored to the previous build reproduces it.
+    const std::string same_path = build(entries, options);
+    EXPECT_EQ(readFile(same_path), readFile(old_path));
+
+    const std::string new_path = build(updateEntries(GetParam().db_type, entries), options);
+    DwarfIdeaReader old_db, new_db;
+    ASSERT_TRUE(old_db.open(old_path));
+    ASSERT_TRUE(new_db.open(new_path));
+    BlockPatchStats stats;
+    const Bytes patch = createBlockPatch(old_db, new_db, &stats);
+    EXPECT_EQ(stats.num_blocks, new_db.getNumBlocks());
+    EXPECT_GT(stats.num_copied_blocks, stats.num_blocks / 2);
+
+    std::ostringstream os;
+    ASSERT_TRUE(applyBlockPatch(old_db, patch.data(), patch.size(), os));
+    EXPECT_EQ(os.str(), readFile(new_path));
+    // The patch for the other old file is rejected.
+    ASSERT_FALSE(applyBlockPatch(new_db, patch.data(), patch.size(), os));
+}
+
+const RoundTripParams kRoundTripParams[] =
+{
+    {"CellsDefault", DbType::kCells, [](DwarfIdeaBuilderOptions&) {}, 0},
+    {"CellsConservative", DbType::kCells, [](DwarfIdeaBuilderOptions& options)
+    {
+        options.coords_quantization = CoordsQuantization::kConservative;
+    }, 0},
+    {"CellsExact", DbType::kCells, [](DwarfIdeaBuilderOptions& options)
+    {
+        options.coords_quantization = CoordsQuantization::kExact;
+        options.max_dist_error = 10.0f;
+    }, kFormatFlagCoordsSteps},
+    {"CellsHuffmanDelta", DbType::kCells, [](DwarfIdeaBuilderOptions& options)
+    {
+        options.keys_codec = options.coords_codec = options.extra_data_codec = EntropyCodecType::kHuffman;
+        options.transform_chain = TransformChain::kDelta;
+    }, kFormatFlagEntropyCodecs | kFormatFlagTransformChain},
+    {"CellsRansZrlt", DbType::kCells, [](DwarfIdeaBuilderOptions& options)
+    {
+        options.keys_codec = EntropyCodecType::kRans;
+        options.coords_codec = EntropyCodecType::kHuffman;
+        options.transform_chain = TransformChain::kZrlt;
+    }, kFormatFlagEntropyCodecs | kFormatFlagTransformChain},
+    {"CellsEntropyTablesSampled", DbType::kCells, [](DwarfIdeaBuilderOptions& options)
+    {
+        // BWTS chain ranks the symbols, which makes the blocks statistics too similar to cluster.
+        options.transform_chain = TransformChain::kZrlt;
+        options.entropy_tables = 4;
+        options.stats_sample_ratio = 0.25;
+    }, kFormatFlagEntropyTables},
+    {"CellsPacked", DbType::kCells, [](DwarfIdeaBuilderOptions& options)
+    {
+        options.packed_coords = true;
+    }, kFormatFlagPackedCoords},
+    {"CellsSplitKeys", DbType::kCells, [](DwarfIdeaBuilderOptions& options)
+    {
+        // The split costs a byte per block, so it only pays off with the larger blocks.
+        options.max_entries_per_block = 256;
+        options.split_keys = true;
+        options.keys_codec = EntropyCodecType::kRans;
+    }, kFormatFlagSplitKeys | kFormatFlagEntropyCodecs},
+    {"CellsWideCompressedIndex", DbType::kCells, [](DwarfIdeaBuilderOptions& options)
+    {
+        options.wide_offsets = true;
+        options.compressed_index = true;
+        options.membership_filter = true;
+    }, kFormatFlagWideOffsets | kFormatFlagCompressedIndex | kFormatFlagMembershipFilter},
+    {"CellsEytzingerSpatial", DbType::kCells, [](DwarfIdeaBuilderOptions& options)
+    {
+        options.eytzinger_index = true;
+        options.spatial_index = true;
+    }, kFormatFlagEytzingerIndex | kFormatFlagSpatialIndex},
+    {"CellsAllFlags", DbType::kCells, [](DwarfIdeaBuilderOptions& options)
+    {
+        options.coords_quantization = CoordsQuantization::kExact;
+        options.keys_codec = EntropyCodecType::kHuffman;
+        options.transform_chain = TransformChain::kZrlt;
+        options.entropy_tables = 3;
+        options.stats_sample_ratio = 0.5;
+        options.max_entries_per_block = 256;
+        options.split_keys = true;
+        options.wide_offsets = true;
+        options.compressed_index = true;
+        options.membership_filter = true;
+        options.spatial_index = true;
+    }, kFormatFlagCoordsSteps | kFormatFlagEntropyTables | kFormatFlagSplitKeys | kFormatFlagCompressedIndex |
+       kFormatFlagSpatialIndex},
+    {"BssidsDefault", DbType::kBssids, [](DwarfIdeaBuilderOptions&) {}, 0},
+    {"BssidsOuiIndexSpatial", DbType::kBssids, [](DwarfIdeaBuilderOptions& options)
+    {
+        options.oui_index = true;
+        options.spatial_index = true;
+        options.eytzinger_index = true;
+    }, kFormatFlagOuiIndex | kFormatFlagSpatialIndex | kFormatFlagEytzingerIndex},
+    {"BssidsPackedCompressedIndex", DbType::kBssids, [](DwarfIdeaBuilderOptions& options)
+    {
+        options.oui_index = true;
+        options.packed_coords = true;
+        options.compressed_index = true;
+        options.membership_filter = true;
+    }, kFormatFlagOuiIndex | kFormatFlagPackedCoords | kFormatFlagCompressedIndex},
+    {"BssidsRansEntropyTables", DbType::kBssids, [](DwarfIdeaBuilderOptions& options)
+    {
+        options.keys_codec = options.coords_codec = EntropyCodecType::kRans;
+        options.transform_chain = TransformChain::kDelta;
+        options.entropy_tables = 4;
+        options.stats_sample_ratio = 0.3;
+        options.spatial_index = true;
+    }, kFormatFlagEntropyCodecs | kFormatFlagEntropyTables | kFormatFlagSpatialIndex},
+};
+
+INSTANTIATE_TEST_SUITE_P(AllFlags, RoundTripTest, ::testing::ValuesIn(kRoundTripParams),
+    [](const ::testing::TestParamInfo<RoundTripParams>& info) { return std::string(info.param.name); });
+
+} // namespace